@@ -13,9 +13,10 @@ using namespace aon;
 void Actor::forward(
     const Int2 &column_pos,
     const Array<Int_Buffer_View> &input_cis,
+    State &stream,
     unsigned long* state,
     const Params &params
-) {
+) const {
     int hidden_column_index = address2(column_pos, Int2(hidden_size.x, hidden_size.y));
 
     int hidden_cells_start = hidden_column_index * hidden_size.z;
@@ -24,14 +25,17 @@ void Actor::forward(
     for (int hc = 0; hc < hidden_size.z; hc++) {
         int hidden_cell_index = hc + hidden_cells_start;
 
-        hidden_acts[hidden_cell_index] = 0.0f;
+        stream.hidden_acts[hidden_cell_index] = 0.0f;
     }
 
+    // weights are those of the learner if shared
+    const Actor &model = (learner.p == nullptr ? *this : *learner.p);
+
     float value = 0.0f;
     int count = 0;
 
     for (int vli = 0; vli < visible_layers.size(); vli++) {
-        Visible_Layer &vl = visible_layers[vli];
+        const Visible_Layer &vl = model.visible_layers[vli];
         const Visible_Layer_Desc &vld = visible_layer_descs[vli];
 
         int diam = vld.radius * 2 + 1;
@@ -61,33 +65,46 @@ void Actor::forward(
 
                 Int2 offset(ix - field_lower_bound.x, iy - field_lower_bound.y);
 
-                int wi_value = offset.y + diam * (offset.x + diam * (in_ci + vld.size.z * hidden_column_index));
-                int wi_start = hidden_size.z * wi_value;
+                Index wi_value = offset.y + diam * (offset.x + diam * (in_ci + vld.size.z * static_cast<Index>(hidden_column_index)));
+                Index wi_start = hidden_size.z * wi_value;
+
+                if (model.fixed_point) {
+                    for (int hc = 0; hc < hidden_size.z; hc++) {
+                        int hidden_cell_index = hc + hidden_cells_start;
 
-                for (int hc = 0; hc < hidden_size.z; hc++) {
-                    int hidden_cell_index = hc + hidden_cells_start;
+                        Index wi = hc + wi_start;
 
-                    int wi = hc + wi_start;
+                        stream.hidden_acts[hidden_cell_index] += vl.action_weights_fixed[wi] * actor_fixed_scale_inv;
+                    }
 
-                    hidden_acts[hidden_cell_index] += vl.action_weights[wi];
+                    value += vl.value_weights_fixed[wi_value] * actor_fixed_scale_inv;
                 }
+                else {
+                    for (int hc = 0; hc < hidden_size.z; hc++) {
+                        int hidden_cell_index = hc + hidden_cells_start;
+
+                        Index wi = hc + wi_start;
 
-                value += vl.value_weights[wi_value];
+                        stream.hidden_acts[hidden_cell_index] += vl.action_weights[wi];
+                    }
+
+                    value += vl.value_weights[wi_value];
+                }
             }
     }
 
     value /= count;
 
-    hidden_values[hidden_column_index] = value;
+    stream.hidden_values[hidden_column_index] = value;
 
     float max_activation = limit_min;
 
     for (int hc = 0; hc < hidden_size.z; hc++) {
         int hidden_cell_index = hc + hidden_cells_start;
 
-        hidden_acts[hidden_cell_index] /= count;
+        stream.hidden_acts[hidden_cell_index] /= count;
 
-        max_activation = max(max_activation, hidden_acts[hidden_cell_index]);
+        max_activation = max(max_activation, stream.hidden_acts[hidden_cell_index]);
     }
     
     float total = 0.0f;
@@ -95,9 +112,9 @@ void Actor::forward(
     for (int hc = 0; hc < hidden_size.z; hc++) {
         int hidden_cell_index = hc + hidden_cells_start;
 
-        hidden_acts[hidden_cell_index] = expf(hidden_acts[hidden_cell_index] - max_activation);
+        stream.hidden_acts[hidden_cell_index] = expf(stream.hidden_acts[hidden_cell_index] - max_activation);
         
-        total += hidden_acts[hidden_cell_index];
+        total += stream.hidden_acts[hidden_cell_index];
     }
 
     float cusp = randf(state) * total;
@@ -108,7 +125,7 @@ void Actor::forward(
     for (int hc = 0; hc < hidden_size.z; hc++) {
         int hidden_cell_index = hc + hidden_cells_start;
 
-        sum_so_far += hidden_acts[hidden_cell_index];
+        sum_so_far += stream.hidden_acts[hidden_cell_index];
 
         if (sum_so_far >= cusp) {
             select_index = hc;
@@ -117,26 +134,28 @@ void Actor::forward(
         }
     }
     
-    hidden_cis[hidden_column_index] = select_index;
+    stream.hidden_cis[hidden_column_index] = select_index;
 }
 
 void Actor::learn(
     const Int2 &column_pos,
+    const State &stream,
     int t,
     float r,
     float d,
     float mimic,
+    unsigned long* state,
     const Params &params
 ) {
     int hidden_column_index = address2(column_pos, Int2(hidden_size.x, hidden_size.y));
 
     int hidden_cells_start = hidden_column_index * hidden_size.z;
 
-    int target_ci = history_samples[t - 1].hidden_target_cis_prev[hidden_column_index];
+    int target_ci = get_history_hidden_target_cis_prev(stream, t - 1)[hidden_column_index];
 
     // --- value prev ---
 
-    float new_value = r + d * hidden_values[hidden_column_index];
+    float new_value = r + d * stream.hidden_values[hidden_column_index];
 
     float value = 0.0f;
     int count = 0;
@@ -162,15 +181,22 @@ void Actor::learn(
 
         count += (iter_upper_bound.x - iter_lower_bound.x + 1) * (iter_upper_bound.y - iter_lower_bound.y + 1);
 
+        Int_Buffer_View vl_input_cis = get_history_input_cis(stream, t, vli);
+
         for (int ix = iter_lower_bound.x; ix <= iter_upper_bound.x; ix++)
             for (int iy = iter_lower_bound.y; iy <= iter_upper_bound.y; iy++) {
                 int visible_column_index = address2(Int2(ix, iy), Int2(vld.size.x, vld.size.y));
 
-                int in_ci = history_samples[t].input_cis[vli][visible_column_index];
+                int in_ci = vl_input_cis[visible_column_index];
 
                 Int2 offset(ix - field_lower_bound.x, iy - field_lower_bound.y);
 
-                value += vl.value_weights[offset.y + diam * (offset.x + diam * (in_ci + vld.size.z * hidden_column_index))];
+                Index wi_value = offset.y + diam * (offset.x + diam * (in_ci + vld.size.z * static_cast<Index>(hidden_column_index)));
+
+                if (fixed_point)
+                    value += vl.value_weights_fixed[wi_value] * actor_fixed_scale_inv;
+                else
+                    value += vl.value_weights[wi_value];
             }
     }
 
@@ -182,7 +208,7 @@ void Actor::learn(
     for (int hc = 0; hc < hidden_size.z; hc++) {
         int hidden_cell_index = hc + hidden_cells_start;
 
-        hidden_acts[hidden_cell_index] = 0.0f;
+        hidden_deltas[hidden_cell_index] = 0.0f;
     }
 
     float delta_value = params.vlr * td_error_value;
@@ -206,26 +232,44 @@ void Actor::learn(
         Int2 iter_lower_bound(max(0, field_lower_bound.x), max(0, field_lower_bound.y));
         Int2 iter_upper_bound(min(vld.size.x - 1, visible_center.x + vld.radius), min(vld.size.y - 1, visible_center.y + vld.radius));
 
+        Int_Buffer_View vl_input_cis = get_history_input_cis(stream, t, vli);
+
         for (int ix = iter_lower_bound.x; ix <= iter_upper_bound.x; ix++)
             for (int iy = iter_lower_bound.y; iy <= iter_upper_bound.y; iy++) {
                 int visible_column_index = address2(Int2(ix, iy), Int2(vld.size.x, vld.size.y));
 
-                int in_ci = history_samples[t].input_cis[vli][visible_column_index];
+                int in_ci = vl_input_cis[visible_column_index];
 
                 Int2 offset(ix - field_lower_bound.x, iy - field_lower_bound.y);
 
-                int wi_value = offset.y + diam * (offset.x + diam * (in_ci + vld.size.z * hidden_column_index));
-                int wi_start = hidden_size.z * wi_value;
+                Index wi_value = offset.y + diam * (offset.x + diam * (in_ci + vld.size.z * static_cast<Index>(hidden_column_index)));
+                Index wi_start = hidden_size.z * wi_value;
 
-                for (int hc = 0; hc < hidden_size.z; hc++) {
-                    int hidden_cell_index = hc + hidden_cells_start;
+                // the action update below touches the same rows
+                vl.dirty[in_ci + vld.size.z * hidden_column_index] = true;
 
-                    int wi = hc + wi_start;
+                if (fixed_point) {
+                    for (int hc = 0; hc < hidden_size.z; hc++) {
+                        int hidden_cell_index = hc + hidden_cells_start;
 
-                    hidden_acts[hidden_cell_index] += vl.action_weights[wi];
+                        Index wi = hc + wi_start;
+
+                        hidden_deltas[hidden_cell_index] += vl.action_weights_fixed[wi] * actor_fixed_scale_inv;
+                    }
+
+                    vl.value_weights_fixed[wi_value] = min(32767, max(-32768, vl.value_weights_fixed[wi_value] + rand_roundf(delta_value * actor_fixed_scale, state)));
                 }
+                else {
+                    for (int hc = 0; hc < hidden_size.z; hc++) {
+                        int hidden_cell_index = hc + hidden_cells_start;
+
+                        Index wi = hc + wi_start;
 
-                vl.value_weights[wi_value] += delta_value;
+                        hidden_deltas[hidden_cell_index] += vl.action_weights[wi];
+                    }
+
+                    vl.value_weights[wi_value] += delta_value;
+                }
             }
     }
 
@@ -236,9 +280,9 @@ void Actor::learn(
     for (int hc = 0; hc < hidden_size.z; hc++) {
         int hidden_cell_index = hc + hidden_cells_start;
 
-        hidden_acts[hidden_cell_index] /= count;
+        hidden_deltas[hidden_cell_index] /= count;
 
-        max_activation = max(max_activation, hidden_acts[hidden_cell_index]);
+        max_activation = max(max_activation, hidden_deltas[hidden_cell_index]);
     }
 
     float total = 0.0f;
@@ -246,9 +290,9 @@ void Actor::learn(
     for (int hc = 0; hc < hidden_size.z; hc++) {
         int hidden_cell_index = hc + hidden_cells_start;
 
-        hidden_acts[hidden_cell_index] = expf(hidden_acts[hidden_cell_index] - max_activation);
+        hidden_deltas[hidden_cell_index] = expf(hidden_deltas[hidden_cell_index] - max_activation);
 
-        total += hidden_acts[hidden_cell_index];
+        total += hidden_deltas[hidden_cell_index];
     }
 
     float total_inv = 1.0f / max(limit_small, total);
@@ -258,10 +302,10 @@ void Actor::learn(
     for (int hc = 0; hc < hidden_size.z; hc++) {
         int hidden_cell_index = hc + hidden_cells_start;
 
-        hidden_acts[hidden_cell_index] *= total_inv;
+        hidden_deltas[hidden_cell_index] *= total_inv;
 
         // re-use as deltas
-        hidden_acts[hidden_cell_index] = rate * ((hc == target_ci) - hidden_acts[hidden_cell_index]);
+        hidden_deltas[hidden_cell_index] = rate * ((hc == target_ci) - hidden_deltas[hidden_cell_index]);
     }
 
     for (int vli = 0; vli < visible_layers.size(); vli++) {
@@ -283,22 +327,35 @@ void Actor::learn(
         Int2 iter_lower_bound(max(0, field_lower_bound.x), max(0, field_lower_bound.y));
         Int2 iter_upper_bound(min(vld.size.x - 1, visible_center.x + vld.radius), min(vld.size.y - 1, visible_center.y + vld.radius));
 
+        Int_Buffer_View vl_input_cis = get_history_input_cis(stream, t, vli);
+
         for (int ix = iter_lower_bound.x; ix <= iter_upper_bound.x; ix++)
             for (int iy = iter_lower_bound.y; iy <= iter_upper_bound.y; iy++) {
                 int visible_column_index = address2(Int2(ix, iy), Int2(vld.size.x, vld.size.y));
 
-                int in_ci = history_samples[t].input_cis[vli][visible_column_index];
+                int in_ci = vl_input_cis[visible_column_index];
 
                 Int2 offset(ix - field_lower_bound.x, iy - field_lower_bound.y);
 
-                int wi_start = hidden_size.z * (offset.y + diam * (offset.x + diam * (in_ci + vld.size.z * hidden_column_index)));
+                Index wi_start = hidden_size.z * (offset.y + diam * (offset.x + diam * (in_ci + vld.size.z * static_cast<Index>(hidden_column_index))));
 
-                for (int hc = 0; hc < hidden_size.z; hc++) {
-                    int hidden_cell_index = hc + hidden_cells_start;
+                if (fixed_point) {
+                    for (int hc = 0; hc < hidden_size.z; hc++) {
+                        int hidden_cell_index = hc + hidden_cells_start;
 
-                    int wi = hc + wi_start;
+                        Index wi = hc + wi_start;
 
-                    vl.action_weights[wi] += hidden_acts[hidden_cell_index];
+                        vl.action_weights_fixed[wi] = min(32767, max(-32768, vl.action_weights_fixed[wi] + rand_roundf(hidden_deltas[hidden_cell_index] * actor_fixed_scale, state)));
+                    }
+                }
+                else {
+                    for (int hc = 0; hc < hidden_size.z; hc++) {
+                        int hidden_cell_index = hc + hidden_cells_start;
+
+                        Index wi = hc + wi_start;
+
+                        vl.action_weights[wi] += hidden_deltas[hidden_cell_index];
+                    }
                 }
             }
     }
@@ -307,18 +364,29 @@ void Actor::learn(
 void Actor::init_random(
     const Int3 &hidden_size,
     int history_capacity,
-    const Array<Visible_Layer_Desc> &visible_layer_descs
+    const Array<Visible_Layer_Desc> &visible_layer_descs,
+    unsigned int seed
 ) {
     this->visible_layer_descs = visible_layer_descs;
 
     this->hidden_size = hidden_size;
 
+    rand_state = rand_get_state(seed);
+
+    this->history_capacity = history_capacity;
+
+    fixed_point = false;
+
+    learner.p = nullptr;
+
     visible_layers.resize(visible_layer_descs.size());
 
     // pre-compute dimensions
     int num_hidden_columns = hidden_size.x * hidden_size.y;
     int num_hidden_cells = num_hidden_columns * hidden_size.z;
 
+    spill_stride = num_hidden_columns;
+
     for (int vli = 0; vli < visible_layers.size(); vli++) {
         Visible_Layer &vl = visible_layers[vli];
         Visible_Layer_Desc &vld = this->visible_layer_descs[vli];
@@ -326,76 +394,107 @@ void Actor::init_random(
         int num_visible_columns = vld.size.x * vld.size.y;
         int num_visible_cells = num_visible_columns * vld.size.z;
 
+        spill_stride += num_visible_columns;
+
         int diam = vld.radius * 2 + 1;
         int area = diam * diam;
 
         // create weight matrix for this visible layer and initialize randomly
-        vl.value_weights.resize(num_hidden_columns * area * vld.size.z);
+        vl.value_weights.resize(static_cast<Index>(num_hidden_columns) * area * vld.size.z);
+
+        for (Index i = 0; i < vl.value_weights.size(); i++)
+            vl.value_weights[i] = randf(-init_weight_noisef, init_weight_noisef, &rand_state);
 
-        for (int i = 0; i < vl.value_weights.size(); i++)
-            vl.value_weights[i] = randf(-init_weight_noisef, init_weight_noisef);
+        vl.action_weights.resize(static_cast<Index>(num_hidden_cells) * area * vld.size.z);
 
-        vl.action_weights.resize(num_hidden_cells * area * vld.size.z);
+        for (Index i = 0; i < vl.action_weights.size(); i++)
+            vl.action_weights[i] = randf(-init_weight_noisef, init_weight_noisef, &rand_state);
 
-        for (int i = 0; i < vl.action_weights.size(); i++)
-            vl.action_weights[i] = randf(-init_weight_noisef, init_weight_noisef);
+        vl.dirty = Byte_Buffer(num_hidden_columns * vld.size.z, false);
     }
 
-    hidden_cis = Int_Buffer(num_hidden_columns, 0);
+    hidden_deltas.resize(num_hidden_cells);
+}
 
-    hidden_values = Float_Buffer(num_hidden_columns, 0.0f);
+void Actor::init_state(
+    State &state,
+    unsigned int seed
+) const {
+    int num_hidden_columns = hidden_size.x * hidden_size.y;
+
+    state.hidden_cis = Int_Buffer(num_hidden_columns, 0);
+
+    state.hidden_values = Float_Buffer(num_hidden_columns, 0.0f);
 
-    hidden_acts.resize(num_hidden_cells);
+    state.hidden_acts = Float_Buffer(num_hidden_columns * hidden_size.z, 0.0f);
+
+    state.spill.unmap();
+    state.spill_rewards.resize(0);
+    state.spill_rewards.start = 0;
 
     // create (pre-allocated) history samples
-    history_size = 0;
-    history_samples.resize(history_capacity);
+    state.history_size = 0;
+    state.history_samples.resize(history_capacity);
+    state.history_samples.start = 0;
 
-    for (int i = 0; i < history_samples.size(); i++) {
-        history_samples[i].input_cis.resize(visible_layers.size());
+    for (int i = 0; i < state.history_samples.size(); i++) {
+        state.history_samples[i].input_cis.resize(visible_layers.size());
 
         for (int vli = 0; vli < visible_layers.size(); vli++) {
-            Visible_Layer_Desc &vld = this->visible_layer_descs[vli];
-
-            int num_visible_columns = vld.size.x * vld.size.y;
+            const Visible_Layer_Desc &vld = visible_layer_descs[vli];
 
-            history_samples[i].input_cis[vli] = Int_Buffer(num_visible_columns);
+            state.history_samples[i].input_cis[vli] = Int_Buffer(vld.size.x * vld.size.y, 0);
         }
 
-        history_samples[i].hidden_target_cis_prev = Int_Buffer(num_hidden_columns);
+        state.history_samples[i].hidden_target_cis_prev = Int_Buffer(num_hidden_columns, 0);
+
+        state.history_samples[i].reward = 0.0f;
     }
+
+    state.rand_state = rand_get_state(seed);
 }
 
-void Actor::step(
+void Actor::add_sample(
+    State &state,
     const Array<Int_Buffer_View> &input_cis,
     Int_Buffer_View hidden_target_cis_prev,
-    float reward,
-    bool learn_enabled,
-    float mimic,
-    const Params &params
-) {
-    int num_hidden_columns = hidden_size.x * hidden_size.y;
+    float reward
+) const {
+    // if resident samples are full, move the oldest one to the spill before it is overwritten
+    if (state.spill_rewards.size() > 0 && state.history_size >= state.history_samples.size()) {
+        state.spill_rewards.push_front();
 
-    // forward kernel
-    unsigned int base_state = rand();
+        const History_Sample &s = state.history_samples.back();
+
+        int* record = get_spill_record(state, 0);
 
-    PARALLEL_FOR
-    for (int i = 0; i < num_hidden_columns; i++) {
-        unsigned long state = rand_get_state(base_state + i * rand_subseed_offset);
+        for (int vli = 0; vli < visible_layers.size(); vli++) {
+            for (int i = 0; i < s.input_cis[vli].size(); i++)
+                record[i] = s.input_cis[vli][i];
+
+            record += s.input_cis[vli].size();
+        }
 
-        forward(Int2(i / hidden_size.y, i % hidden_size.y), input_cis, &state, params);
+        for (int i = 0; i < s.hidden_target_cis_prev.size(); i++)
+            record[i] = s.hidden_target_cis_prev[i];
+
+        state.spill_rewards.front() = s.reward;
+
+        long record_size = spill_stride * sizeof(int);
+
+        state.spill.evict(state.spill_rewards.start * record_size, record_size);
     }
 
-    history_samples.push_front();
+    state.history_samples.push_front();
 
     // if not at cap, increment
-    if (history_size < history_samples.size())
-        history_size++;
+    if (state.history_size < history_capacity)
+        state.history_size++;
     
     // add new sample
     // note: is like .clone() in Rust
     {
-        History_Sample &s = history_samples[0];
+        History_Sample &s = state.history_samples[0];
 
         for (int vli = 0; vli < visible_layers.size(); vli++)
             s.input_cis[vli] = input_cis[vli];
@@ -405,75 +504,397 @@ void Actor::step(
 
         s.reward = reward;
     }
+}
 
-    // learn (if have sufficient samples)
-    if (learn_enabled && history_size > params.min_steps) {
-        for (int it = 0; it < params.history_iters; it++) {
-            int t = rand() % (history_size - params.min_steps) + params.min_steps;
+void Actor::learn_history(
+    State &state,
+    float mimic,
+    const Params &params,
+    unsigned long* rand_state
+) {
+    // a shared learner does this separately
+    if (learner.p != nullptr || state.history_size <= params.min_steps)
+        return;
+
+    if (rand_state == nullptr)
+        rand_state = &state.rand_state;
+
+    int num_hidden_columns = hidden_size.x * hidden_size.y;
 
-            // compute (partial) values, rest is completed in the kernel
-            float r = 0.0f;
-            float d = 1.0f;
+    learn_ts.resize(params.history_iters);
 
-            for (int t2 = t - 1; t2 >= 0; t2--) {
-                r += history_samples[t2].reward * d;
+    for (int it = 0; it < params.history_iters; it++) {
+        int t = rand(rand_state) % (state.history_size - params.min_steps) + params.min_steps;
 
-                d *= params.discount;
+        learn_ts[it] = t;
+
+        // fetch spilled samples ahead of the sweep
+        if (t >= state.history_samples.size()) {
+            long record_size = spill_stride * sizeof(int);
+
+            state.spill.prefetch(((state.spill_rewards.start + t - state.history_samples.size()) % state.spill_rewards.size()) * record_size, record_size);
+
+            if (t - 1 >= state.history_samples.size())
+                state.spill.prefetch(((state.spill_rewards.start + t - 1 - state.history_samples.size()) % state.spill_rewards.size()) * record_size, record_size);
+        }
+    }
+
+    for (int it = 0; it < params.history_iters; it++) {
+        int t = learn_ts[it];
+
+        // compute (partial) values, rest is completed in the kernel
+        float r = 0.0f;
+        float d = 1.0f;
+
+        for (int t2 = t - 1; t2 >= 0; t2--) {
+            r += get_history_reward(state, t2) * d;
+
+            d *= params.discount;
+        }
+
+        unsigned int base_state = rand(rand_state);
+
+        {
+            TRACE_PARALLEL_FOR("actor learn")
+            for (int i = 0; i < num_hidden_columns; i++) {
+                unsigned long learn_state = rand_get_state(base_state + i * rand_subseed_offset);
+
+                learn(Int2(i / hidden_size.y, i % hidden_size.y), state, t, r, d, mimic, &learn_state, params);
             }
+        }
+    }
+}
+
+void Actor::act(
+    State &state,
+    const Array<Int_Buffer_View> &input_cis,
+    Int_Buffer_View hidden_target_cis_prev,
+    float reward,
+    const Params &params,
+    unsigned long* rand_state
+) const {
+    if (rand_state == nullptr)
+        rand_state = &state.rand_state;
 
-            PARALLEL_FOR
-            for (int i = 0; i < num_hidden_columns; i++)
-                learn(Int2(i / hidden_size.y, i % hidden_size.y), t, r, d, mimic, params);
+    int num_hidden_columns = hidden_size.x * hidden_size.y;
+
+    // forward kernel
+    unsigned int base_state = rand(rand_state);
+
+    {
+        TRACE_PARALLEL_FOR("actor forward")
+        for (int i = 0; i < num_hidden_columns; i++) {
+            unsigned long forward_state = rand_get_state(base_state + i * rand_subseed_offset);
+
+            forward(Int2(i / hidden_size.y, i % hidden_size.y), input_cis, state, &forward_state, params);
         }
     }
+
+    if (state.history_samples.size() > 0)
+        add_sample(state, input_cis, hidden_target_cis_prev, reward);
 }
 
-void Actor::clear_state() {
-    hidden_cis.fill(0);
-    hidden_values.fill(0.0f);
+void Actor::step(
+    State &state,
+    const Array<Int_Buffer_View> &input_cis,
+    Int_Buffer_View hidden_target_cis_prev,
+    float reward,
+    bool learn_enabled,
+    float mimic,
+    const Params &params,
+    unsigned long* rand_state
+) {
+    state.stepping = true;
+
+    act(state, input_cis, hidden_target_cis_prev, reward, params, rand_state);
+
+    // learn (if have sufficient samples)
+    if (learn_enabled)
+        learn_history(state, mimic, params, rand_state);
 
-    history_size = 0;
+    state.stepping = false;
 }
 
-int Actor::size() const {
-    int size = sizeof(Int3) + hidden_cis.size() * sizeof(int) + hidden_values.size() * sizeof(float) + sizeof(int);
+void Actor::step_batch(
+    Array_View<State*> states,
+    Array_View<const Array<Int_Buffer_View>*> input_cis,
+    Array_View<Int_Buffer_View> hidden_target_cis_prev,
+    Float_Buffer_View rewards,
+    Byte_Buffer_View learn_enabled,
+    float mimic,
+    const Params &params,
+    unsigned long* rand_state
+) {
+    int num_hidden_columns = hidden_size.x * hidden_size.y;
 
-    for (int vli = 0; vli < visible_layers.size(); vli++) {
-        const Visible_Layer &vl = visible_layers[vli];
-        const Visible_Layer_Desc &vld = visible_layer_descs[vli];
+    if (batch_base_states.size() < states.size())
+        batch_base_states.resize(states.size());
+
+    for (int b = 0; b < states.size(); b++) {
+        batch_base_states[b] = rand(rand_state == nullptr ? &states[b]->rand_state : rand_state);
 
-        size += sizeof(Visible_Layer_Desc) + vl.value_weights.size() * sizeof(float) + vl.action_weights.size() * sizeof(float);
+        states[b]->stepping = true;
     }
 
-    size += 3 * sizeof(int);
+    {
+        // forward kernel
+        TRACE_PARALLEL_FOR("actor forward batch")
+        for (int i = 0; i < num_hidden_columns; i++) {
+            Int2 column_pos(i / hidden_size.y, i % hidden_size.y);
 
-    int sample_size = 0;
+            for (int b = 0; b < states.size(); b++) {
+                unsigned long forward_state = rand_get_state(batch_base_states[b] + i * rand_subseed_offset);
 
-    const History_Sample &s = history_samples[0];
+                forward(column_pos, *input_cis[b], *states[b], &forward_state, params);
+            }
+        }
+    }
 
-    for (int vli = 0; vli < visible_layers.size(); vli++)
-        sample_size += s.input_cis[vli].size() * sizeof(int);
+    for (int b = 0; b < states.size(); b++) {
+        if (states[b]->history_samples.size() > 0)
+            add_sample(*states[b], *input_cis[b], hidden_target_cis_prev[b], rewards[b]);
 
-    sample_size += s.hidden_target_cis_prev.size() * sizeof(int) + sizeof(float);
+        if (learn_enabled[b])
+            learn_history(*states[b], mimic, params, rand_state);
 
-    size += history_samples.size() * sample_size;
+        states[b]->stepping = false;
+    }
+}
 
-    return size;
+void Actor::clear_state(
+    State &state
+) const {
+    state.hidden_cis.fill(0);
+    state.hidden_values.fill(0.0f);
+
+    state.history_size = 0;
 }
 
-int Actor::state_size() const {
-    int size = hidden_cis.size() * sizeof(int) + hidden_values.size() * sizeof(float) + 2 * sizeof(int);
+void Actor::place(
+    Arena &arena
+) {
+    for (int vli = 0; vli < visible_layers.size(); vli++) {
+        Visible_Layer &vl = visible_layers[vli];
 
-    int sample_size = 0;
+        // only one of the float and fixed-point pairs is in use
+        arena.place(vl.value_weights);
+        arena.place(vl.action_weights);
+        arena.place(vl.value_weights_fixed);
+        arena.place(vl.action_weights_fixed);
+    }
 
-    const History_Sample &s = history_samples[0];
+    arena.place(hidden_deltas);
 
     for (int vli = 0; vli < visible_layers.size(); vli++)
-        sample_size += s.input_cis[vli].size() * sizeof(int);
+        arena.place(visible_layers[vli].dirty);
+}
+
+void Actor::fork_state(
+    const State &src,
+    State &dst
+) const {
+    dst.hidden_cis = src.hidden_cis;
+    dst.hidden_values = src.hidden_values;
+    dst.hidden_acts = src.hidden_acts;
+
+    dst.rand_state = src.rand_state;
+
+    // no history
+    dst.history_size = 0;
+    dst.history_samples.resize(0);
+    dst.history_samples.start = 0;
+
+    dst.spill.unmap();
+    dst.spill_rewards.resize(0);
+    dst.spill_rewards.start = 0;
+}
+
+void Actor::learn_streams(
+    const Array<const State*> &streams,
+    float mimic,
+    const Params &params
+) {
+    int num_hidden_columns = hidden_size.x * hidden_size.y;
+
+    // total number of usable samples, so sampling is uniform over all streams
+    int total_samples = 0;
+
+    for (int si = 0; si < streams.size(); si++) {
+        assert(!streams[si]->stepping); // must run between steps
+
+        total_samples += max(0, streams[si]->history_size - params.min_steps);
+    }
+
+    if (total_samples == 0)
+        return;
+
+    for (int it = 0; it < params.history_iters; it++) {
+        int index = rand(&rand_state) % total_samples;
+
+        int si = 0;
+
+        while (index >= max(0, streams[si]->history_size - params.min_steps)) {
+            index -= max(0, streams[si]->history_size - params.min_steps);
+            si++;
+        }
+
+        const State &stream = *streams[si];
+
+        int t = index + params.min_steps;
+
+        // compute (partial) values, rest is completed in the kernel
+        float r = 0.0f;
+        float d = 1.0f;
+
+        for (int t2 = t - 1; t2 >= 0; t2--) {
+            r += get_history_reward(stream, t2) * d;
+
+            d *= params.discount;
+        }
+
+        unsigned int base_state = rand(&rand_state);
+
+        {
+            TRACE_PARALLEL_FOR("actor learn")
+            for (int i = 0; i < num_hidden_columns; i++) {
+                unsigned long state = rand_get_state(base_state + i * rand_subseed_offset);
+
+                learn(Int2(i / hidden_size.y, i % hidden_size.y), stream, t, r, d, mimic, &state, params);
+            }
+        }
+    }
+}
+
+bool Actor::set_history_spill(
+    State &state,
+    const char* file_name,
+    int resident_capacity
+) const {
+    int num_hidden_columns = hidden_size.x * hidden_size.y;
+
+    int spill_capacity = (file_name == nullptr ? 0 : max(0, history_capacity - max(1, resident_capacity)));
+
+    if (spill_capacity > 0) {
+        if (!state.spill.map(file_name, static_cast<long>(spill_capacity) * spill_stride * sizeof(int)))
+            return false;
+    }
+    else
+        state.spill.unmap();
+
+    state.spill_rewards.resize(spill_capacity);
+    state.spill_rewards.start = 0;
+
+    state.history_size = 0;
+    state.history_samples.resize(history_capacity - spill_capacity);
+    state.history_samples.start = 0;
+
+    for (int i = 0; i < state.history_samples.size(); i++) {
+        state.history_samples[i].input_cis.resize(visible_layers.size());
+
+        for (int vli = 0; vli < visible_layers.size(); vli++) {
+            const Visible_Layer_Desc &vld = visible_layer_descs[vli];
+
+            state.history_samples[i].input_cis[vli].resize(vld.size.x * vld.size.y);
+        }
+
+        state.history_samples[i].hidden_target_cis_prev.resize(num_hidden_columns);
+    }
+
+    return true;
+}
+
+// quantize a weight, counting it if it lies outside the fixed-point range and is clamped
+static short to_fixed(
+    float weight,
+    int &num_clamped
+) {
+    int scaled = aon::roundf(weight * actor_fixed_scale);
+
+    if (scaled < -32768 || scaled > 32767)
+        num_clamped++;
+
+    return aon::min(32767, aon::max(-32768, scaled));
+}
+
+int Actor::set_fixed_point(
+    bool fixed_point
+) {
+    if (this->fixed_point == fixed_point)
+        return 0;
+
+    int num_clamped = 0;
+
+    this->fixed_point = fixed_point;
+
+    for (int vli = 0; vli < visible_layers.size(); vli++) {
+        Visible_Layer &vl = visible_layers[vli];
 
-    sample_size += s.hidden_target_cis_prev.size() * sizeof(int) + sizeof(float);
+        // all weights change representation
+        vl.dirty.fill(true);
 
-    size += history_samples.size() * sample_size;
+        if (fixed_point) {
+            vl.value_weights_fixed.resize(vl.value_weights.size());
+
+            for (Index i = 0; i < vl.value_weights.size(); i++)
+                vl.value_weights_fixed[i] = to_fixed(vl.value_weights[i], num_clamped);
+
+            vl.action_weights_fixed.resize(vl.action_weights.size());
+
+            for (Index i = 0; i < vl.action_weights.size(); i++)
+                vl.action_weights_fixed[i] = to_fixed(vl.action_weights[i], num_clamped);
+
+            // release float storage
+            vl.value_weights.resize(0);
+            vl.action_weights.resize(0);
+        }
+        else {
+            vl.value_weights.resize(vl.value_weights_fixed.size());
+
+            for (Index i = 0; i < vl.value_weights_fixed.size(); i++)
+                vl.value_weights[i] = vl.value_weights_fixed[i] * actor_fixed_scale_inv;
+
+            vl.action_weights.resize(vl.action_weights_fixed.size());
+
+            for (Index i = 0; i < vl.action_weights_fixed.size(); i++)
+                vl.action_weights[i] = vl.action_weights_fixed[i] * actor_fixed_scale_inv;
+
+            // release fixed-point storage
+            vl.value_weights_fixed.resize(0);
+            vl.action_weights_fixed.resize(0);
+        }
+    }
+
+    return num_clamped;
+}
+
+long long Actor::size() const {
+    long long size = 2 * sizeof(int) + sizeof(Int3) + 2 * sizeof(int);
+
+    for (int vli = 0; vli < visible_layers.size(); vli++) {
+        const Visible_Layer &vl = visible_layers[vli];
+
+        size += sizeof(Visible_Layer_Desc);
+
+        if (fixed_point)
+            size += vl.value_weights_fixed.size() * sizeof(short) + vl.action_weights_fixed.size() * sizeof(short);
+        else
+            size += vl.value_weights.size() * sizeof(float) + vl.action_weights.size() * sizeof(float);
+    }
+
+    size += sizeof(int);
+
+    return size;
+}
+
+long long Actor::state_size() const {
+    int num_hidden_columns = hidden_size.x * hidden_size.y;
+
+    long long size = num_hidden_columns * sizeof(int) + num_hidden_columns * sizeof(float) + 2 * sizeof(int);
+
+    // a sample is the same as a spill record plus its reward
+    long long sample_size = spill_stride * sizeof(int) + sizeof(float);
+
+    size += history_capacity * sample_size;
 
     return size;
 }
@@ -481,10 +902,15 @@ int Actor::state_size() const {
 void Actor::write(
     Stream_Writer &writer
 ) const {
+    writer.write(reinterpret_cast<const void*>(&actor_magic), sizeof(int));
+    writer.write(reinterpret_cast<const void*>(&actor_version), sizeof(int));
+
     writer.write(reinterpret_cast<const void*>(&hidden_size), sizeof(Int3));
 
-    writer.write(reinterpret_cast<const void*>(&hidden_cis[0]), hidden_cis.size() * sizeof(int));
-    writer.write(reinterpret_cast<const void*>(&hidden_values[0]), hidden_values.size() * sizeof(float));
+    // an int keeps the weights that follow aligned
+    int fixed_point_int = fixed_point;
+
+    writer.write(reinterpret_cast<const void*>(&fixed_point_int), sizeof(int));
 
     int num_visible_layers = visible_layers.size();
 
@@ -496,47 +922,89 @@ void Actor::write(
 
         writer.write(reinterpret_cast<const void*>(&vld), sizeof(Visible_Layer_Desc));
 
-        writer.write(reinterpret_cast<const void*>(&vl.value_weights[0]), vl.value_weights.size() * sizeof(float));
-        writer.write(reinterpret_cast<const void*>(&vl.action_weights[0]), vl.action_weights.size() * sizeof(float));
+        if (fixed_point) {
+            writer.write(reinterpret_cast<const void*>(&vl.value_weights_fixed[0]), vl.value_weights_fixed.size() * sizeof(short));
+            writer.write(reinterpret_cast<const void*>(&vl.action_weights_fixed[0]), vl.action_weights_fixed.size() * sizeof(short));
+        }
+        else {
+            writer.write(reinterpret_cast<const void*>(&vl.value_weights[0]), vl.value_weights.size() * sizeof(float));
+            writer.write(reinterpret_cast<const void*>(&vl.action_weights[0]), vl.action_weights.size() * sizeof(float));
+        }
     }
 
-    writer.write(reinterpret_cast<const void*>(&history_size), sizeof(int));
+    writer.write(reinterpret_cast<const void*>(&history_capacity), sizeof(int));
+}
 
-    int num_history_samples = history_samples.size();
+void Actor::read(
+    Stream_Reader &reader,
+    State* state
+) {
+    int magic;
 
-    writer.write(reinterpret_cast<const void*>(&num_history_samples), sizeof(int));
+    reader.read(reinterpret_cast<void*>(&magic), sizeof(int));
 
-    int history_start = history_samples.start;
+    State legacy_state;
 
-    writer.write(reinterpret_cast<const void*>(&history_start), sizeof(int));
+    if (state == nullptr)
+        state = &legacy_state;
 
-    for (int t = 0; t < history_samples.size(); t++) {
-        const History_Sample &s = history_samples[t];
+    // without a header, the first int is the start of the hidden size
+    if (magic != actor_magic) {
+        hidden_size.x = magic;
 
-        for (int vli = 0; vli < visible_layers.size(); vli++)
-            writer.write(reinterpret_cast<const void*>(&s.input_cis[vli][0]), s.input_cis[vli].size() * sizeof(int));
+        reader.read(reinterpret_cast<void*>(&hidden_size.y), sizeof(Int3) - sizeof(int));
 
-        writer.write(reinterpret_cast<const void*>(&s.hidden_target_cis_prev[0]), s.hidden_target_cis_prev.size() * sizeof(int));
+        read_body(reader, 0, *state);
 
-        writer.write(reinterpret_cast<const void*>(&s.reward), sizeof(float));
+        return;
     }
-}
 
-void Actor::read(
-    Stream_Reader &reader
-) {
+    int version;
+
+    reader.read(reinterpret_cast<void*>(&version), sizeof(int));
+
+    assert(version == actor_version);
+
     reader.read(reinterpret_cast<void*>(&hidden_size), sizeof(Int3));
 
+    read_body(reader, version, *state);
+}
+
+void Actor::read_body(
+    Stream_Reader &reader,
+    int version,
+    State &state
+) {
     int num_hidden_columns = hidden_size.x * hidden_size.y;
     int num_hidden_cells = num_hidden_columns * hidden_size.z;
-    
-    hidden_cis.resize(num_hidden_columns);
-    hidden_values.resize(num_hidden_columns);
 
-    reader.read(reinterpret_cast<void*>(&hidden_cis[0]), hidden_cis.size() * sizeof(int));
-    reader.read(reinterpret_cast<void*>(&hidden_values[0]), hidden_values.size() * sizeof(float));
+    // version 0 stored the recurrent part of its stream here
+    Int_Buffer legacy_hidden_cis;
+    Float_Buffer legacy_hidden_values;
+
+    if (version == 0) {
+        fixed_point = false;
+
+        legacy_hidden_cis.resize(num_hidden_columns);
+        legacy_hidden_values.resize(num_hidden_columns);
+
+        reader.read(reinterpret_cast<void*>(&legacy_hidden_cis[0]), legacy_hidden_cis.size() * sizeof(int));
+        reader.read(reinterpret_cast<void*>(&legacy_hidden_values[0]), legacy_hidden_values.size() * sizeof(float));
+    }
+    else {
+        int fixed_point_int;
 
-    hidden_acts.resize(num_hidden_cells);
+        reader.read(reinterpret_cast<void*>(&fixed_point_int), sizeof(int));
+
+        fixed_point = fixed_point_int;
+    }
+
+    learner.p = nullptr;
+
+    // the stream is not written
+    rand_state = rand_get_state(0);
+    
+    hidden_deltas.resize(num_hidden_cells);
 
     int num_visible_layers;
 
@@ -544,6 +1012,8 @@ void Actor::read(
 
     visible_layers.resize(num_visible_layers);
     visible_layer_descs.resize(num_visible_layers);
+
+    spill_stride = num_hidden_columns;
     
     for (int vli = 0; vli < visible_layers.size(); vli++) {
         Visible_Layer &vl = visible_layers[vli];
@@ -552,100 +1022,243 @@ void Actor::read(
         reader.read(reinterpret_cast<void*>(&vld), sizeof(Visible_Layer_Desc));
 
         int num_visible_columns = vld.size.x * vld.size.y;
-        int num_visible_cells = num_visible_columns * vld.size.z;
+
+        spill_stride += num_visible_columns;
 
         int diam = vld.radius * 2 + 1;
         int area = diam * diam;
 
-        vl.value_weights.resize(num_hidden_columns * area * vld.size.z);
-        vl.action_weights.resize(num_hidden_cells * area * vld.size.z);
+        if (fixed_point) {
+            read_array(reader, vl.value_weights_fixed, static_cast<Index>(num_hidden_columns) * area * vld.size.z);
+            read_array(reader, vl.action_weights_fixed, static_cast<Index>(num_hidden_cells) * area * vld.size.z);
+
+            vl.value_weights.resize(0);
+            vl.action_weights.resize(0);
+        }
+        else {
+            read_array(reader, vl.value_weights, static_cast<Index>(num_hidden_columns) * area * vld.size.z);
+            read_array(reader, vl.action_weights, static_cast<Index>(num_hidden_cells) * area * vld.size.z);
+
+            vl.value_weights_fixed.resize(0);
+            vl.action_weights_fixed.resize(0);
+        }
+
+        vl.dirty = Byte_Buffer(num_hidden_columns * vld.size.z, false);
+    }
+
+    if (version > 0) {
+        reader.read(reinterpret_cast<void*>(&history_capacity), sizeof(int));
 
-        reader.read(reinterpret_cast<void*>(&vl.value_weights[0]), vl.value_weights.size() * sizeof(float));
-        reader.read(reinterpret_cast<void*>(&vl.action_weights[0]), vl.action_weights.size() * sizeof(float));
+        return;
     }
 
+    // the stream state of version 0: history size, number of samples (the capacity), history start and the samples
+    int history_size;
+
     reader.read(reinterpret_cast<void*>(&history_size), sizeof(int));
+    reader.read(reinterpret_cast<void*>(&history_capacity), sizeof(int));
+
+    init_state(state, 0);
 
-    int num_history_samples;
+    state.hidden_cis = legacy_hidden_cis;
+    state.hidden_values = legacy_hidden_values;
 
-    reader.read(reinterpret_cast<void*>(&num_history_samples), sizeof(int));
+    state.history_size = history_size;
 
     int history_start;
 
     reader.read(reinterpret_cast<void*>(&history_start), sizeof(int));
 
-    history_samples.resize(num_history_samples);
-    history_samples.start = history_start;
+    state.history_samples.start = history_start;
+
+    for (int t = 0; t < state.history_samples.size(); t++) {
+        History_Sample &s = state.history_samples[t];
+
+        for (int vli = 0; vli < visible_layers.size(); vli++)
+            reader.read(reinterpret_cast<void*>(&s.input_cis[vli][0]), s.input_cis[vli].size() * sizeof(int));
+
+        reader.read(reinterpret_cast<void*>(&s.hidden_target_cis_prev[0]), s.hidden_target_cis_prev.size() * sizeof(int));
+
+        reader.read(reinterpret_cast<void*>(&s.reward), sizeof(float));
+    }
+}
+
+void Actor::write_state(
+    Stream_Writer &writer,
+    const State &state
+) const {
+    assert(state.history_samples.size() + state.spill_rewards.size() == history_capacity); // not a fork
+
+    writer.write(reinterpret_cast<const void*>(&state.hidden_cis[0]), state.hidden_cis.size() * sizeof(int));
+    writer.write(reinterpret_cast<const void*>(&state.hidden_values[0]), state.hidden_values.size() * sizeof(float));
 
-    for (int t = 0; t < history_samples.size(); t++) {
-        History_Sample &s = history_samples[t];
+    writer.write(reinterpret_cast<const void*>(&state.history_size), sizeof(int));
 
-        s.input_cis.resize(num_visible_layers);
+    // spilled histories are written in order, as if they started at 0
+    int history_start = (state.spill_rewards.size() > 0 ? 0 : state.history_samples.start);
+
+    writer.write(reinterpret_cast<const void*>(&history_start), sizeof(int));
+
+    for (int t = 0; t < history_capacity; t++) {
+        Int_Buffer_View hidden_target_cis_prev = get_history_hidden_target_cis_prev(state, t);
+        float reward = get_history_reward(state, t);
 
         for (int vli = 0; vli < visible_layers.size(); vli++) {
-            const Visible_Layer_Desc &vld = visible_layer_descs[vli];
+            Int_Buffer_View input_cis = get_history_input_cis(state, t, vli);
 
-            int num_visible_columns = vld.size.x * vld.size.y;
+            writer.write(reinterpret_cast<const void*>(&input_cis[0]), input_cis.size() * sizeof(int));
+        }
 
-            s.input_cis[vli].resize(num_visible_columns);
+        writer.write(reinterpret_cast<const void*>(&hidden_target_cis_prev[0]), hidden_target_cis_prev.size() * sizeof(int));
 
-            reader.read(reinterpret_cast<void*>(&s.input_cis[vli][0]), s.input_cis[vli].size() * sizeof(int));
+        writer.write(reinterpret_cast<const void*>(&reward), sizeof(float));
+    }
+}
+
+void Actor::read_state(
+    Stream_Reader &reader,
+    State &state
+) const {
+    // a state that does not belong to this actor yet is allocated with a resident history, otherwise its spill is kept.
+    // its RNG stream is not written, a newly allocated one starts from seed 0
+    if (state.hidden_cis.size() != hidden_size.x * hidden_size.y || state.history_samples.size() + state.spill_rewards.size() != history_capacity)
+        init_state(state, 0);
+
+    reader.read(reinterpret_cast<void*>(&state.hidden_cis[0]), state.hidden_cis.size() * sizeof(int));
+    reader.read(reinterpret_cast<void*>(&state.hidden_values[0]), state.hidden_values.size() * sizeof(float));
+
+    reader.read(reinterpret_cast<void*>(&state.history_size), sizeof(int));
+
+    int history_start;
+
+    reader.read(reinterpret_cast<void*>(&history_start), sizeof(int));
+
+    // samples are read in order, so a spilled history can start at 0
+    state.history_samples.start = (state.spill_rewards.size() > 0 ? 0 : history_start);
+    state.spill_rewards.start = 0;
+
+    for (int t = 0; t < history_capacity; t++) {
+        for (int vli = 0; vli < visible_layers.size(); vli++) {
+            Int_Buffer_View input_cis = get_history_input_cis(state, t, vli);
+
+            reader.read(reinterpret_cast<void*>(&input_cis[0]), input_cis.size() * sizeof(int));
         }
 
-        s.hidden_target_cis_prev.resize(num_hidden_columns);
+        Int_Buffer_View hidden_target_cis_prev = get_history_hidden_target_cis_prev(state, t);
 
-        reader.read(reinterpret_cast<void*>(&s.hidden_target_cis_prev[0]), s.hidden_target_cis_prev.size() * sizeof(int));
+        reader.read(reinterpret_cast<void*>(&hidden_target_cis_prev[0]), hidden_target_cis_prev.size() * sizeof(int));
 
-        reader.read(reinterpret_cast<void*>(&s.reward), sizeof(float));
+        float reward;
+
+        reader.read(reinterpret_cast<void*>(&reward), sizeof(float));
+
+        if (t < state.history_samples.size())
+            state.history_samples[t].reward = reward;
+        else
+            state.spill_rewards[t - state.history_samples.size()] = reward;
     }
 }
 
-void Actor::write_state(
+void Actor::write_delta(
     Stream_Writer &writer
 ) const {
-    writer.write(reinterpret_cast<const void*>(&hidden_cis[0]), hidden_cis.size() * sizeof(int));
-    writer.write(reinterpret_cast<const void*>(&hidden_values[0]), hidden_values.size() * sizeof(float));
+    writer.write(reinterpret_cast<const void*>(&hidden_size), sizeof(Int3));
 
-    writer.write(reinterpret_cast<const void*>(&history_size), sizeof(int));
+    int num_visible_layers = visible_layers.size();
 
-    int history_start = history_samples.start;
+    writer.write(reinterpret_cast<const void*>(&num_visible_layers), sizeof(int));
 
-    writer.write(reinterpret_cast<const void*>(&history_start), sizeof(int));
+    int fixed_point_int = fixed_point;
 
-    for (int t = 0; t < history_samples.size(); t++) {
-        const History_Sample &s = history_samples[t];
+    writer.write(reinterpret_cast<const void*>(&fixed_point_int), sizeof(int));
 
-        for (int vli = 0; vli < visible_layers.size(); vli++)
-            writer.write(reinterpret_cast<const void*>(&s.input_cis[vli][0]), s.input_cis[vli].size() * sizeof(int));
+    for (int vli = 0; vli < visible_layers.size(); vli++) {
+        const Visible_Layer &vl = visible_layers[vli];
+        const Visible_Layer_Desc &vld = visible_layer_descs[vli];
+
+        int diam = vld.radius * 2 + 1;
+        Index value_row_size = diam * diam;
+        Index action_row_size = hidden_size.z * value_row_size;
+
+        int num_dirty = 0;
+
+        for (int i = 0; i < vl.dirty.size(); i++)
+            num_dirty += vl.dirty[i];
 
-        writer.write(reinterpret_cast<const void*>(&s.hidden_target_cis_prev[0]), s.hidden_target_cis_prev.size() * sizeof(int));
+        writer.write(reinterpret_cast<const void*>(&num_dirty), sizeof(int));
 
-        writer.write(reinterpret_cast<const void*>(&s.reward), sizeof(float));
+        for (int i = 0; i < vl.dirty.size(); i++) {
+            if (!vl.dirty[i])
+                continue;
+
+            writer.write(reinterpret_cast<const void*>(&i), sizeof(int));
+
+            if (fixed_point) {
+                writer.write(reinterpret_cast<const void*>(&vl.value_weights_fixed[i * value_row_size]), value_row_size * sizeof(short));
+                writer.write(reinterpret_cast<const void*>(&vl.action_weights_fixed[i * action_row_size]), action_row_size * sizeof(short));
+            }
+            else {
+                writer.write(reinterpret_cast<const void*>(&vl.value_weights[i * value_row_size]), value_row_size * sizeof(float));
+                writer.write(reinterpret_cast<const void*>(&vl.action_weights[i * action_row_size]), action_row_size * sizeof(float));
+            }
+        }
     }
 }
 
-void Actor::read_state(
+bool Actor::read_delta(
     Stream_Reader &reader
 ) {
-    reader.read(reinterpret_cast<void*>(&hidden_cis[0]), hidden_cis.size() * sizeof(int));
-    reader.read(reinterpret_cast<void*>(&hidden_values[0]), hidden_values.size() * sizeof(float));
+    Int3 delta_hidden_size;
 
-    reader.read(reinterpret_cast<void*>(&history_size), sizeof(int));
+    reader.read(reinterpret_cast<void*>(&delta_hidden_size), sizeof(Int3));
 
-    int history_start;
+    int num_visible_layers;
 
-    reader.read(reinterpret_cast<void*>(&history_start), sizeof(int));
+    reader.read(reinterpret_cast<void*>(&num_visible_layers), sizeof(int));
 
-    history_samples.start = history_start;
+    if (delta_hidden_size.x != hidden_size.x || delta_hidden_size.y != hidden_size.y || delta_hidden_size.z != hidden_size.z || num_visible_layers != visible_layers.size())
+        return false;
 
-    for (int t = 0; t < history_samples.size(); t++) {
-        History_Sample &s = history_samples[t];
+    int fixed_point_int;
 
-        for (int vli = 0; vli < visible_layers.size(); vli++)
-            reader.read(reinterpret_cast<void*>(&s.input_cis[vli][0]), s.input_cis[vli].size() * sizeof(int));
+    reader.read(reinterpret_cast<void*>(&fixed_point_int), sizeof(int));
 
-        reader.read(reinterpret_cast<void*>(&s.hidden_target_cis_prev[0]), s.hidden_target_cis_prev.size() * sizeof(int));
+    // switching marks everything dirty on the writing side, so the delta then holds all weights
+    set_fixed_point(fixed_point_int);
 
-        reader.read(reinterpret_cast<void*>(&s.reward), sizeof(float));
+    for (int vli = 0; vli < visible_layers.size(); vli++) {
+        Visible_Layer &vl = visible_layers[vli];
+        const Visible_Layer_Desc &vld = visible_layer_descs[vli];
+
+        int diam = vld.radius * 2 + 1;
+        Index value_row_size = diam * diam;
+        Index action_row_size = hidden_size.z * value_row_size;
+
+        int num_dirty;
+
+        reader.read(reinterpret_cast<void*>(&num_dirty), sizeof(int));
+
+        if (num_dirty < 0 || num_dirty > vl.dirty.size())
+            return false;
+
+        for (int d = 0; d < num_dirty; d++) {
+            int i;
+
+            reader.read(reinterpret_cast<void*>(&i), sizeof(int));
+
+            if (i < 0 || i >= vl.dirty.size())
+                return false;
+
+            if (fixed_point) {
+                reader.read(reinterpret_cast<void*>(&vl.value_weights_fixed[i * value_row_size]), value_row_size * sizeof(short));
+                reader.read(reinterpret_cast<void*>(&vl.action_weights_fixed[i * action_row_size]), action_row_size * sizeof(short));
+            }
+            else {
+                reader.read(reinterpret_cast<void*>(&vl.value_weights[i * value_row_size]), value_row_size * sizeof(float));
+                reader.read(reinterpret_cast<void*>(&vl.action_weights[i * action_row_size]), action_row_size * sizeof(float));
+            }
+        }
     }
+
+    return true;
 }
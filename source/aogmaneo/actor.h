@@ -11,6 +11,16 @@
 #include "helpers.h"
 
 namespace aon {
+// fixed-point actor weight scale. int16 weights then cover [-256, 256) in steps of 1/128.
+// weights outside saturate, both when converting and when learning
+const float actor_fixed_scale = 128.0f;
+const float actor_fixed_scale_inv = 1.0f / actor_fixed_scale;
+
+// serialized actor format: a header (magic, version) and the weights.
+// version 0 had no header, float weights and was followed by a stream state
+const int actor_magic = 0x5443414f; // "OACT"
+const int actor_version = 1;
+
 // a reinforcement learning layer
 class Actor {
 public:
@@ -32,6 +42,11 @@ public:
     struct Visible_Layer {
         Float_Buffer value_weights; // value function weights
         Float_Buffer action_weights; // action function weights
+
+        Short_Buffer value_weights_fixed; // value function weights, fixed-point mode
+        Short_Buffer action_weights_fixed; // action function weights, fixed-point mode
+
+        Byte_Buffer dirty; // (hidden column, input cell) weight rows learned since the last clear_dirty
     };
 
     // history sample for delayed updates
@@ -42,6 +57,78 @@ public:
         float reward;
     };
 
+    // per-stream state, the actor itself only holds weights (and scratch buffers) that may be shared by many streams
+    struct State {
+        Int_Buffer hidden_cis; // hidden states
+
+        Float_Buffer hidden_values; // hidden value function output buffer
+
+        Float_Buffer hidden_acts; // action activations of the latest step
+
+        // current history size - fixed after initialization. determines length of wait before updating
+        int history_size;
+
+        Circle_Buffer<History_Sample> history_samples; // history buffer, fixed length. only the most recent samples when spilling
+
+        // history spill, older samples are moved to a memory mapped file
+        Mapped_Region spill;
+        Circle_Buffer<float> spill_rewards; // rewards of spilled samples, also tracks spill capacity and start
+
+        bool stepping; // set while a step advances the state, learn_streams must not read it then
+
+        unsigned long rand_state; // RNG stream action selection and learning draw from, used when steps are not given one
+
+        State()
+        :
+        history_size(0),
+        stepping(false)
+        {}
+    };
+
+    // pointer to a shared learner. copies of an actor start without one (they would otherwise replay into weights they do not own), moves keep it
+    struct Learner_Ref {
+        Actor* p;
+
+        Learner_Ref()
+        :
+        p(nullptr)
+        {}
+
+        Learner_Ref(
+            const Learner_Ref &
+        )
+        :
+        p(nullptr)
+        {}
+
+        Learner_Ref(
+            Learner_Ref &&other
+        )
+        :
+        p(other.p)
+        {
+            other.p = nullptr;
+        }
+
+        Learner_Ref &operator=(
+            const Learner_Ref &
+        ) {
+            p = nullptr;
+
+            return *this;
+        }
+
+        Learner_Ref &operator=(
+            Learner_Ref &&other
+        ) {
+            p = other.p;
+
+            other.p = nullptr;
+
+            return *this;
+        }
+    };
+
     struct Params {
         float vlr; // value learning rate
         float alr; // action learning rate
@@ -62,81 +149,261 @@ public:
 
     Int3 hidden_size; // hidden/output/action size
 
-    // current history size - fixed after initialization. determines length of wait before updating
-    int history_size;
+    bool fixed_point; // whether weights are stored as int16 fixed-point instead of float
+
+    Learner_Ref learner; // shared learner whose weights are used instead of this actor's, nullptr if none
+
+    int history_capacity; // number of history samples per stream
 
-    Float_Buffer hidden_acts; // temporary buffer
+    Float_Buffer hidden_deltas; // learning scratch. learning writes the weights, so only one stream learns at a time anyway
 
-    Int_Buffer hidden_cis; // hidden states
+    int spill_stride; // ints per spilled sample
 
-    Float_Buffer hidden_values; // hidden value function output buffer
+    Int_Buffer learn_ts; // history indices sampled for the current learn sweep
 
-    Circle_Buffer<History_Sample> history_samples; // history buffer, fixed length
+    U_Int_Buffer batch_base_states; // forward RNG seeds per stream of a batched step, grown on demand
+
+    unsigned long rand_state; // RNG stream of learn_streams
 
     // visible layers and descriptors
     Array<Visible_Layer> visible_layers;
     Array<Visible_Layer_Desc> visible_layer_descs;
 
+    int* get_spill_record(
+        const State &state,
+        int j
+    ) const {
+        return static_cast<int*>(state.spill.data()) + static_cast<long>((state.spill_rewards.start + j) % state.spill_rewards.size()) * spill_stride;
+    }
+
     // --- kernels ---
 
     void forward(
         const Int2 &column_pos,
         const Array<Int_Buffer_View> &input_cis,
+        State &stream,
         unsigned long* state,
         const Params &params
-    );
+    ) const;
 
     void learn(
         const Int2 &column_pos,
+        const State &stream,
         int t,
         float r,
         float d,
         float mimic,
+        unsigned long* state,
         const Params &params
     );
 
+    // read everything after the hidden size of a format version. the stream state of version 0 is read into state
+    void read_body(
+        Stream_Reader &reader,
+        int version,
+        State &state
+    );
+
+    // add the latest step of a stream to its history, spilling the oldest resident sample if needed
+    void add_sample(
+        State &state,
+        const Array<Int_Buffer_View> &input_cis,
+        Int_Buffer_View hidden_target_cis_prev,
+        float reward
+    ) const;
+
 public:
     // initialized randomly
     void init_random(
         const Int3 &hidden_size,
         int history_capacity,
-        const Array<Visible_Layer_Desc> &visible_layer_descs
+        const Array<Visible_Layer_Desc> &visible_layer_descs,
+        unsigned int seed = rand() // seed of the weight initialization and the actor's RNG stream
     );
 
+    // allocate a cleared state for this actor, with a fully resident history
+    void init_state(
+        State &state,
+        unsigned int seed // seed of the state's RNG stream
+    ) const;
+
+    // select actions and add the step to the stream's history, without learning.
+    // only writes the state, so different states can act concurrently
+    void act(
+        State &state, // stream state to advance
+        const Array<Int_Buffer_View> &input_cis,
+        Int_Buffer_View hidden_target_cis_prev,
+        float reward,
+        const Params &params,
+        unsigned long* rand_state = nullptr // RNG state, nullptr for the state's own stream
+    ) const;
+
     // step (get actions and update)
     void step(
+        State &state, // stream state to advance
         const Array<Int_Buffer_View> &input_cis,
         Int_Buffer_View hidden_target_cis_prev,
         float reward,
         bool learn_enabled,
         float mimic,
+        const Params &params,
+        unsigned long* rand_state = nullptr // RNG state, nullptr for the state's own stream
+    );
+
+    // step a batch of streams. actions are selected with columns as the outer loop and streams as the inner one, so weights are reused across the batch.
+    // streams with learning enabled then learn one after the other
+    void step_batch(
+        Array_View<State*> states, // stream states to advance
+        Array_View<const Array<Int_Buffer_View>*> input_cis, // input states per stream
+        Array_View<Int_Buffer_View> hidden_target_cis_prev, // previous actions per stream
+        Float_Buffer_View rewards, // rewards per stream
+        Byte_Buffer_View learn_enabled, // whether to learn, per stream
+        float mimic,
+        const Params &params,
+        unsigned long* rand_state = nullptr // RNG state, nullptr for the state's own stream
+    );
+
+    // learn from a stream's own history, if it has enough samples and there is no shared learner. step does this when learning is enabled
+    void learn_history(
+        State &state,
+        float mimic,
+        const Params &params,
+        unsigned long* rand_state = nullptr
+    );
+
+    void clear_state(
+        State &state
+    ) const;
+
+    // move the weights and scratch buffers into an arena (see Hierarchy::pack), in the order a step uses them
+    void place(
+        Arena &arena
+    );
+
+    // copy the recurrent part of a state into dst, without its history. dst then records no samples and does not learn from its own history.
+    // buffers of dst are reused if it was forked from a state of this actor before
+    void fork_state(
+        const State &src,
+        State &dst
+    ) const;
+
+    // share the weights of another actor (the learner) with the same dimensions for action selection, nullptr to use own weights again.
+    // samples are still added to the stream histories, but learning is left to learner.learn_streams
+    void set_learner(
+        Actor* learner
+    ) {
+        this->learner.p = learner;
+    }
+
+    // learn this actor's weights by replaying samples drawn uniformly from the histories of streams (states of actors that use this one as their learner, or of itself).
+    // reads the histories and values of the streams and writes the weights their actors select actions with,
+    // so it must run between steps: not concurrently with a step of any of the streams or of the learner itself (asserted through State::stepping)
+    void learn_streams(
+        const Array<const State*> &streams,
+        float mimic,
         const Params &params
     );
 
-    void clear_state();
+    // convert weights between float and int16 fixed-point storage (e.g. quantize a trained float model).
+    // returns the number of weights that were outside the fixed-point range and got clamped, 0 if all fit
+    int set_fixed_point(
+        bool fixed_point
+    );
+
+    bool get_fixed_point() const {
+        return fixed_point;
+    }
 
     // serialization
-    int size() const; // returns size in bytes
-    int state_size() const; // returns size of state in bytes
+    long long size() const; // returns size in bytes
+    long long state_size() const; // returns size of a state in bytes
 
     void write(
         Stream_Writer &writer
     ) const;
 
+    // also reads actors written before the format had a header (version 0), which have float weights and hold a stream state.
+    // that state is read into state if given, otherwise skipped. write such an actor again to convert it
     void read(
-        Stream_Reader &reader
+        Stream_Reader &reader,
+        State* state = nullptr
     );
 
     void write_state(
-        Stream_Writer &writer
+        Stream_Writer &writer,
+        const State &state
     ) const;
 
     void read_state(
+        Stream_Reader &reader,
+        State &state
+    ) const;
+
+    // incremental checkpoints. learning marks the weight rows (of a hidden column and input cell) it changes as dirty
+    void clear_dirty() {
+        for (int vli = 0; vli < visible_layers.size(); vli++)
+            visible_layers[vli].dirty.fill(false);
+    }
+
+    // write the dirty weight rows
+    void write_delta(
+        Stream_Writer &writer
+    ) const;
+
+    // apply weights written by write_delta of an actor of the same shape, converting to its fixed-point mode. returns false if the shape differs
+    bool read_delta(
         Stream_Reader &reader
     );
     
+    // keep only resident_capacity of the most recent history samples of a stream in memory, spill older ones to a memory mapped file.
+    // pass nullptr to disable. clears the history. returns false if the file could not be mapped. copies of the state spill to their own file next to it
+    bool set_history_spill(
+        State &state,
+        const char* file_name,
+        int resident_capacity
+    ) const;
+
     int get_history_capacity() const {
-        return history_samples.size();
+        return history_capacity;
+    }
+
+    // history sample access, spanning resident and spilled samples
+    Int_Buffer_View get_history_input_cis(
+        const State &state,
+        int t,
+        int vli
+    ) const {
+        if (t < state.history_samples.size())
+            return state.history_samples[t].input_cis[vli];
+
+        int* record = get_spill_record(state, t - state.history_samples.size());
+
+        for (int i = 0; i < vli; i++)
+            record += visible_layer_descs[i].size.x * visible_layer_descs[i].size.y;
+
+        return Int_Buffer_View(record, visible_layer_descs[vli].size.x * visible_layer_descs[vli].size.y);
+    }
+
+    Int_Buffer_View get_history_hidden_target_cis_prev(
+        const State &state,
+        int t
+    ) const {
+        if (t < state.history_samples.size())
+            return state.history_samples[t].hidden_target_cis_prev;
+
+        int num_hidden_columns = hidden_size.x * hidden_size.y;
+
+        return Int_Buffer_View(get_spill_record(state, t - state.history_samples.size()) + spill_stride - num_hidden_columns, num_hidden_columns);
+    }
+
+    float get_history_reward(
+        const State &state,
+        int t
+    ) const {
+        if (t < state.history_samples.size())
+            return state.history_samples[t].reward;
+
+        return state.spill_rewards[t - state.history_samples.size()];
     }
 };
 }
@@ -9,119 +9,304 @@
 #pragma once
 
 #include <assert.h>
+#include <string.h>
+
+#include <new>
+#include <type_traits>
 
 namespace aon {
+// sizes and indices of arrays (and weight index arithmetic in the kernels).
+// 64-bit by default, USE_INDEX32 selects 32-bit for models known to stay below
+// 2^31 elements per buffer
+#ifdef USE_INDEX32
+typedef int Index;
+#else
+typedef long long Index;
+#endif
+
+#ifdef USE_ALLOCATION_COUNT
+// number of Array allocations so far, to check that steady-state stepping does not allocate. not thread safe
+extern unsigned long allocation_count;
+#endif
+
+// alignment of array storage in bytes, enough for aligned SIMD loads
+const int array_alignment = 64;
+
 template <typename T> class Array_View;
 
 template <typename T> class Array {
-public:
+private:
+  // uninitialized storage for capacity elements, aligned to array_alignment.
+  // the pointer from operator new is kept just before the aligned storage
+  static T *allocate(Index capacity) {
+#ifdef USE_ALLOCATION_COUNT
+    allocation_count++;
+#endif
 
-  T *p;
-  int s;
+    char *raw = static_cast<char *>(::operator new(
+        static_cast<unsigned long long>(capacity) * sizeof(T) +
+        array_alignment + sizeof(void *)));
 
-  Array() : p(nullptr), s(0) {}
+    char *start = raw + sizeof(void *);
 
-  Array(const Array<T> &other) : p(nullptr), s(0) { *this = other; }
+    char *aligned =
+        start + (array_alignment -
+                 reinterpret_cast<unsigned long long>(start) % array_alignment) %
+                    array_alignment;
 
-  Array(int size) : p(nullptr), s(0) { resize(size); }
+    reinterpret_cast<void **>(aligned)[-1] = raw;
 
-  Array(int size, T value) : p(nullptr), s(0) { resize(size, value); }
+    return reinterpret_cast<T *>(aligned);
+  }
 
-  ~Array() {
-    if (p != nullptr)
-      delete[] p;
+  static void deallocate(T *data) {
+    ::operator delete(static_cast<void **>(static_cast<void *>(data))[-1]);
   }
 
-  Array<T> &operator=(const Array<T> &other) {
-    if (s != other.s) {
+  // default construct the elements in [begin, end)
+  void construct(Index begin, Index end) {
+    if (!std::is_trivially_default_constructible<T>::value) {
+      for (Index i = begin; i < end; i++)
+        new (p + i) T;
+    }
+  }
+
+  // destroy the elements in [begin, end)
+  void destroy(Index begin, Index end) {
+    if (!std::is_trivially_destructible<T>::value) {
+      for (Index i = begin; i < end; i++)
+        p[i].~T();
+    }
+  }
+
+  void release() {
+    if (owned) {
+      destroy(0, s);
+
       if (p != nullptr)
-        delete[] p;
+        deallocate(p);
+    }
 
-      s = other.s;
+    p = nullptr;
+    s = 0;
+    c = 0;
+    owned = true;
+  }
 
-      p = new T[static_cast<unsigned int>(s)];
+  // move the elements (as many as fit) into new owned storage
+  void reallocate(Index capacity) {
+    T *temp = (capacity > 0 ? allocate(capacity) : nullptr);
+
+    Index ms = s < capacity ? s : capacity;
+
+    if (std::is_trivially_copyable<T>::value) {
+      if (ms > 0)
+        memcpy(static_cast<void *>(temp), static_cast<const void *>(p),
+               ms * sizeof(T));
+    } else {
+      for (Index i = 0; i < ms; i++) {
+        // external storage is left as is
+        if (owned)
+          new (temp + i) T(static_cast<T &&>(p[i]));
+        else
+          new (temp + i) T(p[i]);
+      }
     }
 
-    for (int i = 0; i < s; i++)
-      p[i] = other.p[i];
+    release();
+
+    p = temp;
+    s = ms;
+    c = capacity;
+  }
+
+  // copy size elements from data, reusing the storage if they fit
+  void assign(const T *data, Index size) {
+    if (!owned || size > c) {
+      release();
+
+      if (size > 0) {
+        p = allocate(size);
+        c = size;
+      }
+    }
+
+    if (std::is_trivially_copyable<T>::value) {
+      if (size > 0)
+        memcpy(static_cast<void *>(p), static_cast<const void *>(data),
+               size * sizeof(T));
+    } else {
+      Index ms = s < size ? s : size;
+
+      for (Index i = 0; i < ms; i++)
+        p[i] = data[i];
+
+      for (Index i = ms; i < size; i++)
+        new (p + i) T(data[i]);
+
+      destroy(size, s);
+    }
+
+    s = size;
+  }
+
+public:
+  T *p;
+  Index s;
+  Index c; // capacity, number of elements that fit in p without reallocating
+  bool owned; // false if p points into external storage (see borrow)
+
+  Array() : p(nullptr), s(0), c(0), owned(true) {}
+
+  Array(const Array<T> &other) : p(nullptr), s(0), c(0), owned(true) {
+    assign(other.p, other.s);
+  }
+
+  Array(Array<T> &&other)
+      : p(other.p), s(other.s), c(other.c), owned(other.owned) {
+    other.p = nullptr;
+    other.s = 0;
+    other.c = 0;
+    other.owned = true;
+  }
+
+  Array(Index size) : p(nullptr), s(0), c(0), owned(true) { resize(size); }
+
+  Array(Index size, T value) : p(nullptr), s(0), c(0), owned(true) {
+    resize(size, value);
+  }
+
+  ~Array() { release(); }
+
+  Array<T> &operator=(const Array<T> &other) {
+    if (this != &other)
+      assign(other.p, other.s);
 
     return *this;
   }
 
-  Array<T> &operator=(const Array_View<T> &other) {
-    if (s != other.s) {
-      if (p != nullptr)
-        delete[] p;
+  Array<T> &operator=(Array<T> &&other) {
+    if (this != &other) {
+      release();
 
+      p = other.p;
       s = other.s;
+      c = other.c;
+      owned = other.owned;
 
-      p = new T[static_cast<unsigned int>(s)];
+      other.p = nullptr;
+      other.s = 0;
+      other.c = 0;
+      other.owned = true;
     }
 
-    for (int i = 0; i < s; i++)
-      p[i] = other.p[i];
+    return *this;
+  }
+
+  Array<T> &operator=(const Array_View<T> &other) {
+    assign(other.p, other.s);
 
     return *this;
   }
 
-  void resize(int size) {
+  // resizing to 0 frees the storage, other sizes reuse it if they fit
+  void resize(Index size) {
     if (s == size)
       return;
 
-    T *temp = p;
-    int old_size = s;
-
-    s = size;
+    if (size == 0) {
+      release();
 
-    if (s != 0) {
-      p = new T[static_cast<unsigned int>(s)];
+      return;
+    }
 
-      int ms = old_size < s ? old_size : s;
+    if (!owned || size > c)
+      reallocate(size);
 
-      for (int i = 0; i < ms; i++)
-        p[i] = temp[i];
-    } else
-      p = nullptr;
+    if (size > s)
+      construct(s, size);
+    else
+      destroy(size, s);
 
-    if (temp != nullptr)
-      delete[] temp;
+    s = size;
   }
 
-  void resize(int size, T value) {
-    int old_s = s;
+  void resize(Index size, T value) {
+    Index old_s = s;
 
     resize(size);
 
-    for (int i = old_s; i < s; i++)
+    for (Index i = old_s; i < s; i++)
       p[i] = value;
   }
 
-  T &operator[](int index) {
+  // make room for capacity elements, so that resizing up to it does not
+  // allocate. moves external storage into owned storage
+  void reserve(Index capacity) {
+    if (owned && capacity <= c)
+      return;
+
+    reallocate(capacity > s ? capacity : s);
+  }
+
+  Index capacity() const { return c; }
+
+  T &operator[](Index index) {
     assert(index >= 0 && index < s);
 
     return p[index];
   }
 
-  const T &operator[](int index) const {
+  const T &operator[](Index index) const {
     assert(index >= 0 && index < s);
 
     return p[index];
   }
 
-  int size() const { return s; }
+  Index size() const { return s; }
 
   void fill(T value) {
-    for (int i = 0; i < s; i++)
+    for (Index i = 0; i < s; i++)
       p[i] = value;
   }
 
+  // exchange storage without copying
+  void swap(Array<T> &other) {
+    T *temp_p = p;
+    Index temp_s = s;
+    Index temp_c = c;
+    bool temp_owned = owned;
+
+    p = other.p;
+    s = other.s;
+    c = other.c;
+    owned = other.owned;
+
+    other.p = temp_p;
+    other.s = temp_s;
+    other.c = temp_c;
+    other.owned = temp_owned;
+  }
+
+  // use external storage without copying. the storage must outlive this
+  // array or the next resize, which moves the contents into owned storage.
+  // writes (such as learning) go to the external storage
+  void borrow(T *data, Index size) {
+    release();
+
+    p = data;
+    s = size;
+    c = size;
+    owned = false;
+  }
+
   friend Array_View<T>;
 };
 
 template <typename T> class Array_View {
 public:
   T *p;
-  int s;
+  Index s;
 
   Array_View() : p(nullptr), s(0) {}
 
@@ -129,7 +314,7 @@ public:
 
   Array_View(const Array<T> &other) { *this = other; }
 
-  Array_View<T>(T *p, int s) : p(p), s(s) {}
+  Array_View<T>(T *p, Index s) : p(p), s(s) {}
 
   Array_View<T> &operator=(const Array_View<T> &other) {
     p = other.p;
@@ -145,22 +330,22 @@ public:
     return *this;
   }
 
-  T &operator[](int index) {
+  T &operator[](Index index) {
     assert(index >= 0 && index < s);
 
     return p[index];
   }
 
-  const T &operator[](int index) const {
+  const T &operator[](Index index) const {
     assert(index >= 0 && index < s);
 
     return p[index];
   }
 
-  int size() const { return s; }
+  Index size() const { return s; }
 
   void fill(T value) {
-    for (int i = 0; i < s; i++)
+    for (Index i = 0; i < s; i++)
       p[i] = value;
   }
 
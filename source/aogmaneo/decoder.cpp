@@ -13,8 +13,10 @@ using namespace aon;
 void Decoder::forward(
     const Int2 &column_pos,
     const Array<Int_Buffer_View> &input_cis,
+    State &stream,
+    bool acts_enabled,
     const Params &params
-) {
+) const {
     int hidden_column_index = address2(column_pos, Int2(hidden_size.x, hidden_size.y));
 
     int hidden_cells_start = hidden_column_index * hidden_size.z;
@@ -22,13 +24,13 @@ void Decoder::forward(
     for (int hc = 0; hc < hidden_size.z; hc++) {
         int hidden_cell_index = hc + hidden_cells_start;
 
-        hidden_sums[hidden_cell_index] = 0;
+        stream.hidden_sums[hidden_cell_index] = 0;
     }
 
     int count = 0;
 
     for (int vli = 0; vli < visible_layers.size(); vli++) {
-        Visible_Layer &vl = visible_layers[vli];
+        const Visible_Layer &vl = visible_layers[vli];
         const Visible_Layer_Desc &vld = visible_layer_descs[vli];
 
         int diam = vld.radius * 2 + 1;
@@ -58,14 +60,14 @@ void Decoder::forward(
 
                 Int2 offset(ix - field_lower_bound.x, iy - field_lower_bound.y);
 
-                int wi_start = hidden_size.z * (offset.y + diam * (offset.x + diam * (in_ci + vld.size.z * hidden_column_index)));
+                Index wi_start = hidden_size.z * (offset.y + diam * (offset.x + diam * (in_ci + vld.size.z * static_cast<Index>(hidden_column_index))));
 
                 for (int hc = 0; hc < hidden_size.z; hc++) {
                     int hidden_cell_index = hc + hidden_cells_start;
 
-                    int wi = hc + wi_start;
+                    Index wi = hc + wi_start;
 
-                    hidden_sums[hidden_cell_index] += vl.weights[wi];
+                    stream.hidden_sums[hidden_cell_index] += vl.weights[wi];
                 }
             }
     }
@@ -76,9 +78,10 @@ void Decoder::forward(
     for (int hc = 0; hc < hidden_size.z; hc++) {
         int hidden_cell_index = hc + hidden_cells_start;
 
-        float activation = static_cast<float>(hidden_sums[hidden_cell_index]) / (count * 255);
+        float activation = static_cast<float>(stream.hidden_sums[hidden_cell_index]) / (count * 255);
 
-        hidden_acts[hidden_cell_index] = activation;
+        if (acts_enabled)
+            stream.hidden_acts[hidden_cell_index] = activation;
 
         if (activation > max_activation) {
             max_activation = activation;
@@ -86,14 +89,19 @@ void Decoder::forward(
         }
     }
 
+    stream.hidden_cis[hidden_column_index] = max_index;
+
+    if (!acts_enabled)
+        return;
+
     float total = 0.0f;
 
     for (int hc = 0; hc < hidden_size.z; hc++) {
         int hidden_cell_index = hc + hidden_cells_start;
     
-        hidden_acts[hidden_cell_index] = expf((hidden_acts[hidden_cell_index] - max_activation) * params.scale);
+        stream.hidden_acts[hidden_cell_index] = expf((stream.hidden_acts[hidden_cell_index] - max_activation) * params.scale);
 
-        total += hidden_acts[hidden_cell_index];
+        total += stream.hidden_acts[hidden_cell_index];
     }
 
     float total_inv = 1.0f / max(limit_small, total);
@@ -101,15 +109,14 @@ void Decoder::forward(
     for (int hc = 0; hc < hidden_size.z; hc++) {
         int hidden_cell_index = hc + hidden_cells_start;
 
-        hidden_acts[hidden_cell_index] *= total_inv;
+        stream.hidden_acts[hidden_cell_index] *= total_inv;
     }
-
-    hidden_cis[hidden_column_index] = max_index;
 }
 
 void Decoder::update_gates(
     const Int2 &column_pos,
     int vli,
+    const State &stream,
     const Params &params
 ) {
     Visible_Layer &vl = visible_layers[vli];
@@ -139,9 +146,9 @@ void Decoder::update_gates(
     Int2 iter_lower_bound(max(0, field_lower_bound.x), max(0, field_lower_bound.y));
     Int2 iter_upper_bound(min(hidden_size.x - 1, hidden_center.x + reverse_radii.x), min(hidden_size.y - 1, hidden_center.y + reverse_radii.y));
 
-    int hidden_stride = vld.size.z * diam * diam;
+    Index hidden_stride = vld.size.z * diam * diam;
     
-    int in_ci_prev = vl.input_cis_prev[visible_column_index];
+    int in_ci_prev = stream.input_cis_prev[vli][visible_column_index];
 
     const float half_byte_inv = 1.0f / 127.0f;
 
@@ -159,10 +166,10 @@ void Decoder::update_gates(
             if (in_bounds(column_pos, Int2(visible_center.x - vld.radius, visible_center.y - vld.radius), Int2(visible_center.x + vld.radius + 1, visible_center.y + vld.radius + 1))) {
                 Int2 offset(column_pos.x - visible_center.x + vld.radius, column_pos.y - visible_center.y + vld.radius);
 
-                int wi_start = hidden_size.z * (offset.y + diam * (offset.x + diam * (in_ci_prev + vld.size.z * hidden_column_index)));
+                Index wi_start = hidden_size.z * (offset.y + diam * (offset.x + diam * (in_ci_prev + vld.size.z * static_cast<Index>(hidden_column_index))));
 
                 for (int hc =  0; hc < hidden_size.z; hc++) {
-                    int wi = hc + wi_start;
+                    Index wi = hc + wi_start;
 
                     float w = (127.0f - vl.weights[wi]) * half_byte_inv;
 
@@ -181,6 +188,7 @@ void Decoder::update_gates(
 void Decoder::learn(
     const Int2 &column_pos,
     const Int_Buffer_View hidden_target_cis,
+    const State &stream,
     unsigned long* state,
     const Params &params
 ) {
@@ -189,7 +197,7 @@ void Decoder::learn(
     int hidden_cells_start = hidden_column_index * hidden_size.z;
 
     // check if has acts computed (ran at least once) by checking for flag value
-    if (hidden_acts[hidden_cells_start] == -1.0f)
+    if (stream.hidden_acts[hidden_cells_start] == -1.0f)
         return;
 
     int target_ci = hidden_target_cis[hidden_column_index];
@@ -197,7 +205,7 @@ void Decoder::learn(
     for (int hc = 0; hc < hidden_size.z; hc++) {
         int hidden_cell_index = hc + hidden_cells_start;
 
-        hidden_deltas[hidden_cell_index] = params.lr * 255.0f * ((hc == target_ci) - hidden_acts[hidden_cell_index]);
+        hidden_deltas[hidden_cell_index] = params.lr * 255.0f * ((hc == target_ci) - stream.hidden_acts[hidden_cell_index]);
     }
 
     for (int vli = 0; vli < visible_layers.size(); vli++) {
@@ -223,18 +231,20 @@ void Decoder::learn(
             for (int iy = iter_lower_bound.y; iy <= iter_upper_bound.y; iy++) {
                 int visible_column_index = address2(Int2(ix, iy), Int2(vld.size.x, vld.size.y));
 
-                int in_ci_prev = vl.input_cis_prev[visible_column_index];
+                int in_ci_prev = stream.input_cis_prev[vli][visible_column_index];
 
                 Int2 offset(ix - field_lower_bound.x, iy - field_lower_bound.y);
 
-                int wi_start = hidden_size.z * (offset.y + diam * (offset.x + diam * (in_ci_prev + vld.size.z * hidden_column_index)));
+                Index wi_start = hidden_size.z * (offset.y + diam * (offset.x + diam * (in_ci_prev + vld.size.z * static_cast<Index>(hidden_column_index))));
 
                 float gate = vl.gates[visible_column_index];
 
+                vl.dirty[in_ci_prev + vld.size.z * hidden_column_index] = true;
+
                 for (int hc = 0; hc < hidden_size.z; hc++) {
                     int hidden_cell_index = hc + hidden_cells_start;
 
-                    int wi = hc + wi_start;
+                    Index wi = hc + wi_start;
 
                     vl.weights[wi] = min(255, max(0, vl.weights[wi] + rand_roundf(hidden_deltas[hidden_cell_index] * gate, state)));
                 }
@@ -244,12 +254,15 @@ void Decoder::learn(
 
 void Decoder::init_random(
     const Int3 &hidden_size,
-    const Array<Visible_Layer_Desc> &visible_layer_descs
+    const Array<Visible_Layer_Desc> &visible_layer_descs,
+    unsigned int seed
 ) {
     this->visible_layer_descs = visible_layer_descs; 
 
     this->hidden_size = hidden_size;
 
+    unsigned long rand_state = rand_get_state(seed);
+
     visible_layers.resize(visible_layer_descs.size());
 
     // pre-compute dimensions
@@ -270,24 +283,20 @@ void Decoder::init_random(
         int diam = vld.radius * 2 + 1;
         int area = diam * diam;
 
-        vl.weights.resize(num_hidden_cells * area * vld.size.z);
-
-        for (int i = 0; i < vl.weights.size(); i++)
-            vl.weights[i] = 127 + (rand() % init_weight_noisei) - init_weight_noisei / 2;
+        vl.weights.resize(static_cast<Index>(num_hidden_cells) * area * vld.size.z);
 
-        vl.input_cis_prev = Int_Buffer(num_visible_columns, 0);
+        for (Index i = 0; i < vl.weights.size(); i++)
+            vl.weights[i] = 127 + (rand(&rand_state) % init_weight_noisei) - init_weight_noisei / 2;
 
         vl.gates.resize(num_visible_columns);
-    }
-
-    // hidden cis
-    hidden_cis = Int_Buffer(num_hidden_columns, 0);
 
-    hidden_sums.resize(num_hidden_cells);
-    hidden_acts = Float_Buffer(num_hidden_cells, -1.0f); // flag
+        vl.dirty = Byte_Buffer(num_hidden_columns * vld.size.z, false);
+    }
 
     hidden_deltas.resize(num_hidden_cells);
 
+    weights_version = 1;
+
     // generate helper buffers for parallelization
     visible_pos_vlis.resize(total_num_visible_columns);
 
@@ -306,77 +315,212 @@ void Decoder::init_random(
     }
 }
 
-void Decoder::step(
-    const Array<Int_Buffer_View> &input_cis,
+void Decoder::init_state(
+    State &state,
+    unsigned int seed
+) const {
+    int num_hidden_columns = hidden_size.x * hidden_size.y;
+    int num_hidden_cells = num_hidden_columns * hidden_size.z;
+
+    state.hidden_cis = Int_Buffer(num_hidden_columns, 0);
+
+    state.hidden_acts = Float_Buffer(num_hidden_cells, -1.0f); // flag
+
+    state.hidden_sums.resize(num_hidden_cells);
+
+    state.input_cis_prev.resize(visible_layers.size());
+
+    for (int vli = 0; vli < visible_layers.size(); vli++) {
+        const Visible_Layer_Desc &vld = visible_layer_descs[vli];
+
+        state.input_cis_prev[vli] = Int_Buffer(vld.size.x * vld.size.y, 0);
+    }
+
+    state.weights_version = 0;
+
+    state.rand_state = rand_get_state(seed);
+}
+
+void Decoder::learn_stream(
+    State &state,
     Int_Buffer_View hidden_target_cis,
-    bool learn_enabled,
-    const Params &params
+    const Params &params,
+    unsigned long* rand_state
 ) {
     int num_hidden_columns = hidden_size.x * hidden_size.y;
 
-    if (learn_enabled) {
-        // update gates
-        PARALLEL_FOR
+    // update gates
+    {
+        TRACE_PARALLEL_FOR("decoder gates")
         for (int i = 0; i < visible_pos_vlis.size(); i++) {
             Int2 pos = Int2(visible_pos_vlis[i].x, visible_pos_vlis[i].y);
             int vli = visible_pos_vlis[i].z;
 
-            update_gates(pos, vli, params);
+            update_gates(pos, vli, state, params);
         }
+    }
+
+    if (rand_state == nullptr)
+        rand_state = &state.rand_state;
 
-        unsigned int base_state = rand();
+    unsigned int base_state = rand(rand_state);
 
-        PARALLEL_FOR
+    {
+        TRACE_PARALLEL_FOR("decoder learn")
         for (int i = 0; i < num_hidden_columns; i++) {
-            unsigned long state = rand_get_state(base_state + i * rand_subseed_offset);
+            unsigned long learn_state = rand_get_state(base_state + i * rand_subseed_offset);
 
-            learn(Int2(i / hidden_size.y, i % hidden_size.y), hidden_target_cis, &state, params);
+            learn(Int2(i / hidden_size.y, i % hidden_size.y), hidden_target_cis, state, &learn_state, params);
         }
     }
 
-    PARALLEL_FOR
-    for (int i = 0; i < num_hidden_columns; i++)
-        forward(Int2(i / hidden_size.y, i % hidden_size.y), input_cis, params);
+    weights_version++;
+}
+
+void Decoder::step(
+    State &state,
+    const Array<Int_Buffer_View> &input_cis,
+    Int_Buffer_View hidden_target_cis,
+    bool learn_enabled,
+    const Params &params,
+    unsigned long* rand_state
+) {
+    int num_hidden_columns = hidden_size.x * hidden_size.y;
+
+    if (learn_enabled)
+        learn_stream(state, hidden_target_cis, params, rand_state);
+
+    {
+        TRACE_PARALLEL_FOR("decoder forward")
+        for (int i = 0; i < num_hidden_columns; i++)
+            forward(Int2(i / hidden_size.y, i % hidden_size.y), input_cis, state, true, params);
+    }
+    
+    // copy to prevs
+    for (int vli = 0; vli < visible_layers.size(); vli++)
+        state.input_cis_prev[vli] = input_cis[vli];
+
+    state.weights_version = weights_version;
+}
+
+void Decoder::step_batch(
+    Array_View<State*> states,
+    Array_View<const Array<Int_Buffer_View>*> input_cis,
+    Array_View<Int_Buffer_View> hidden_target_cis,
+    Byte_Buffer_View learn_enabled,
+    const Params &params,
+    unsigned long* rand_state
+) {
+    int num_hidden_columns = hidden_size.x * hidden_size.y;
+
+    for (int b = 0; b < states.size(); b++) {
+        if (learn_enabled[b])
+            learn_stream(*states[b], hidden_target_cis[b], params, rand_state);
+    }
+
+    {
+        TRACE_PARALLEL_FOR("decoder forward batch")
+        for (int i = 0; i < num_hidden_columns; i++) {
+            Int2 column_pos(i / hidden_size.y, i % hidden_size.y);
+
+            for (int b = 0; b < states.size(); b++)
+                forward(column_pos, *input_cis[b], *states[b], true, params);
+        }
+    }
     
     // copy to prevs
+    for (int b = 0; b < states.size(); b++) {
+        for (int vli = 0; vli < visible_layers.size(); vli++)
+            states[b]->input_cis_prev[vli] = (*input_cis[b])[vli];
+
+        states[b]->weights_version = weights_version;
+    }
+}
+
+bool Decoder::inputs_unchanged(
+    const State &state,
+    const Array<Int_Buffer_View> &input_cis
+) const {
+    // not stepped yet, or the weights changed since
+    if (state.hidden_acts[0] == -1.0f || state.weights_version != weights_version)
+        return false;
+
     for (int vli = 0; vli < visible_layers.size(); vli++) {
-        Visible_Layer &vl = visible_layers[vli];
+        if (!cis_equal(input_cis[vli], state.input_cis_prev[vli]))
+            return false;
+    }
+
+    return true;
+}
 
-        vl.input_cis_prev = input_cis[vli];
+void Decoder::predict(
+    State &state,
+    const Array<Int_Buffer_View> &input_cis,
+    const Params &params
+) const {
+    int num_hidden_columns = hidden_size.x * hidden_size.y;
+
+    {
+        TRACE_PARALLEL_FOR("decoder predict")
+        for (int i = 0; i < num_hidden_columns; i++)
+            forward(Int2(i / hidden_size.y, i % hidden_size.y), input_cis, state, false, params);
     }
+
+    // the predictions no longer follow from input_cis_prev
+    state.weights_version = 0;
 }
 
-void Decoder::clear_state() {
-    hidden_cis.fill(0);
-    hidden_acts.fill(-1.0f); // flag
+void Decoder::clear_state(
+    State &state
+) const {
+    state.hidden_cis.fill(0);
+    state.hidden_acts.fill(-1.0f); // flag
+
+    state.weights_version = 0;
+
+    for (int vli = 0; vli < visible_layers.size(); vli++)
+        state.input_cis_prev[vli].fill(0);
+}
 
+void Decoder::place(
+    Arena &arena
+) {
     for (int vli = 0; vli < visible_layers.size(); vli++) {
         Visible_Layer &vl = visible_layers[vli];
 
-        vl.input_cis_prev.fill(0);
+        arena.place(vl.weights);
+        arena.place(vl.gates);
     }
+
+    arena.place(hidden_deltas);
+    arena.place(visible_pos_vlis);
+
+    for (int vli = 0; vli < visible_layers.size(); vli++)
+        arena.place(visible_layers[vli].dirty);
 }
 
-int Decoder::size() const {
-    int size = sizeof(Int3) + hidden_cis.size() * sizeof(int) + hidden_acts.size() * sizeof(float) + sizeof(int);
+long long Decoder::size() const {
+    long long size = 2 * sizeof(int) + sizeof(Int3) + sizeof(int);
 
     for (int vli = 0; vli < visible_layers.size(); vli++) {
         const Visible_Layer &vl = visible_layers[vli];
-        const Visible_Layer_Desc &vld = visible_layer_descs[vli];
 
-        size += sizeof(Visible_Layer_Desc) + vl.weights.size() * sizeof(Byte) + vl.input_cis_prev.size() * sizeof(int);
+        size += sizeof(Visible_Layer_Desc) + vl.weights.size() * sizeof(Byte);
     }
 
     return size;
 }
 
-int Decoder::state_size() const {
-    int size = hidden_cis.size() * sizeof(int) + hidden_acts.size() * sizeof(float);
+long long Decoder::state_size() const {
+    int num_hidden_columns = hidden_size.x * hidden_size.y;
+    int num_hidden_cells = num_hidden_columns * hidden_size.z;
+
+    long long size = num_hidden_columns * sizeof(int) + num_hidden_cells * sizeof(float);
 
     for (int vli = 0; vli < visible_layers.size(); vli++) {
-        const Visible_Layer &vl = visible_layers[vli];
+        const Visible_Layer_Desc &vld = visible_layer_descs[vli];
 
-        size += vl.input_cis_prev.size() * sizeof(int);
+        size += vld.size.x * vld.size.y * sizeof(int);
     }
 
     return size;
@@ -385,11 +529,11 @@ int Decoder::state_size() const {
 void Decoder::write(
     Stream_Writer &writer
 ) const {
+    writer.write(reinterpret_cast<const void*>(&decoder_magic), sizeof(int));
+    writer.write(reinterpret_cast<const void*>(&decoder_version), sizeof(int));
+
     writer.write(reinterpret_cast<const void*>(&hidden_size), sizeof(Int3));
 
-    writer.write(reinterpret_cast<const void*>(&hidden_cis[0]), hidden_cis.size() * sizeof(int));
-    writer.write(reinterpret_cast<const void*>(&hidden_acts[0]), hidden_acts.size() * sizeof(float));
-    
     int num_visible_layers = visible_layers.size();
 
     writer.write(reinterpret_cast<const void*>(&num_visible_layers), sizeof(int));
@@ -401,26 +545,48 @@ void Decoder::write(
         writer.write(reinterpret_cast<const void*>(&vld), sizeof(Visible_Layer_Desc));
 
         writer.write(reinterpret_cast<const void*>(&vl.weights[0]), vl.weights.size() * sizeof(Byte));
-
-        writer.write(reinterpret_cast<const void*>(&vl.input_cis_prev[0]), vl.input_cis_prev.size() * sizeof(int));
     }
 }
 
 void Decoder::read(
-    Stream_Reader &reader
+    Stream_Reader &reader,
+    State* state
 ) {
-    reader.read(reinterpret_cast<void*>(&hidden_size), sizeof(Int3));
+    int magic;
+
+    reader.read(reinterpret_cast<void*>(&magic), sizeof(int));
+
+    int version = 0;
+
+    // without a header, the first int is the start of the hidden size
+    if (magic != decoder_magic) {
+        hidden_size.x = magic;
+
+        reader.read(reinterpret_cast<void*>(&hidden_size.y), sizeof(Int3) - sizeof(int));
+    }
+    else {
+        reader.read(reinterpret_cast<void*>(&version), sizeof(int));
+
+        assert(version == decoder_version);
+
+        reader.read(reinterpret_cast<void*>(&hidden_size), sizeof(Int3));
+    }
 
     int num_hidden_columns = hidden_size.x * hidden_size.y;
     int num_hidden_cells = num_hidden_columns * hidden_size.z;
 
-    hidden_cis.resize(num_hidden_columns);
-    hidden_acts.resize(num_hidden_cells);
+    // version 0 stored the stream state here and after the weights of each visible layer
+    Int_Buffer legacy_hidden_cis;
+    Float_Buffer legacy_hidden_acts;
+    Array<Int_Buffer> legacy_input_cis_prev;
 
-    reader.read(reinterpret_cast<void*>(&hidden_cis[0]), hidden_cis.size() * sizeof(int));
-    reader.read(reinterpret_cast<void*>(&hidden_acts[0]), hidden_acts.size() * sizeof(float));
+    if (version == 0) {
+        legacy_hidden_cis.resize(num_hidden_columns);
+        legacy_hidden_acts.resize(num_hidden_cells);
 
-    hidden_sums.resize(num_hidden_cells);
+        reader.read(reinterpret_cast<void*>(&legacy_hidden_cis[0]), legacy_hidden_cis.size() * sizeof(int));
+        reader.read(reinterpret_cast<void*>(&legacy_hidden_acts[0]), legacy_hidden_acts.size() * sizeof(float));
+    }
 
     hidden_deltas.resize(num_hidden_cells);
 
@@ -431,6 +597,9 @@ void Decoder::read(
     visible_layers.resize(num_visible_layers);
     visible_layer_descs.resize(num_visible_layers);
 
+    if (version == 0)
+        legacy_input_cis_prev.resize(num_visible_layers);
+
     int total_num_visible_columns = 0;
 
     for (int vli = 0; vli < visible_layers.size(); vli++) {
@@ -447,17 +616,21 @@ void Decoder::read(
         int diam = vld.radius * 2 + 1;
         int area = diam * diam;
 
-        vl.weights.resize(num_hidden_cells * area * vld.size.z);
+        read_array(reader, vl.weights, static_cast<Index>(num_hidden_cells) * area * vld.size.z);
 
-        reader.read(reinterpret_cast<void*>(&vl.weights[0]), vl.weights.size() * sizeof(Byte));
+        if (version == 0) {
+            legacy_input_cis_prev[vli].resize(num_visible_columns);
 
-        vl.input_cis_prev.resize(num_visible_columns);
-
-        reader.read(reinterpret_cast<void*>(&vl.input_cis_prev[0]), vl.input_cis_prev.size() * sizeof(int));
+            reader.read(reinterpret_cast<void*>(&legacy_input_cis_prev[vli][0]), legacy_input_cis_prev[vli].size() * sizeof(int));
+        }
 
         vl.gates.resize(num_visible_columns);
+
+        vl.dirty = Byte_Buffer(num_hidden_columns * vld.size.z, false);
     }
 
+    weights_version = 1;
+
     // generate helper buffers for parallelization
     visible_pos_vlis.resize(total_num_visible_columns);
 
@@ -474,30 +647,131 @@ void Decoder::read(
             index++;
         }
     }
+
+    if (version == 0 && state != nullptr) {
+        init_state(*state, 0);
+
+        state->hidden_cis = legacy_hidden_cis;
+        state->hidden_acts = legacy_hidden_acts;
+
+        for (int vli = 0; vli < visible_layers.size(); vli++)
+            state->input_cis_prev[vli] = legacy_input_cis_prev[vli];
+    }
 }
 
 void Decoder::write_state(
-    Stream_Writer &writer
+    Stream_Writer &writer,
+    const State &state
 ) const {
-    writer.write(reinterpret_cast<const void*>(&hidden_cis[0]), hidden_cis.size() * sizeof(int));
-    writer.write(reinterpret_cast<const void*>(&hidden_acts[0]), hidden_acts.size() * sizeof(float));
+    writer.write(reinterpret_cast<const void*>(&state.hidden_cis[0]), state.hidden_cis.size() * sizeof(int));
+    writer.write(reinterpret_cast<const void*>(&state.hidden_acts[0]), state.hidden_acts.size() * sizeof(float));
     
+    for (int vli = 0; vli < visible_layers.size(); vli++)
+        writer.write(reinterpret_cast<const void*>(&state.input_cis_prev[vli][0]), state.input_cis_prev[vli].size() * sizeof(int));
+}
+
+void Decoder::read_state(
+    Stream_Reader &reader,
+    State &state
+) const {
+    int num_hidden_columns = hidden_size.x * hidden_size.y;
+    int num_hidden_cells = num_hidden_columns * hidden_size.z;
+
+    state.hidden_cis.resize(num_hidden_columns);
+    state.hidden_acts.resize(num_hidden_cells);
+    state.hidden_sums.resize(num_hidden_cells);
+
+    state.weights_version = 0;
+
+    reader.read(reinterpret_cast<void*>(&state.hidden_cis[0]), state.hidden_cis.size() * sizeof(int));
+    reader.read(reinterpret_cast<void*>(&state.hidden_acts[0]), state.hidden_acts.size() * sizeof(float));
+
+    state.input_cis_prev.resize(visible_layers.size());
+
+    for (int vli = 0; vli < visible_layers.size(); vli++) {
+        const Visible_Layer_Desc &vld = visible_layer_descs[vli];
+
+        state.input_cis_prev[vli].resize(vld.size.x * vld.size.y);
+
+        reader.read(reinterpret_cast<void*>(&state.input_cis_prev[vli][0]), state.input_cis_prev[vli].size() * sizeof(int));
+    }
+}
+
+void Decoder::write_delta(
+    Stream_Writer &writer
+) const {
+    writer.write(reinterpret_cast<const void*>(&hidden_size), sizeof(Int3));
+
+    int num_visible_layers = visible_layers.size();
+
+    writer.write(reinterpret_cast<const void*>(&num_visible_layers), sizeof(int));
+
     for (int vli = 0; vli < visible_layers.size(); vli++) {
         const Visible_Layer &vl = visible_layers[vli];
+        const Visible_Layer_Desc &vld = visible_layer_descs[vli];
+
+        int diam = vld.radius * 2 + 1;
+        Index row_size = hidden_size.z * diam * diam;
+
+        int num_dirty = 0;
+
+        for (int i = 0; i < vl.dirty.size(); i++)
+            num_dirty += vl.dirty[i];
+
+        writer.write(reinterpret_cast<const void*>(&num_dirty), sizeof(int));
+
+        for (int i = 0; i < vl.dirty.size(); i++) {
+            if (!vl.dirty[i])
+                continue;
 
-        writer.write(reinterpret_cast<const void*>(&vl.input_cis_prev[0]), vl.input_cis_prev.size() * sizeof(int));
+            writer.write(reinterpret_cast<const void*>(&i), sizeof(int));
+            writer.write(reinterpret_cast<const void*>(&vl.weights[i * row_size]), row_size * sizeof(Byte));
+        }
     }
 }
 
-void Decoder::read_state(
+bool Decoder::read_delta(
     Stream_Reader &reader
 ) {
-    reader.read(reinterpret_cast<void*>(&hidden_cis[0]), hidden_cis.size() * sizeof(int));
-    reader.read(reinterpret_cast<void*>(&hidden_acts[0]), hidden_acts.size() * sizeof(float));
+    Int3 delta_hidden_size;
+
+    reader.read(reinterpret_cast<void*>(&delta_hidden_size), sizeof(Int3));
+
+    int num_visible_layers;
+
+    reader.read(reinterpret_cast<void*>(&num_visible_layers), sizeof(int));
+
+    if (delta_hidden_size.x != hidden_size.x || delta_hidden_size.y != hidden_size.y || delta_hidden_size.z != hidden_size.z || num_visible_layers != visible_layers.size())
+        return false;
+
+    // the weights change from here, even if the rest turns out to be corrupt
+    weights_version++;
 
     for (int vli = 0; vli < visible_layers.size(); vli++) {
         Visible_Layer &vl = visible_layers[vli];
+        const Visible_Layer_Desc &vld = visible_layer_descs[vli];
 
-        reader.read(reinterpret_cast<void*>(&vl.input_cis_prev[0]), vl.input_cis_prev.size() * sizeof(int));
+        int diam = vld.radius * 2 + 1;
+        Index row_size = hidden_size.z * diam * diam;
+
+        int num_dirty;
+
+        reader.read(reinterpret_cast<void*>(&num_dirty), sizeof(int));
+
+        if (num_dirty < 0 || num_dirty > vl.dirty.size())
+            return false;
+
+        for (int d = 0; d < num_dirty; d++) {
+            int i;
+
+            reader.read(reinterpret_cast<void*>(&i), sizeof(int));
+
+            if (i < 0 || i >= vl.dirty.size())
+                return false;
+
+            reader.read(reinterpret_cast<void*>(&vl.weights[i * row_size]), row_size * sizeof(Byte));
+        }
     }
+
+    return true;
 }
@@ -11,6 +11,11 @@
 #include "helpers.h"
 
 namespace aon {
+// serialized decoder format: a header (magic, version) and the weights.
+// version 0 had no header and held the hidden states and previous inputs of a stream
+const int decoder_magic = 0x4345444f; // "ODEC"
+const int decoder_version = 1;
+
 // a prediction layer (predicts x_(t+1))
 class Decoder {
 public:
@@ -32,9 +37,24 @@ public:
     struct Visible_Layer {
         Byte_Buffer weights;
 
-        Int_Buffer input_cis_prev; // previous timestep (prev) input states
-
         Float_Buffer gates;
+
+        Byte_Buffer dirty; // (hidden column, input cell) weight rows learned since the last clear_dirty
+    };
+
+    // per-stream state, the decoder itself only holds weights (and the scratch buffers of learning) that may be shared by many streams
+    struct State {
+        Int_Buffer hidden_cis; // hidden state
+
+        Float_Buffer hidden_acts;
+
+        Int_Buffer hidden_sums; // activation scratch of the forward pass
+
+        Array<Int_Buffer> input_cis_prev; // previous timestep (prev) input states, per visible layer
+
+        unsigned long weights_version; // version of the weights hidden_cis was predicted with from input_cis_prev, 0 if none
+
+        unsigned long rand_state; // RNG stream learning draws from, used when steps are not given one
     };
 
     struct Params {
@@ -52,13 +72,12 @@ public:
 
     Int3 hidden_size; // size of the output/hidden/prediction
 
-    Int_Buffer hidden_cis; // hidden state
-
-    Int_Buffer hidden_sums;
-    Float_Buffer hidden_acts;
-
+    // learning scratch. learning writes the weights, so only one stream learns at a time anyway
     Float_Buffer hidden_deltas;
 
+    // counts changes of the weights (from 1), so that a state can tell whether its predictions are still what activating would give
+    unsigned long weights_version;
+
     // visible layers and descs
     Array<Visible_Layer> visible_layers;
     Array<Visible_Layer_Desc> visible_layer_descs;
@@ -70,18 +89,22 @@ public:
     void forward(
         const Int2 &column_pos,
         const Array<Int_Buffer_View> &input_cis,
+        State &stream,
+        bool acts_enabled,
         const Params &params
-    );
+    ) const;
 
     void update_gates(
         const Int2 &column_pos,
         int vli,
+        const State &stream,
         const Params &params
     );
 
     void learn(
         const Int2 &column_pos,
         Int_Buffer_View hidden_target_cis,
+        const State &stream,
         unsigned long* state,
         const Params &params
     );
@@ -90,36 +113,106 @@ public:
     // create with random initialization
     void init_random(
         const Int3 &hidden_size, // hidden/output/prediction size
-        const Array<Visible_Layer_Desc> &visible_layer_descs
+        const Array<Visible_Layer_Desc> &visible_layer_descs,
+        unsigned int seed = rand() // seed of the weight initialization
     );
 
+    // allocate a cleared state for this decoder
+    void init_state(
+        State &state,
+        unsigned int seed // seed of the state's RNG stream
+    ) const;
+
     // activate the predictor (predict values)
     void step(
+        State &state, // stream state to advance
         const Array<Int_Buffer_View> &input_cis,
         Int_Buffer_View hidden_target_cis,
         bool learn_enabled,
-        const Params &params
+        const Params &params,
+        unsigned long* rand_state = nullptr // RNG state, nullptr for the state's own stream
+    );
+
+    // step a batch of streams. streams with learning enabled learn one after the other, then all are activated together,
+    // with columns as the outer loop and streams as the inner one so weights are reused across the batch
+    void step_batch(
+        Array_View<State*> states, // stream states to advance
+        Array_View<const Array<Int_Buffer_View>*> input_cis, // input states per stream
+        Array_View<Int_Buffer_View> hidden_target_cis, // targets per stream
+        Byte_Buffer_View learn_enabled, // whether to learn, per stream
+        const Params &params, // parameters
+        unsigned long* rand_state = nullptr // RNG state, nullptr for the state's own stream
     );
 
-    void clear_state();
+    // learn a stream's targets from its previous step, before stepping it. step does this when learning is enabled
+    void learn_stream(
+        State &state,
+        Int_Buffer_View hidden_target_cis,
+        const Params &params,
+        unsigned long* rand_state = nullptr
+    );
+
+    // whether a stream's inputs and the weights are the same as when its predictions were made, so that activating again would reproduce them
+    bool inputs_unchanged(
+        const State &state,
+        const Array<Int_Buffer_View> &input_cis
+    ) const;
+
+    // activate only, for predictions that are not learned from (e.g. rollouts). hidden_acts and the inputs kept for learning are not updated.
+    // only writes the state, so different states can be activated concurrently
+    void predict(
+        State &state, // stream state to advance
+        const Array<Int_Buffer_View> &input_cis,
+        const Params &params
+    ) const;
+
+    void clear_state(
+        State &state
+    ) const;
+
+    // move the weights and scratch buffers into an arena (see Hierarchy::pack), in the order a step uses them
+    void place(
+        Arena &arena
+    );
 
     // serialization
-    int size() const; // returns size in Bytes
-    int state_size() const; // returns size of state in Bytes
+    long long size() const; // returns size in Bytes
+    long long state_size() const; // returns size of a state in Bytes
 
     void write(
         Stream_Writer &writer
     ) const;
 
+    // also reads decoders written before the format had a header (version 0), which hold the hidden states and previous inputs of a stream.
+    // those are read into state if given, otherwise skipped. write such a decoder again to convert it
     void read(
-        Stream_Reader &reader
+        Stream_Reader &reader,
+        State* state = nullptr
     );
 
     void write_state(
-        Stream_Writer &writer
+        Stream_Writer &writer,
+        const State &state
     ) const;
 
     void read_state(
+        Stream_Reader &reader,
+        State &state
+    ) const;
+
+    // incremental checkpoints. learning marks the weight rows (of a hidden column and input cell) it changes as dirty
+    void clear_dirty() {
+        for (int vli = 0; vli < visible_layers.size(); vli++)
+            visible_layers[vli].dirty.fill(false);
+    }
+
+    // write the dirty weight rows
+    void write_delta(
+        Stream_Writer &writer
+    ) const;
+
+    // apply weights written by write_delta of a decoder of the same shape. returns false if the shape differs
+    bool read_delta(
         Stream_Reader &reader
     );
 };
@@ -13,8 +13,9 @@ using namespace aon;
 void Encoder::forward(
     const Int2 &column_pos,
     const Array<Int_Buffer_View> &input_cis,
+    State &stream,
     const Params &params
-) {
+) const {
     int hidden_column_index = address2(column_pos, Int2(hidden_size.x, hidden_size.y));
 
     int hidden_cells_start = hidden_column_index * hidden_size.z;
@@ -22,11 +23,11 @@ void Encoder::forward(
     for (int hc = 0; hc < hidden_size.z; hc++) {
         int hidden_cell_index = hc + hidden_cells_start;
 
-        hidden_acts[hidden_cell_index] = 0.0f;
+        stream.hidden_acts[hidden_cell_index] = 0.0f;
     }
 
     for (int vli = 0; vli < visible_layers.size(); vli++) {
-        Visible_Layer &vl = visible_layers[vli];
+        const Visible_Layer &vl = visible_layers[vli];
         const Visible_Layer_Desc &vld = visible_layer_descs[vli];
 
         if (vl.importance == 0.0f)
@@ -49,7 +50,7 @@ void Encoder::forward(
 
         int sub_count = (iter_upper_bound.x - iter_lower_bound.x + 1) * (iter_upper_bound.y - iter_lower_bound.y + 1);
 
-        int hidden_stride = vld.size.z * diam * diam;
+        Index hidden_stride = vld.size.z * diam * diam;
 
         float influence = vl.importance / (sub_count * 255);
 
@@ -68,9 +69,9 @@ void Encoder::forward(
                 for (int hc = 0; hc < hidden_size.z; hc++) {
                     int hidden_cell_index = hc + hidden_cells_start;
 
-                    int wi = wi_offset + hidden_cell_index * hidden_stride;
+                    Index wi = wi_offset + hidden_cell_index * hidden_stride;
 
-                    hidden_acts[hidden_cell_index] += vl.weights[wi] * influence;
+                    stream.hidden_acts[hidden_cell_index] += vl.weights[wi] * influence;
                 }
             }
     }
@@ -81,7 +82,7 @@ void Encoder::forward(
     for (int hc = 0; hc < hidden_size.z; hc++) {
         int hidden_cell_index = hc + hidden_cells_start;
 
-        float activation = hidden_acts[hidden_cell_index];
+        float activation = stream.hidden_acts[hidden_cell_index];
 
         if (activation > max_activation) {
             max_activation = activation;
@@ -89,18 +90,19 @@ void Encoder::forward(
         }
     }
 
-    hidden_cis[hidden_column_index] = max_index;
+    stream.hidden_cis[hidden_column_index] = max_index;
 }
 
 void Encoder::update_gates(
     const Int2 &column_pos,
+    const State &stream,
     const Params &params
 ) {
     int hidden_column_index = address2(column_pos, Int2(hidden_size.x, hidden_size.y));
 
     int hidden_cells_start = hidden_column_index * hidden_size.z;
 
-    int hidden_cell_index_max = hidden_cis[hidden_column_index] + hidden_cells_start;
+    int hidden_cell_index_max = stream.hidden_cis[hidden_column_index] + hidden_cells_start;
 
     const float byte_inv = 1.0f / 255.0f;
 
@@ -134,10 +136,10 @@ void Encoder::update_gates(
 
                 Int2 offset(ix - field_lower_bound.x, iy - field_lower_bound.y);
 
-                int wi_start = vld.size.z * (offset.y + diam * (offset.x + diam * hidden_cell_index_max));
+                Index wi_start = vld.size.z * (offset.y + diam * (offset.x + diam * static_cast<Index>(hidden_cell_index_max)));
 
                 for (int vc = 0; vc < vld.size.z; vc++) {
-                    int wi = vc + wi_start;
+                    Index wi = vc + wi_start;
 
                     float w = (255.0f - vl.weights[wi]) * byte_inv;
 
@@ -155,6 +157,7 @@ void Encoder::learn(
     const Int2 &column_pos,
     Int_Buffer_View input_cis,
     int vli,
+    const State &stream,
     unsigned long* state,
     const Params &params
 ) {
@@ -208,16 +211,16 @@ void Encoder::learn(
             Int2 visible_center = project(hidden_pos, h_to_v);
 
             if (in_bounds(column_pos, Int2(visible_center.x - vld.radius, visible_center.y - vld.radius), Int2(visible_center.x + vld.radius + 1, visible_center.y + vld.radius + 1))) {
-                int hidden_cell_index_max = hidden_cis[hidden_column_index] + hidden_column_index * hidden_size.z;
+                int hidden_cell_index_max = stream.hidden_cis[hidden_column_index] + hidden_column_index * hidden_size.z;
 
                 Int2 offset(column_pos.x - visible_center.x + vld.radius, column_pos.y - visible_center.y + vld.radius);
 
-                int wi_start = vld.size.z * (offset.y + diam * (offset.x + diam * hidden_cell_index_max));
+                Index wi_start = vld.size.z * (offset.y + diam * (offset.x + diam * static_cast<Index>(hidden_cell_index_max)));
 
                 for (int vc = 0; vc < vld.size.z; vc++) {
                     int visible_cell_index = vc + visible_cells_start;
 
-                    int wi = vc + wi_start;
+                    Index wi = vc + wi_start;
 
                     vl.recon_sums[visible_cell_index] += vl.weights[wi];
                 }
@@ -254,18 +257,18 @@ void Encoder::learn(
             Int2 visible_center = project(hidden_pos, h_to_v);
 
             if (in_bounds(column_pos, Int2(visible_center.x - vld.radius, visible_center.y - vld.radius), Int2(visible_center.x + vld.radius + 1, visible_center.y + vld.radius + 1))) {
-                int hidden_cell_index_max = hidden_cis[hidden_column_index] + hidden_column_index * hidden_size.z;
+                int hidden_cell_index_max = stream.hidden_cis[hidden_column_index] + hidden_column_index * hidden_size.z;
 
                 Int2 offset(column_pos.x - visible_center.x + vld.radius, column_pos.y - visible_center.y + vld.radius);
 
-                int wi_start = vld.size.z * (offset.y + diam * (offset.x + diam * hidden_cell_index_max));
+                Index wi_start = vld.size.z * (offset.y + diam * (offset.x + diam * static_cast<Index>(hidden_cell_index_max)));
 
                 float gate = hidden_gates[hidden_column_index];
 
                 for (int vc = 0; vc < vld.size.z; vc++) {
                     int visible_cell_index = vc + visible_cells_start;
 
-                    int wi = vc + wi_start;
+                    Index wi = vc + wi_start;
 
                     vl.weights[wi] = min(255, max(0, vl.weights[wi] + rand_roundf(vl.recon_deltas[visible_cell_index] * gate, state)));
                 }
@@ -275,12 +278,15 @@ void Encoder::learn(
 
 void Encoder::init_random(
     const Int3 &hidden_size,
-    const Array<Visible_Layer_Desc> &visible_layer_descs
+    const Array<Visible_Layer_Desc> &visible_layer_descs,
+    unsigned int seed
 ) {
     this->visible_layer_descs = visible_layer_descs;
 
     this->hidden_size = hidden_size;
 
+    unsigned long rand_state = rand_get_state(seed);
+
     visible_layers.resize(visible_layer_descs.size());
 
     // pre-compute dimensions
@@ -302,21 +308,21 @@ void Encoder::init_random(
         int diam = vld.radius * 2 + 1;
         int area = diam * diam;
 
-        vl.weights.resize(num_hidden_cells * area * vld.size.z);
+        vl.weights.resize(static_cast<Index>(num_hidden_cells) * area * vld.size.z);
 
-        for (int i = 0; i < vl.weights.size(); i++)
-            vl.weights[i] = 255 - (rand() % init_weight_noisei);
+        for (Index i = 0; i < vl.weights.size(); i++)
+            vl.weights[i] = 255 - (rand(&rand_state) % init_weight_noisei);
 
         vl.recon_sums.resize(num_visible_cells);
 
         vl.recon_deltas.resize(num_visible_cells);
     }
 
-    hidden_cis = Int_Buffer(num_hidden_columns, 0);
+    hidden_gates.resize(num_hidden_columns);
 
-    hidden_acts.resize(num_hidden_cells);
+    dirty = Byte_Buffer(num_hidden_cells, false);
 
-    hidden_gates.resize(num_hidden_columns);
+    weights_version = 1;
 
     // generate helper buffers for parallelization
     visible_pos_vlis.resize(total_num_visible_columns);
@@ -336,42 +342,138 @@ void Encoder::init_random(
     }
 }
 
-void Encoder::step(
+void Encoder::init_state(
+    State &state,
+    unsigned int seed
+) const {
+    state.hidden_cis = Int_Buffer(hidden_size.x * hidden_size.y, 0);
+
+    state.hidden_acts.resize(hidden_size.x * hidden_size.y * hidden_size.z);
+
+    state.weights_version = 0;
+
+    state.rand_state = rand_get_state(seed);
+}
+
+void Encoder::learn_stream(
+    State &state,
     const Array<Int_Buffer_View> &input_cis,
-    bool learn_enabled,
-    const Params &params
+    const Params &params,
+    unsigned long* rand_state
 ) {
     int num_hidden_columns = hidden_size.x * hidden_size.y;
-    
-    PARALLEL_FOR
-    for (int i = 0; i < num_hidden_columns; i++)
-        forward(Int2(i / hidden_size.y, i % hidden_size.y), input_cis, params);
 
-    if (learn_enabled) {
-        PARALLEL_FOR
-        for (int i = 0; i < num_hidden_columns; i++)
-            update_gates(Int2(i / hidden_size.y, i % hidden_size.y), params);
+    {
+        TRACE_PARALLEL_FOR("encoder gates")
+        for (int i = 0; i < num_hidden_columns; i++) {
+            update_gates(Int2(i / hidden_size.y, i % hidden_size.y), state, params);
+
+            // only the weights of winning cells learn
+            dirty[state.hidden_cis[i] + i * hidden_size.z] = true;
+        }
+    }
+
+    if (rand_state == nullptr)
+        rand_state = &state.rand_state;
 
-        unsigned int base_state = rand();
+    unsigned int base_state = rand(rand_state);
 
-        PARALLEL_FOR
+    {
+        TRACE_PARALLEL_FOR("encoder learn")
         for (int i = 0; i < visible_pos_vlis.size(); i++) {
             Int2 pos = Int2(visible_pos_vlis[i].x, visible_pos_vlis[i].y);
             int vli = visible_pos_vlis[i].z;
 
-            unsigned long state = rand_get_state(base_state + i * rand_subseed_offset);
+            unsigned long learn_state = rand_get_state(base_state + i * rand_subseed_offset);
+
+            learn(pos, input_cis[vli], vli, state, &learn_state, params);
+        }
+    }
+
+    weights_version++;
+}
+
+void Encoder::activate(
+    State &state,
+    const Array<Int_Buffer_View> &input_cis,
+    const Params &params
+) const {
+    int num_hidden_columns = hidden_size.x * hidden_size.y;
+    
+    TRACE_PARALLEL_FOR("encoder forward")
+    for (int i = 0; i < num_hidden_columns; i++)
+        forward(Int2(i / hidden_size.y, i % hidden_size.y), input_cis, state, params);
+
+    state.weights_version = weights_version;
+}
+
+void Encoder::step(
+    State &state,
+    const Array<Int_Buffer_View> &input_cis,
+    bool learn_enabled,
+    const Params &params,
+    unsigned long* rand_state
+) {
+    activate(state, input_cis, params);
+
+    if (learn_enabled)
+        learn_stream(state, input_cis, params, rand_state);
+}
+
+void Encoder::step_batch(
+    Array_View<State*> states,
+    Array_View<const Array<Int_Buffer_View>*> input_cis,
+    Byte_Buffer_View learn_enabled,
+    const Params &params,
+    unsigned long* rand_state
+) {
+    int num_hidden_columns = hidden_size.x * hidden_size.y;
+    
+    {
+        TRACE_PARALLEL_FOR("encoder forward batch")
+        for (int i = 0; i < num_hidden_columns; i++) {
+            Int2 column_pos(i / hidden_size.y, i % hidden_size.y);
 
-            learn(pos, input_cis[vli], vli, &state, params);
+            for (int b = 0; b < states.size(); b++)
+                forward(column_pos, *input_cis[b], *states[b], params);
         }
     }
+
+    for (int b = 0; b < states.size(); b++)
+        states[b]->weights_version = weights_version;
+
+    for (int b = 0; b < states.size(); b++) {
+        if (learn_enabled[b])
+            learn_stream(*states[b], *input_cis[b], params, rand_state);
+    }
 }
 
-void Encoder::clear_state() {
-    hidden_cis.fill(0);
+void Encoder::clear_state(
+    State &state
+) const {
+    state.hidden_cis.fill(0);
+
+    state.weights_version = 0;
 }
 
-int Encoder::size() const {
-    int size = sizeof(Int3) + hidden_cis.size() * sizeof(int) + sizeof(int);
+void Encoder::place(
+    Arena &arena
+) {
+    for (int vli = 0; vli < visible_layers.size(); vli++) {
+        Visible_Layer &vl = visible_layers[vli];
+
+        arena.place(vl.weights);
+        arena.place(vl.recon_sums);
+        arena.place(vl.recon_deltas);
+    }
+
+    arena.place(hidden_gates);
+    arena.place(visible_pos_vlis);
+    arena.place(dirty);
+}
+
+long long Encoder::size() const {
+    long long size = 2 * sizeof(int) + sizeof(Int3) + sizeof(int);
 
     for (int vli = 0; vli < visible_layers.size(); vli++) {
         const Visible_Layer &vl = visible_layers[vli];
@@ -382,16 +484,17 @@ int Encoder::size() const {
     return size;
 }
 
-int Encoder::state_size() const {
-    return hidden_cis.size() * sizeof(int);
+long long Encoder::state_size() const {
+    return hidden_size.x * hidden_size.y * sizeof(int);
 }
 
 void Encoder::write(
     Stream_Writer &writer
 ) const {
-    writer.write(reinterpret_cast<const void*>(&hidden_size), sizeof(Int3));
+    writer.write(reinterpret_cast<const void*>(&encoder_magic), sizeof(int));
+    writer.write(reinterpret_cast<const void*>(&encoder_version), sizeof(int));
 
-    writer.write(reinterpret_cast<const void*>(&hidden_cis[0]), hidden_cis.size() * sizeof(int));
+    writer.write(reinterpret_cast<const void*>(&hidden_size), sizeof(Int3));
 
     int num_visible_layers = visible_layers.size();
 
@@ -410,21 +513,51 @@ void Encoder::write(
 }
 
 void Encoder::read(
-    Stream_Reader &reader
+    Stream_Reader &reader,
+    State* state
 ) {
-    reader.read(reinterpret_cast<void*>(&hidden_size), sizeof(Int3));
+    int magic;
+
+    reader.read(reinterpret_cast<void*>(&magic), sizeof(int));
+
+    int version = 0;
+
+    // without a header, the first int is the start of the hidden size
+    if (magic != encoder_magic) {
+        hidden_size.x = magic;
+
+        reader.read(reinterpret_cast<void*>(&hidden_size.y), sizeof(Int3) - sizeof(int));
+    }
+    else {
+        reader.read(reinterpret_cast<void*>(&version), sizeof(int));
+
+        assert(version == encoder_version);
+
+        reader.read(reinterpret_cast<void*>(&hidden_size), sizeof(Int3));
+    }
 
     int num_hidden_columns = hidden_size.x * hidden_size.y;
     int num_hidden_cells = num_hidden_columns * hidden_size.z;
 
-    hidden_cis.resize(num_hidden_columns);
+    // version 0 stored the hidden states of its stream here
+    if (version == 0) {
+        Int_Buffer legacy_hidden_cis(num_hidden_columns);
+
+        reader.read(reinterpret_cast<void*>(&legacy_hidden_cis[0]), legacy_hidden_cis.size() * sizeof(int));
 
-    reader.read(reinterpret_cast<void*>(&hidden_cis[0]), hidden_cis.size() * sizeof(int));
+        if (state != nullptr) {
+            init_state(*state, 0);
 
-    hidden_acts.resize(num_hidden_cells);
+            state->hidden_cis = legacy_hidden_cis;
+        }
+    }
 
     hidden_gates.resize(num_hidden_columns);
 
+    dirty = Byte_Buffer(num_hidden_cells, false);
+
+    weights_version = 1;
+
     int num_visible_layers = visible_layers.size();
 
     reader.read(reinterpret_cast<void*>(&num_visible_layers), sizeof(int));
@@ -448,9 +581,7 @@ void Encoder::read(
         int diam = vld.radius * 2 + 1;
         int area = diam * diam;
 
-        vl.weights.resize(num_hidden_cells * area * vld.size.z);
-
-        reader.read(reinterpret_cast<void*>(&vl.weights[0]), vl.weights.size() * sizeof(Byte));
+        read_array(reader, vl.weights, static_cast<Index>(num_hidden_cells) * area * vld.size.z);
 
         vl.recon_sums.resize(num_visible_cells);
 
@@ -478,13 +609,107 @@ void Encoder::read(
 }
 
 void Encoder::write_state(
-    Stream_Writer &writer
+    Stream_Writer &writer,
+    const State &state
 ) const {
-    writer.write(reinterpret_cast<const void*>(&hidden_cis[0]), hidden_cis.size() * sizeof(int));
+    writer.write(reinterpret_cast<const void*>(&state.hidden_cis[0]), state.hidden_cis.size() * sizeof(int));
 }
 
 void Encoder::read_state(
+    Stream_Reader &reader,
+    State &state
+) const {
+    state.hidden_cis.resize(hidden_size.x * hidden_size.y);
+    state.hidden_acts.resize(hidden_size.x * hidden_size.y * hidden_size.z);
+
+    state.weights_version = 0;
+
+    reader.read(reinterpret_cast<void*>(&state.hidden_cis[0]), state.hidden_cis.size() * sizeof(int));
+}
+
+void Encoder::write_delta(
+    Stream_Writer &writer
+) const {
+    writer.write(reinterpret_cast<const void*>(&hidden_size), sizeof(Int3));
+
+    int num_visible_layers = visible_layers.size();
+
+    writer.write(reinterpret_cast<const void*>(&num_visible_layers), sizeof(int));
+
+    int num_dirty = 0;
+
+    for (int i = 0; i < dirty.size(); i++)
+        num_dirty += dirty[i];
+
+    writer.write(reinterpret_cast<const void*>(&num_dirty), sizeof(int));
+
+    for (int i = 0; i < dirty.size(); i++) {
+        if (!dirty[i])
+            continue;
+
+        writer.write(reinterpret_cast<const void*>(&i), sizeof(int));
+
+        for (int vli = 0; vli < visible_layers.size(); vli++) {
+            const Visible_Layer &vl = visible_layers[vli];
+            const Visible_Layer_Desc &vld = visible_layer_descs[vli];
+
+            int diam = vld.radius * 2 + 1;
+            Index cell_size = diam * diam * vld.size.z;
+
+            writer.write(reinterpret_cast<const void*>(&vl.weights[i * cell_size]), cell_size * sizeof(Byte));
+        }
+    }
+
+    // importances are not learned but may have been set
+    for (int vli = 0; vli < visible_layers.size(); vli++)
+        writer.write(reinterpret_cast<const void*>(&visible_layers[vli].importance), sizeof(float));
+}
+
+bool Encoder::read_delta(
     Stream_Reader &reader
 ) {
-    reader.read(reinterpret_cast<void*>(&hidden_cis[0]), hidden_cis.size() * sizeof(int));
+    Int3 delta_hidden_size;
+
+    reader.read(reinterpret_cast<void*>(&delta_hidden_size), sizeof(Int3));
+
+    int num_visible_layers;
+
+    reader.read(reinterpret_cast<void*>(&num_visible_layers), sizeof(int));
+
+    if (delta_hidden_size.x != hidden_size.x || delta_hidden_size.y != hidden_size.y || delta_hidden_size.z != hidden_size.z || num_visible_layers != visible_layers.size())
+        return false;
+
+    // the weights change from here, even if the rest turns out to be corrupt
+    weights_version++;
+
+    int num_dirty;
+
+    reader.read(reinterpret_cast<void*>(&num_dirty), sizeof(int));
+
+    if (num_dirty < 0 || num_dirty > dirty.size())
+        return false;
+
+    for (int d = 0; d < num_dirty; d++) {
+        int i;
+
+        reader.read(reinterpret_cast<void*>(&i), sizeof(int));
+
+        if (i < 0 || i >= dirty.size())
+            return false;
+
+        for (int vli = 0; vli < visible_layers.size(); vli++) {
+            Visible_Layer &vl = visible_layers[vli];
+            const Visible_Layer_Desc &vld = visible_layer_descs[vli];
+
+            int diam = vld.radius * 2 + 1;
+            Index cell_size = diam * diam * vld.size.z;
+
+            reader.read(reinterpret_cast<void*>(&vl.weights[i * cell_size]), cell_size * sizeof(Byte));
+        }
+    }
+
+    for (int vli = 0; vli < visible_layers.size(); vli++)
+        reader.read(reinterpret_cast<void*>(&visible_layers[vli].importance), sizeof(float));
+
+    return true;
 }
@@ -11,6 +11,11 @@
 #include "helpers.h"
 
 namespace aon {
+// serialized encoder format: a header (magic, version) and the weights.
+// version 0 had no header and held the hidden states of a stream after the hidden size
+const int encoder_magic = 0x434e454f; // "OENC"
+const int encoder_version = 1;
+
 // sparse coder
 class Encoder {
 public:
@@ -44,6 +49,17 @@ public:
         {}
     };
 
+    // per-stream state, the encoder itself only holds weights (and the scratch buffers of learning) that may be shared by many streams
+    struct State {
+        Int_Buffer hidden_cis;
+
+        Float_Buffer hidden_acts; // activation scratch of the forward pass
+
+        unsigned long weights_version; // version of the weights hidden_cis was activated with, 0 if none
+
+        unsigned long rand_state; // RNG stream learning draws from, used when steps are not given one
+    };
+
     struct Params {
         float scale; // scale of exp
         float lr; // learning rate
@@ -59,11 +75,14 @@ public:
 
     Int3 hidden_size; // size of hidden/output layer
 
-    Int_Buffer hidden_cis;
+    // learning scratch. learning writes the weights, so only one stream learns at a time anyway
+    Float_Buffer hidden_gates;
 
-    Float_Buffer hidden_acts;
+    // hidden cells whose weights learned since the last clear_dirty, for incremental checkpoints
+    Byte_Buffer dirty;
 
-    Float_Buffer hidden_gates;
+    // counts changes of the weights (from 1), so that a state can tell whether its output is still what activating would give
+    unsigned long weights_version;
 
     // visible layers and associated descriptors
     Array<Visible_Layer> visible_layers;
@@ -76,11 +95,13 @@ public:
     void forward(
         const Int2 &column_pos,
         const Array<Int_Buffer_View> &input_cis,
+        State &stream,
         const Params &params
-    );
+    ) const;
 
     void update_gates(
         const Int2 &column_pos,
+        const State &stream,
         const Params &params
     );
 
@@ -88,6 +109,7 @@ public:
         const Int2 &column_pos,
         Int_Buffer_View input_cis,
         int vli,
+        const State &stream,
         unsigned long* state,
         const Params &params
     );
@@ -96,34 +118,102 @@ public:
     // create a sparse coding layer with random initialization
     void init_random(
         const Int3 &hidden_size, // hidden/output size
-        const Array<Visible_Layer_Desc> &visible_layer_descs // descriptors for visible layers
+        const Array<Visible_Layer_Desc> &visible_layer_descs, // descriptors for visible layers
+        unsigned int seed = rand() // seed of the weight initialization
     );
 
+    // allocate a cleared state for this encoder
+    void init_state(
+        State &state,
+        unsigned int seed // seed of the state's RNG stream
+    ) const;
+
+    // activate only, without learning. only writes the state, so different states can be activated concurrently
+    void activate(
+        State &state, // stream state to advance
+        const Array<Int_Buffer_View> &input_cis, // input states
+        const Params &params // parameters
+    ) const;
+
     void step(
+        State &state, // stream state to advance
         const Array<Int_Buffer_View> &input_cis, // input states
         bool learn_enabled, // whether to learn
-        const Params &params // parameters
+        const Params &params, // parameters
+        unsigned long* rand_state = nullptr // RNG state, nullptr for the state's own stream
     );
 
-    void clear_state();
+    // step a batch of streams. columns are the outer loop and streams the inner one, so weights are reused across the batch.
+    // streams with learning enabled then learn one after the other
+    void step_batch(
+        Array_View<State*> states, // stream states to advance
+        Array_View<const Array<Int_Buffer_View>*> input_cis, // input states per stream
+        Byte_Buffer_View learn_enabled, // whether to learn, per stream
+        const Params &params, // parameters
+        unsigned long* rand_state = nullptr // RNG state, nullptr for the state's own stream
+    );
+
+    // learn from the latest step of a stream, the inputs it was stepped with. step does this when learning is enabled
+    void learn_stream(
+        State &state,
+        const Array<Int_Buffer_View> &input_cis,
+        const Params &params,
+        unsigned long* rand_state = nullptr
+    );
+
+    void clear_state(
+        State &state
+    ) const;
+
+    // move the weights and scratch buffers into an arena (see Hierarchy::pack), in the order a step uses them
+    void place(
+        Arena &arena
+    );
 
     // serialization
-    int size() const; // returns size in bytes
-    int state_size() const; // returns size of state in bytes
+    long long size() const; // returns size in bytes
+    long long state_size() const; // returns size of a state in bytes
 
     void write(
         Stream_Writer &writer
     ) const;
 
+    // also reads encoders written before the format had a header (version 0), which hold the hidden states of a stream.
+    // those are read into state if given, otherwise skipped. write such an encoder again to convert it
     void read(
-        Stream_Reader &reader
+        Stream_Reader &reader,
+        State* state = nullptr
     );
 
     void write_state(
-        Stream_Writer &writer
+        Stream_Writer &writer,
+        const State &state
     ) const;
 
     void read_state(
+        Stream_Reader &reader,
+        State &state
+    ) const;
+
+    // whether a stream's output was activated with the current weights, so activating it again on the same inputs would reproduce it
+    bool output_current(
+        const State &state
+    ) const {
+        return state.weights_version == weights_version;
+    }
+
+    // incremental checkpoints. learning marks the weights of the hidden cells it changes as dirty
+    void clear_dirty() {
+        dirty.fill(false);
+    }
+
+    // write the weights of dirty hidden cells
+    void write_delta(
+        Stream_Writer &writer
+    ) const;
+
+    // apply weights written by write_delta of an encoder of the same shape. returns false if the shape differs
+    bool read_delta(
         Stream_Reader &reader
     );
 };
@@ -12,6 +12,17 @@
 #include <omp.h>
 #endif
 
+#ifdef USE_MMAP
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+
 using namespace aon;
 
 float aon::expf(
@@ -199,6 +210,14 @@ void aon::set_num_threads(
 int aon::get_num_threads() {
     return omp_get_num_threads();
 }
+
+int aon::get_max_threads() {
+    return omp_get_max_threads();
+}
+
+double aon::get_time() {
+    return omp_get_wtime();
+}
 #else
 void aon::set_num_threads(
     int num_threads
@@ -207,6 +226,14 @@ void aon::set_num_threads(
 int aon::get_num_threads() {
     return 0;
 }
+
+int aon::get_max_threads() {
+    return 1;
+}
+
+double aon::get_time() {
+    return 0.0;
+}
 #endif
 
 Int2 aon::min_overhang(
@@ -234,6 +261,10 @@ Int2 aon::min_overhang(
     return new_pos;
 }
 
+#ifdef USE_ALLOCATION_COUNT
+unsigned long aon::allocation_count = 0;
+#endif
+
 unsigned long aon::global_state = rand_get_state(12345);
 
 float aon::rand_normalf(
@@ -244,3 +275,922 @@ float aon::rand_normalf(
 
     return sqrtf(-2.0f * logf(u1)) * cosf(pi2 * u2);
 }
+
+#ifdef USE_MMAP
+// create a file named after base with a unique suffix, holding a copy of data, and map it. the file is unlinked, so it is removed once unmapped.
+// data is written through the page cache, so the copy does not have to be resident. returns MAP_FAILED on failure
+static void* map_file_copy(
+    const char* base,
+    const void* data,
+    long size
+) {
+    long base_len = strlen(base);
+
+    Array<char> name(base_len + 8);
+
+    memcpy(name.p, base, base_len);
+    memcpy(name.p + base_len, ".XXXXXX", 8);
+
+    int fd = mkstemp(name.p);
+
+    if (fd == -1)
+        return MAP_FAILED;
+
+    unlink(name.p);
+
+    long written = 0;
+
+    while (written < size) {
+        long n = write(fd, static_cast<const char*>(data) + written, size - written);
+
+        if (n <= 0)
+            break;
+
+        written += n;
+    }
+
+    void* mapped = (written == size ? mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0) : MAP_FAILED);
+
+    close(fd);
+
+    return mapped;
+}
+
+Mapped_Region &Mapped_Region::operator=(
+    const Mapped_Region &other
+) {
+    if (this == &other)
+        return *this;
+
+    unmap();
+
+    if (other.p == nullptr)
+        return *this;
+
+    if (other.file_backed) {
+        void* data = map_file_copy(other.file_name.p, other.p, other.s);
+
+        if (data != MAP_FAILED) {
+            p = data;
+            s = other.s;
+            file_backed = true;
+            file_name = other.file_name;
+
+            return *this;
+        }
+    }
+
+    if (map(nullptr, other.s))
+        memcpy(p, other.p, s);
+
+    return *this;
+}
+
+bool Mapped_Region::map(
+    const char* file_name,
+    long size
+) {
+    unmap();
+
+    if (size <= 0)
+        return false;
+
+    void* data;
+
+    if (file_name == nullptr)
+        data = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    else {
+        int fd = open(file_name, O_RDWR | O_CREAT, 0644);
+
+        if (fd == -1)
+            return false;
+
+        if (ftruncate(fd, size) != 0) {
+            close(fd);
+
+            return false;
+        }
+
+        data = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+
+        // mapping stays valid after the descriptor is closed
+        close(fd);
+    }
+
+    if (data == MAP_FAILED)
+        return false;
+
+    p = data;
+    s = size;
+    file_backed = (file_name != nullptr);
+
+    if (file_backed) {
+        long name_len = strlen(file_name);
+
+        this->file_name.resize(name_len + 1);
+
+        memcpy(this->file_name.p, file_name, name_len + 1);
+    }
+
+    return true;
+}
+
+bool Mapped_Region::map_private(
+    const char* file_name
+) {
+    unmap();
+
+    int fd = open(file_name, O_RDONLY);
+
+    if (fd == -1)
+        return false;
+
+    struct stat st;
+
+    if (fstat(fd, &st) != 0 || st.st_size <= 0) {
+        close(fd);
+
+        return false;
+    }
+
+    void* data = mmap(nullptr, st.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+
+    close(fd);
+
+    if (data == MAP_FAILED)
+        return false;
+
+    p = data;
+    s = st.st_size;
+    file_backed = false; // written pages are private, dropping them would lose the writes
+
+    return true;
+}
+
+void Mapped_Region::unmap() {
+    if (p != nullptr)
+        munmap(p, s);
+
+    p = nullptr;
+    s = 0;
+    file_backed = false;
+    file_name.resize(0);
+}
+
+void Mapped_Region::prefetch(
+    long offset,
+    long len
+) const {
+    long page_size = sysconf(_SC_PAGESIZE);
+
+    long start = offset / page_size * page_size;
+
+    madvise(static_cast<char*>(p) + start, min(s - start, len + offset - start), MADV_WILLNEED);
+}
+
+void Mapped_Region::evict(
+    long offset,
+    long len
+) const {
+    // dropping pages of anonymous memory would lose them
+    if (!file_backed)
+        return;
+
+    long page_size = sysconf(_SC_PAGESIZE);
+
+    long start = offset / page_size * page_size;
+
+    madvise(static_cast<char*>(p) + start, min(s - start, len + offset - start), MADV_DONTNEED);
+}
+#else
+Mapped_Region &Mapped_Region::operator=(
+    const Mapped_Region &
+) {
+    return *this;
+}
+
+bool Mapped_Region::map(
+    const char*,
+    long
+) {
+    return false;
+}
+
+bool Mapped_Region::map_private(
+    const char*
+) {
+    return false;
+}
+
+void Mapped_Region::unmap() {}
+
+void Mapped_Region::prefetch(
+    long,
+    long
+) const {}
+
+void Mapped_Region::evict(
+    long,
+    long
+) const {}
+#endif
+
+void Mapped_Reader::read(
+    void* data,
+    long long len
+) {
+    if (len < 0 || len > size - pos) {
+        memset(data, 0, max<long long>(0, len));
+
+        failed = true;
+
+        return;
+    }
+
+    memcpy(data, static_cast<Byte*>(region.data()) + pos, len);
+
+    pos += len;
+}
+
+void* Mapped_Reader::view(
+    long long len
+) {
+    if (len < 0 || len > size - pos)
+        return nullptr;
+
+    void* data = static_cast<Byte*>(region.data()) + pos;
+
+    pos += len;
+
+    return data;
+}
+
+void Memory_Writer::write(
+    const void* data,
+    long long len
+) {
+    if (size + len > buffer.size())
+        buffer.resize(max<long long>(size + len, buffer.size() * 2));
+
+    memcpy(buffer.p + size, data, len);
+
+    size += len;
+}
+
+void* Memory_Writer::view(
+    long long len
+) {
+    if (size + len > buffer.size())
+        buffer.resize(max<long long>(size + len, buffer.size() * 2));
+
+    void* p = buffer.p + size;
+
+    size += len;
+
+    return p;
+}
+
+void Memory_Reader::read(
+    void* dst,
+    long long len
+) {
+    if (len < 0 || len > data.size() - pos) {
+        memset(dst, 0, max<long long>(0, len));
+
+        failed = true;
+
+        return;
+    }
+
+    memcpy(dst, data.p + pos, len);
+
+    pos += len;
+}
+
+void Span_Reader::read(
+    void* dst,
+    long long len
+) {
+    if (len < 0 || len > data.size() - pos) {
+        memset(dst, 0, max<long long>(0, len));
+
+        failed = true;
+
+        return;
+    }
+
+    memcpy(dst, data.p + pos, len);
+
+    pos += len;
+}
+
+void* Span_Reader::view(
+    long long len
+) {
+    if (len < 0 || len > data.size() - pos)
+        return nullptr;
+
+    void* p = data.p + pos;
+
+    pos += len;
+
+    return p;
+}
+
+void Span_Writer::write(
+    const void* src,
+    long long len
+) {
+    if (pos + len > data.size()) {
+        overflowed = true;
+
+        return;
+    }
+
+    memcpy(data.p + pos, src, len);
+
+    pos += len;
+}
+
+void* Span_Writer::view(
+    long long len
+) {
+    if (pos + len > data.size()) {
+        overflowed = true;
+
+        return nullptr;
+    }
+
+    void* p = data.p + pos;
+
+    pos += len;
+
+    return p;
+}
+
+bool File_Writer::open(
+    const char* file_name
+) {
+    close();
+
+    file = fopen(file_name, "wb");
+
+    if (file == nullptr)
+        return false;
+
+    // buffered here instead
+    setvbuf(static_cast<FILE*>(file), nullptr, _IONBF, 0);
+
+    buffer.resize(file_buffer_size);
+
+    size = 0;
+    failed = false;
+
+    return true;
+}
+
+void File_Writer::write(
+    const void* data,
+    long long len
+) {
+    if (file == nullptr) {
+        failed = true;
+
+        return;
+    }
+
+    const Byte* src = static_cast<const Byte*>(data);
+
+    // top up the buffer
+    if (size > 0) {
+        int n = min<long long>(len, buffer.size() - size);
+
+        memcpy(buffer.p + size, src, n);
+
+        size += n;
+        src += n;
+        len -= n;
+
+        if (size < buffer.size())
+            return;
+
+        flush();
+    }
+
+    // whole buffers directly
+    long long direct_len = len / buffer.size() * buffer.size();
+
+    if (direct_len > 0) {
+        if (fwrite(src, 1, direct_len, static_cast<FILE*>(file)) != static_cast<size_t>(direct_len))
+            failed = true;
+
+        src += direct_len;
+        len -= direct_len;
+    }
+
+    memcpy(buffer.p, src, len);
+
+    size = len;
+}
+
+bool File_Writer::flush() {
+    if (file == nullptr)
+        return false;
+
+    if (size > 0) {
+        if (fwrite(buffer.p, 1, size, static_cast<FILE*>(file)) != static_cast<size_t>(size))
+            failed = true;
+
+        size = 0;
+    }
+
+    return !failed;
+}
+
+bool File_Writer::close() {
+    if (file == nullptr)
+        return false;
+
+    bool success = flush();
+
+    if (fclose(static_cast<FILE*>(file)) != 0)
+        success = false;
+
+    file = nullptr;
+
+    return success;
+}
+
+bool File_Reader::open(
+    const char* file_name
+) {
+    close();
+
+    file = fopen(file_name, "rb");
+
+    if (file == nullptr)
+        return false;
+
+    setvbuf(static_cast<FILE*>(file), nullptr, _IONBF, 0);
+
+    left = -1;
+
+    if (fseek(static_cast<FILE*>(file), 0, SEEK_END) == 0)
+        left = ftell(static_cast<FILE*>(file));
+
+    if (fseek(static_cast<FILE*>(file), 0, SEEK_SET) != 0)
+        left = -1;
+
+    buffer.resize(file_buffer_size);
+
+    start = 0;
+    size = 0;
+    failed = false;
+
+    return true;
+}
+
+void File_Reader::read(
+    void* data,
+    long long len
+) {
+    Byte* dst = static_cast<Byte*>(data);
+
+    if (left >= 0)
+        left = max<long long>(0, left - len);
+
+    if (file == nullptr) {
+        memset(dst, 0, len);
+
+        failed = true;
+
+        return;
+    }
+
+    // drain the buffer
+    int n = min<long long>(len, size - start);
+
+    memcpy(dst, buffer.p + start, n);
+
+    start += n;
+    dst += n;
+    len -= n;
+
+    if (len == 0)
+        return;
+
+    // whole buffers directly
+    long long direct_len = len / buffer.size() * buffer.size();
+
+    if (direct_len > 0) {
+        long long read_len = fread(dst, 1, direct_len, static_cast<FILE*>(file));
+
+        dst += read_len;
+        len -= read_len;
+
+        if (read_len < direct_len) {
+            memset(dst, 0, len);
+
+            failed = true;
+
+            return;
+        }
+    }
+
+    if (len == 0)
+        return;
+
+    start = 0;
+    size = fread(buffer.p, 1, buffer.size(), static_cast<FILE*>(file));
+
+    n = min<long long>(len, size);
+
+    memcpy(dst, buffer.p, n);
+
+    start = n;
+
+    if (n < len) {
+        memset(dst + n, 0, len - n);
+
+        failed = true;
+    }
+}
+
+void File_Reader::close() {
+    if (file != nullptr)
+        fclose(static_cast<FILE*>(file));
+
+    file = nullptr;
+    left = -1;
+
+    start = 0;
+    size = 0;
+}
+
+// symbol frequencies sum to 1 << rans_prob_bits. the state is kept in [rans_low, rans_low << 8) and renormalized a byte at a time
+const int rans_prob_bits = 12;
+const unsigned int rans_prob_scale = 1u << rans_prob_bits;
+const unsigned int rans_low = 1u << 23;
+const int rans_header_size = 256 * sizeof(unsigned short);
+
+// scale counts to frequencies summing to rans_prob_scale, keeping every occurring symbol at least 1
+static void rans_normalize(
+    const int* counts,
+    int total,
+    unsigned short* freqs
+) {
+    int sum = 0;
+
+    for (int s = 0; s < 256; s++) {
+        if (counts[s] == 0) {
+            freqs[s] = 0;
+
+            continue;
+        }
+
+        int freq = max(1, static_cast<int>(static_cast<long long>(counts[s]) * rans_prob_scale / total));
+
+        freqs[s] = freq;
+        sum += freq;
+    }
+
+    // take rounding errors from (or give them to) the most frequent symbols
+    while (sum != rans_prob_scale) {
+        int max_index = 0;
+
+        for (int s = 1; s < 256; s++) {
+            if (freqs[s] > freqs[max_index])
+                max_index = s;
+        }
+
+        if (sum < static_cast<int>(rans_prob_scale)) {
+            freqs[max_index] += rans_prob_scale - sum;
+            sum = rans_prob_scale;
+        }
+        else {
+            freqs[max_index]--;
+            sum--;
+        }
+    }
+}
+
+bool aon::rans_encode(
+    Byte_Buffer_View src,
+    Byte_Buffer &dst
+) {
+    if (src.size() <= rans_header_size + 4)
+        return false;
+
+    int counts[256] = { 0 };
+
+    for (int i = 0; i < src.size(); i++)
+        counts[src[i]]++;
+
+    unsigned short freqs[256];
+
+    rans_normalize(counts, src.size(), freqs);
+
+    unsigned int cums[256];
+
+    unsigned int cum = 0;
+
+    for (int s = 0; s < 256; s++) {
+        cums[s] = cum;
+        cum += freqs[s];
+    }
+
+    // the stream is written backwards from the end, giving up once it reaches the header (not smaller than src)
+    dst.resize(src.size());
+
+    int pos = dst.size();
+
+    unsigned int x = rans_low;
+
+    for (int i = src.size() - 1; i >= 0; i--) {
+        int s = src[i];
+        unsigned int freq = freqs[s];
+
+        unsigned int x_max = ((rans_low >> rans_prob_bits) << 8) * freq;
+
+        while (x >= x_max) {
+            if (pos == rans_header_size)
+                return false;
+
+            dst[--pos] = x & 0xff;
+            x >>= 8;
+        }
+
+        x = ((x / freq) << rans_prob_bits) + (x % freq) + cums[s];
+    }
+
+    // final state, little endian. must end up smaller than src
+    if (pos - rans_header_size <= 4)
+        return false;
+
+    for (int b = 3; b >= 0; b--)
+        dst[--pos] = (x >> (b * 8)) & 0xff;
+
+    int stream_size = dst.size() - pos;
+
+    memcpy(dst.p, freqs, rans_header_size);
+    memmove(dst.p + rans_header_size, dst.p + pos, stream_size);
+
+    dst.resize(rans_header_size + stream_size);
+
+    return true;
+}
+
+bool aon::rans_decode(
+    Byte_Buffer_View src,
+    Byte_Buffer_View dst
+) {
+    if (src.size() < rans_header_size + 4)
+        return false;
+
+    unsigned short freqs[256];
+
+    memcpy(freqs, src.p, rans_header_size);
+
+    unsigned int cums[256];
+
+    // symbol of each slot of the cumulative frequency range
+    Byte slot_symbols[rans_prob_scale];
+
+    unsigned int cum = 0;
+
+    for (int s = 0; s < 256; s++) {
+        if (cum + freqs[s] > rans_prob_scale)
+            return false;
+
+        cums[s] = cum;
+
+        for (unsigned int f = 0; f < freqs[s]; f++)
+            slot_symbols[cum + f] = s;
+
+        cum += freqs[s];
+    }
+
+    if (cum != rans_prob_scale)
+        return false;
+
+    int pos = rans_header_size;
+
+    unsigned int x = 0;
+
+    for (int b = 0; b < 4; b++)
+        x |= static_cast<unsigned int>(src[pos++]) << (b * 8);
+
+    for (int i = 0; i < dst.size(); i++) {
+        unsigned int slot = x & (rans_prob_scale - 1);
+        int s = slot_symbols[slot];
+
+        dst[i] = s;
+
+        x = freqs[s] * (x >> rans_prob_bits) + slot - cums[s];
+
+        while (x < rans_low) {
+            if (pos == src.size())
+                return false;
+
+            x = (x << 8) | src[pos++];
+        }
+    }
+
+    return true;
+}
+
+unsigned long long aon::checksum(
+    const void* data,
+    long long len,
+    unsigned long long hash
+) {
+    const Byte* bytes = static_cast<const Byte*>(data);
+
+    for (int i = 0; i < len; i++) {
+        hash ^= bytes[i];
+        hash *= 1099511628211ull;
+    }
+
+    return hash;
+}
+
+#ifdef USE_TRACE
+// buffers are claimed by threads on their first event and kept for the lifetime of the process
+static Trace_Buffer* trace_buffers[trace_max_threads];
+static int trace_num_buffers = 0;
+
+// used by threads beyond trace_max_threads, always full
+static Trace_Buffer trace_overflow_buffer = { Array<Trace_Event>(), trace_capacity, 0 };
+
+static thread_local Trace_Buffer* trace_buffer = nullptr;
+
+void aon::trace_record(
+    const char* name,
+    int index,
+    double begin,
+    double end
+) {
+    if (trace_buffer == nullptr) {
+        int buffer_index;
+
+#ifdef USE_OMP
+        #pragma omp atomic capture
+#endif
+        buffer_index = trace_num_buffers++;
+
+        if (buffer_index < trace_max_threads) {
+            trace_buffer = new Trace_Buffer();
+
+            trace_buffer->events.resize(trace_capacity);
+            trace_buffer->num_events = 0;
+            trace_buffer->num_dropped = 0;
+
+            trace_buffers[buffer_index] = trace_buffer;
+        }
+        else
+            trace_buffer = &trace_overflow_buffer;
+    }
+
+    if (trace_buffer->num_events >= trace_capacity) {
+        trace_buffer->num_dropped++;
+
+        return;
+    }
+
+    Trace_Event &e = trace_buffer->events[trace_buffer->num_events];
+
+    e.name = name;
+    e.index = index;
+    e.begin = begin;
+    e.end = end;
+
+    trace_buffer->num_events++;
+}
+
+static void trace_write_string(
+    Stream_Writer &writer,
+    const char* str
+) {
+    int len = 0;
+
+    while (str[len] != '\0')
+        len++;
+
+    writer.write(str, len);
+}
+
+static void trace_write_int(
+    Stream_Writer &writer,
+    long value
+) {
+    char digits[24];
+    int len = 0;
+
+    bool negative = (value < 0);
+
+    if (negative)
+        value = -value;
+
+    do {
+        digits[sizeof(digits) - 1 - len] = '0' + value % 10;
+        value /= 10;
+        len++;
+    } while (value > 0);
+
+    if (negative) {
+        digits[sizeof(digits) - 1 - len] = '-';
+        len++;
+    }
+
+    writer.write(digits + sizeof(digits) - len, len);
+}
+
+// microseconds with nanosecond precision
+static void trace_write_time(
+    Stream_Writer &writer,
+    double seconds
+) {
+    long ns = static_cast<long>(seconds * 1.0e9 + 0.5);
+
+    trace_write_int(writer, ns / 1000);
+
+    char frac[4] = { '.', static_cast<char>('0' + ns / 100 % 10), static_cast<char>('0' + ns / 10 % 10), static_cast<char>('0' + ns % 10) };
+
+    writer.write(frac, sizeof(frac));
+}
+
+void aon::trace_dump(
+    Stream_Writer &writer
+) {
+    int num_buffers = min(trace_num_buffers, trace_max_threads);
+
+    // relative to the first event
+    double origin = 0.0;
+    bool has_origin = false;
+
+    for (int t = 0; t < num_buffers; t++) {
+        const Trace_Buffer* b = trace_buffers[t];
+
+        for (int i = 0; i < b->num_events; i++) {
+            if (!has_origin || b->events[i].begin < origin) {
+                origin = b->events[i].begin;
+                has_origin = true;
+            }
+        }
+    }
+
+    trace_write_string(writer, "{\"traceEvents\":[");
+
+    bool first = true;
+
+    for (int t = 0; t < num_buffers; t++) {
+        const Trace_Buffer* b = trace_buffers[t];
+
+        for (int i = 0; i < b->num_events; i++) {
+            const Trace_Event &e = b->events[i];
+
+            trace_write_string(writer, first ? "\n{\"name\":\"" : ",\n{\"name\":\"");
+            trace_write_string(writer, e.name);
+
+            if (e.index >= 0) {
+                trace_write_string(writer, " ");
+                trace_write_int(writer, e.index);
+            }
+
+            trace_write_string(writer, "\",\"ph\":\"X\",\"pid\":0,\"tid\":");
+            trace_write_int(writer, t);
+            trace_write_string(writer, ",\"ts\":");
+            trace_write_time(writer, e.begin - origin);
+            trace_write_string(writer, ",\"dur\":");
+            trace_write_time(writer, e.end - e.begin);
+            trace_write_string(writer, "}");
+
+            first = false;
+        }
+    }
+
+    trace_write_string(writer, "\n]}\n");
+}
+
+int aon::trace_get_num_dropped() {
+    int num_buffers = min(trace_num_buffers, trace_max_threads);
+
+    int num_dropped = trace_overflow_buffer.num_dropped;
+
+    for (int t = 0; t < num_buffers; t++)
+        num_dropped += trace_buffers[t]->num_dropped;
+
+    return num_dropped;
+}
+
+void aon::trace_clear() {
+    int num_buffers = min(trace_num_buffers, trace_max_threads);
+
+    for (int t = 0; t < num_buffers; t++) {
+        trace_buffers[t]->num_events = 0;
+        trace_buffers[t]->num_dropped = 0;
+    }
+
+    trace_overflow_buffer.num_dropped = 0;
+}
+#endif
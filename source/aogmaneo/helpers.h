@@ -15,8 +15,35 @@
 #include <algorithm>
 #endif
 
+#define PRAGMA(x) _Pragma(#x)
+
 #define PARALLEL_FOR _Pragma("omp parallel for")
 
+// runs the following block on one thread of a team (if condition holds) that executes the TASKs it spawns
+#define PARALLEL_TASKS(condition) PRAGMA(omp parallel if(condition)) PRAGMA(omp single)
+#define TASK _Pragma("omp task")
+
+// tracing (if USE_TRACE is set), records the time until the end of the enclosing scope under a name (string literal) and optional index (e.g. layer)
+#ifdef USE_TRACE
+#define TRACE_CONCAT_INNER(a, b) a##b
+#define TRACE_CONCAT(a, b) TRACE_CONCAT_INNER(a, b)
+#define TRACE_SCOPE(...) aon::Trace_Scope TRACE_CONCAT(trace_scope_, __LINE__)(__VA_ARGS__)
+#else
+#define TRACE_SCOPE(...)
+#endif
+
+// a PARALLEL_FOR traced like TRACE_SCOPE on the calling thread, with each thread of the team also recording the span of its share of the loop.
+// the per-thread spans are firstprivate copies of a prototype, made when a thread starts and destroyed when it is done
+#ifdef USE_TRACE
+#define PRAGMA_EXPAND(x) PRAGMA(x)
+#define TRACE_PARALLEL_FOR(...) \
+    TRACE_SCOPE(__VA_ARGS__); \
+    aon::Trace_Thread_Span TRACE_CONCAT(trace_thread_span_, __LINE__)(__VA_ARGS__); \
+    PRAGMA_EXPAND(omp parallel for firstprivate(TRACE_CONCAT(trace_thread_span_, __LINE__)))
+#else
+#define TRACE_PARALLEL_FOR(...) PARALLEL_FOR
+#endif
+
 namespace aon {
 const int exp_iters = 6;
 const int log_iters = 6;
@@ -142,6 +169,12 @@ void set_num_threads(
 
 int get_num_threads();
 
+// number of threads a parallel region started here would use
+int get_max_threads();
+
+// wall clock time in seconds, for deadlines. always 0 if USE_OMP is not set
+double get_time();
+
 // Vector types
 template <typename T> 
 struct Vec2 {
@@ -170,7 +203,7 @@ struct Vec3 {
         T y,
         T z
     )
-    : x(x), y(y), z(z)
+    : x(x), y(y), z(z), pad(0) // sizes are written as is, keep files deterministic
     {}
 };
 
@@ -275,6 +308,171 @@ struct Circle_Buffer {
     }
 };
 
+// --- arena ---
+
+// one block of memory holding many arrays, each starting at a multiple of array_alignment, so that buffers used together sit together.
+// arrays are placed in two passes over the same arrays: a sizing pass (an arena without memory) adds up their footprint,
+// then a pass over an arena of at least that size moves them into it. placed arrays borrow from the arena
+class Arena {
+private:
+    Byte_Buffer storage; // empty if the memory is provided
+
+    Byte* data; // nullptr while sizing
+    long long capacity;
+    long long used;
+
+    // arena being replaced, arrays borrowed from it are moved along with owned ones
+    const Byte* replaced_data;
+    long long replaced_capacity;
+
+public:
+    Arena()
+    :
+    data(nullptr),
+    capacity(0),
+    used(0),
+    replaced_data(nullptr),
+    replaced_capacity(0)
+    {}
+
+    // copies of arrays own their storage, so copies of an arena start empty
+    Arena(
+        const Arena &
+    )
+    :
+    Arena()
+    {}
+
+    Arena(
+        Arena &&other
+    )
+    :
+    Arena()
+    {
+        *this = static_cast<Arena&&>(other);
+    }
+
+    Arena &operator=(
+        const Arena &
+    ) {
+        *this = Arena();
+
+        return *this;
+    }
+
+    Arena &operator=(
+        Arena &&other
+    ) {
+        if (this != &other) {
+            storage = static_cast<Byte_Buffer&&>(other.storage);
+            data = other.data;
+            capacity = other.capacity;
+            used = other.used;
+            replaced_data = other.replaced_data;
+            replaced_capacity = other.replaced_capacity;
+
+            other.data = nullptr;
+            other.capacity = 0;
+            other.used = 0;
+            other.replaced_data = nullptr;
+            other.replaced_capacity = 0;
+        }
+
+        return *this;
+    }
+
+    // allocate capacity bytes to place arrays in
+    void allocate(
+        long long capacity
+    ) {
+        storage.resize(0);
+        storage.resize(capacity);
+
+        data = storage.p;
+        this->capacity = capacity;
+        used = 0;
+    }
+
+    // place arrays in memory provided by the caller, which must outlive them. its start is aligned up to array_alignment
+    void provide(
+        Byte_Buffer_View buffer
+    ) {
+        storage.resize(0);
+
+        long long skip = (array_alignment - reinterpret_cast<unsigned long long>(buffer.p) % array_alignment) % array_alignment;
+
+        data = buffer.p + skip;
+        capacity = max<long long>(0, buffer.size() - skip);
+        used = 0;
+    }
+
+    // also move arrays placed in other (which this arena replaces)
+    void replace(
+        const Arena &other
+    ) {
+        replaced_data = other.data;
+        replaced_capacity = other.capacity;
+    }
+
+    // footprint of the arrays placed so far, in bytes
+    long long get_used() const {
+        return used;
+    }
+
+    long long get_capacity() const {
+        return capacity;
+    }
+
+    // move an array into the arena, copying its contents. arrays borrowed from elsewhere (such as a mapped file) are left where they are
+    template<typename T>
+    void place(
+        Array<T> &arr
+    ) {
+        static_assert(std::is_trivially_copyable<T>::value, "arena arrays are moved by copying bytes");
+
+        if (arr.size() == 0)
+            return;
+
+        const Byte* bytes = reinterpret_cast<const Byte*>(arr.p);
+
+        if (!arr.owned && !(bytes >= replaced_data && bytes < replaced_data + replaced_capacity))
+            return;
+
+        long long start = (used + array_alignment - 1) / array_alignment * array_alignment;
+        long long len = arr.size() * static_cast<long long>(sizeof(T));
+
+        used = start + len;
+
+        // sizing
+        if (data == nullptr)
+            return;
+
+        assert(used <= capacity);
+
+        T* p = reinterpret_cast<T*>(data + start);
+
+        memcpy(static_cast<void*>(p), static_cast<const void*>(arr.p), len);
+
+        arr.borrow(p, arr.size());
+    }
+};
+
+// whether two column index buffers are the same
+inline bool cis_equal(
+    Int_Buffer_View left,
+    Int_Buffer_View right
+) {
+    if (left.size() != right.size())
+        return false;
+
+    for (int i = 0; i < left.size(); i++) {
+        if (left[i] != right[i])
+            return false;
+    }
+
+    return true;
+}
+
 // --- bounds ---
 
 // bounds check from (0, 0) to upper_bound
@@ -387,6 +585,7 @@ inline float tanhf(
 // --- rng ---
 
 // PCG32 https://en.wikipedia.org/wiki/Permuted_congruential_generator
+// global stream, the default of the functions below. encoders, decoders, actors and hierarchies step with their own streams, this one only seeds them
 extern unsigned long global_state;
 
 const unsigned long pcg_multiplier = 6364136223846793005u;
@@ -453,6 +652,109 @@ inline int rand_roundf(
     return i + (randf(state) < abs_rem) * s;
 }
 
+// --- memory mapping ---
+
+// memory mapped region, backed by a file or anonymous memory. does nothing if USE_MMAP is not set
+class Mapped_Region {
+public:
+    void* p;
+    long s;
+    bool file_backed;
+
+    Array<char> file_name; // of the backing file (null terminated), empty if anonymous
+
+    Mapped_Region()
+    :
+    p(nullptr),
+    s(0),
+    file_backed(false)
+    {}
+
+    // copies of file backed regions get their own file next to the original, removed from the directory right away so it goes with the copy.
+    // copies of anonymous regions (or if that file can not be created) are anonymous
+    Mapped_Region(
+        const Mapped_Region &other
+    )
+    :
+    p(nullptr),
+    s(0),
+    file_backed(false)
+    {
+        *this = other;
+    }
+
+    Mapped_Region(
+        Mapped_Region &&other
+    )
+    :
+    p(nullptr),
+    s(0),
+    file_backed(false)
+    {
+        *this = static_cast<Mapped_Region&&>(other);
+    }
+
+    ~Mapped_Region() {
+        unmap();
+    }
+
+    Mapped_Region &operator=(
+        const Mapped_Region &other
+    );
+
+    Mapped_Region &operator=(
+        Mapped_Region &&other
+    ) {
+        if (this != &other) {
+            unmap();
+
+            p = other.p;
+            s = other.s;
+            file_backed = other.file_backed;
+            file_name = static_cast<Array<char>&&>(other.file_name);
+
+            other.p = nullptr;
+            other.s = 0;
+            other.file_backed = false;
+        }
+
+        return *this;
+    }
+
+    // map size bytes of a file (created or resized as needed), or anonymous memory if file_name is nullptr. returns false on failure
+    bool map(
+        const char* file_name,
+        long size
+    );
+
+    // map an existing file copy-on-write: writes stay private to the mapping and never reach the file. returns false on failure
+    bool map_private(
+        const char* file_name
+    );
+
+    void unmap();
+
+    // hint that a range will be accessed soon
+    void prefetch(
+        long offset,
+        long len
+    ) const;
+
+    // hint that a range will not be accessed soon, allowing it to leave resident memory
+    void evict(
+        long offset,
+        long len
+    ) const;
+
+    void* data() const {
+        return p;
+    }
+
+    long size() const {
+        return s;
+    }
+};
+
 // --- serialization ---
 
 class Stream_Writer {
@@ -461,8 +763,16 @@ public:
 
     virtual void write(
         const void* data,
-        int len
+        long long len
     ) = 0;
+
+    // skip the next len bytes and return a pointer to them, to be filled in place, for writers backed by memory.
+    // the pointer is valid until the next write or view. returns nullptr if not supported, in which case write is used
+    virtual void* view(
+        long long
+    ) {
+        return nullptr;
+    }
 };
 
 class Stream_Reader {
@@ -471,7 +781,554 @@ public:
 
     virtual void read(
         void* data,
-        int len
+        long long len
     ) = 0;
+
+    // skip the next len bytes and return a pointer to them, for readers backed by memory that outlives what is read.
+    // returns nullptr if not supported or past the end of the input, in which case read is used
+    virtual void* view(
+        long long
+    ) {
+        return nullptr;
+    }
+
+    // number of bytes left to read, -1 if not known
+    virtual long long remaining() const {
+        return -1;
+    }
+
+    // whether all reads so far were complete. reads past the end of the input fill with zeros
+    virtual bool good() const {
+        return true;
+    }
+};
+
+// read size elements into arr, borrowing the reader's memory instead of copying when it supports view
+template<typename T>
+void read_array(
+    Stream_Reader &reader,
+    Array<T> &arr,
+    Index size
+) {
+    long long len = size * static_cast<long long>(sizeof(T));
+
+    void* data = (size > 0 ? reader.view(len) : nullptr);
+
+    if (data != nullptr && reinterpret_cast<unsigned long>(data) % alignof(T) == 0) {
+        arr.borrow(static_cast<T*>(data), size);
+
+        return;
+    }
+
+    // don't write into storage borrowed by an earlier read
+    if (!arr.owned)
+        arr.resize(0);
+
+    arr.resize(size);
+
+    if (data == nullptr) {
+        if (size > 0)
+            reader.read(reinterpret_cast<void*>(arr.p), len);
+    }
+    else {
+        // misaligned, copy instead
+        for (long long i = 0; i < len; i++)
+            reinterpret_cast<Byte*>(arr.p)[i] = static_cast<Byte*>(data)[i];
+    }
+}
+
+// reads from a file mapped copy-on-write. arrays read with read_array point into the mapping, so loading does not copy the weights
+// and processes loading the same file share its pages. the reader must outlive everything read from it
+class Mapped_Reader : public Stream_Reader {
+private:
+    Mapped_Region region;
+    long long size; // mapped length
+    long long pos;
+    bool failed;
+
+public:
+    Mapped_Reader()
+    :
+    size(0),
+    pos(0),
+    failed(false)
+    {}
+
+    // returns false on failure (always without USE_MMAP)
+    bool open(
+        const char* file_name
+    ) {
+        pos = 0;
+        failed = false;
+
+        bool success = region.map_private(file_name);
+
+        size = (success ? region.size() : 0);
+
+        return success;
+    }
+
+    // reads past the end of the mapping fill with zeros
+    void read(
+        void* data,
+        long long len
+    ) override;
+
+    // returns nullptr past the end of the mapping
+    void* view(
+        long long len
+    ) override;
+
+    long long remaining() const override {
+        return size - pos;
+    }
+
+    // whether all reads so far were within the mapping
+    bool good() const override {
+        return !failed;
+    }
+};
+
+// writes into a buffer that grows as needed
+class Memory_Writer : public Stream_Writer {
+public:
+    Byte_Buffer buffer; // the first size bytes are written, the rest is spare capacity
+    long long size;
+
+    Memory_Writer()
+    :
+    size(0)
+    {}
+
+    void write(
+        const void* data,
+        long long len
+    ) override;
+
+    void* view(
+        long long len
+    ) override;
+};
+
+// reads from memory it does not own, copying
+class Memory_Reader : public Stream_Reader {
+private:
+    Byte_Buffer_View data;
+    long long pos;
+    bool failed;
+
+public:
+    Memory_Reader(
+        Byte_Buffer_View data
+    )
+    :
+    data(data),
+    pos(0),
+    failed(false)
+    {}
+
+    // reads past the end of the data fill with zeros
+    void read(
+        void* dst,
+        long long len
+    ) override;
+
+    long long remaining() const override {
+        return data.size() - pos;
+    }
+
+    bool good() const override {
+        return !failed;
+    }
+};
+
+// reads from memory that outlives everything read from it. arrays read with read_array point into it instead of copying
+class Span_Reader : public Stream_Reader {
+private:
+    Byte_Buffer_View data;
+    long long pos;
+    bool failed;
+
+public:
+    Span_Reader(
+        Byte_Buffer_View data
+    )
+    :
+    data(data),
+    pos(0),
+    failed(false)
+    {}
+
+    // reads past the end of the span fill with zeros
+    void read(
+        void* dst,
+        long long len
+    ) override;
+
+    // returns nullptr past the end of the span
+    void* view(
+        long long len
+    ) override;
+
+    long long remaining() const override {
+        return data.size() - pos;
+    }
+
+    // whether all reads so far were within the span
+    bool good() const override {
+        return !failed;
+    }
+};
+
+// writes into fixed memory, such as a buffer of size() bytes. writes past its end are dropped
+class Span_Writer : public Stream_Writer {
+private:
+    Byte_Buffer_View data;
+    long long pos;
+    bool overflowed;
+
+public:
+    Span_Writer(
+        Byte_Buffer_View data
+    )
+    :
+    data(data),
+    pos(0),
+    overflowed(false)
+    {}
+
+    void write(
+        const void* src,
+        long long len
+    ) override;
+
+    void* view(
+        long long len
+    ) override;
+
+    long long get_size() const {
+        return pos;
+    }
+
+    // whether everything written fit
+    bool good() const {
+        return !overflowed;
+    }
+};
+
+// file streams with their own buffer, moving whole buffers to and from the file.
+// reads and writes of at least a buffer (bulk arrays) go to the file directly, without passing through the buffer
+const int file_buffer_size = 1 << 20;
+
+class File_Writer : public Stream_Writer {
+private:
+    void* file; // FILE*
+    Byte_Buffer buffer;
+    int size;
+    bool failed;
+
+public:
+    File_Writer()
+    :
+    file(nullptr),
+    size(0),
+    failed(false)
+    {}
+
+    File_Writer(
+        const File_Writer &other
+    ) = delete;
+
+    File_Writer &operator=(
+        const File_Writer &other
+    ) = delete;
+
+    ~File_Writer() {
+        close();
+    }
+
+    // create or truncate a file. returns false on failure
+    bool open(
+        const char* file_name
+    );
+
+    void write(
+        const void* data,
+        long long len
+    ) override;
+
+    // write out the buffer. returns false if any write so far failed
+    bool flush();
+
+    // flush and close. returns false if any write failed
+    bool close();
+};
+
+class File_Reader : public Stream_Reader {
+private:
+    void* file; // FILE*
+    Byte_Buffer buffer;
+    int start; // next unread byte in buffer
+    int size; // bytes in buffer
+    long long left; // bytes left in the file, -1 if it can not seek (such as a pipe)
+    bool failed;
+
+public:
+    File_Reader()
+    :
+    file(nullptr),
+    start(0),
+    size(0),
+    left(-1),
+    failed(false)
+    {}
+
+    File_Reader(
+        const File_Reader &other
+    ) = delete;
+
+    File_Reader &operator=(
+        const File_Reader &other
+    ) = delete;
+
+    ~File_Reader() {
+        close();
+    }
+
+    // returns false on failure
+    bool open(
+        const char* file_name
+    );
+
+    // reads past the end of the file fill with zeros
+    void read(
+        void* data,
+        long long len
+    ) override;
+
+    long long remaining() const override {
+        return left;
+    }
+
+    // whether all reads so far were complete
+    bool good() const override {
+        return !failed;
+    }
+
+    void close();
 };
+
+// --- compression ---
+
+// order-0 rANS entropy coding of bytes, for skewed data such as weights.
+// encodes src into dst (resized), returns false (leaving dst unspecified) if the result would not be smaller than src
+bool rans_encode(
+    Byte_Buffer_View src,
+    Byte_Buffer &dst
+);
+
+// decodes src into dst, which must have the size of the original data. returns false on malformed input
+bool rans_decode(
+    Byte_Buffer_View src,
+    Byte_Buffer_View dst
+);
+
+// --- checksums ---
+
+const unsigned long long checksum_seed = 14695981039346656037ull;
+
+// 64-bit FNV-1a of data, continuing from hash
+unsigned long long checksum(
+    const void* data,
+    long long len,
+    unsigned long long hash = checksum_seed
+);
+
+// keeps the size and checksum of what is written, forwarding it to another writer if given (otherwise discarding it)
+class Checksum_Writer : public Stream_Writer {
+private:
+    Stream_Writer* writer;
+
+public:
+    long long size;
+    unsigned long long hash;
+
+    Checksum_Writer(
+        Stream_Writer* writer = nullptr
+    )
+    :
+    writer(writer),
+    size(0),
+    hash(checksum_seed)
+    {}
+
+    void write(
+        const void* data,
+        long long len
+    ) override {
+        if (writer != nullptr)
+            writer->write(data, len);
+
+        size += len;
+        hash = checksum(data, len, hash);
+    }
+};
+
+// forwards to another reader, keeping the size and (if verifying) checksum of what passes through
+class Checksum_Reader : public Stream_Reader {
+private:
+    Stream_Reader* reader;
+    bool verify;
+
+public:
+    long long size;
+    unsigned long long hash;
+
+    Checksum_Reader(
+        Stream_Reader* reader,
+        bool verify
+    )
+    :
+    reader(reader),
+    verify(verify),
+    size(0),
+    hash(checksum_seed)
+    {}
+
+    void read(
+        void* data,
+        long long len
+    ) override {
+        reader->read(data, len);
+
+        size += len;
+
+        if (verify)
+            hash = checksum(data, len, hash);
+    }
+
+    void* view(
+        long long len
+    ) override {
+        void* data = reader->view(len);
+
+        if (data != nullptr) {
+            size += len;
+
+            if (verify)
+                hash = checksum(data, len, hash);
+        }
+
+        return data;
+    }
+
+    long long remaining() const override {
+        return reader->remaining();
+    }
+
+    bool good() const override {
+        return reader->good();
+    }
+};
+
+// --- tracing ---
+
+#ifdef USE_TRACE
+const int trace_max_threads = 256;
+const int trace_capacity = 1 << 16; // events per thread, later events are dropped
+
+struct Trace_Event {
+    const char* name;
+    int index;
+
+    double begin;
+    double end;
+};
+
+// events of one thread, only written by that thread
+struct Trace_Buffer {
+    Array<Trace_Event> events;
+    int num_events;
+    int num_dropped;
+};
+
+void trace_record(
+    const char* name,
+    int index,
+    double begin,
+    double end
+);
+
+// write all recorded events as Chrome trace_event JSON (chrome://tracing, Perfetto). timestamps come from get_time, so USE_OMP is needed.
+// this and trace_clear must not run while events are recorded
+void trace_dump(
+    Stream_Writer &writer
+);
+
+// number of events dropped because buffers were full
+int trace_get_num_dropped();
+
+void trace_clear();
+
+class Trace_Scope {
+private:
+    const char* name;
+    int index;
+
+    double begin;
+
+public:
+    Trace_Scope(
+        const char* name,
+        int index = -1
+    )
+    :
+    name(name),
+    index(index),
+    begin(get_time())
+    {}
+
+    ~Trace_Scope() {
+        trace_record(name, index, begin, get_time());
+    }
+};
+
+// prototype for TRACE_PARALLEL_FOR. only its copies record, from their construction until their destruction
+class Trace_Thread_Span {
+private:
+    const char* name;
+    int index;
+
+    double begin; // -1 for the prototype
+
+public:
+    Trace_Thread_Span(
+        const char* name,
+        int index = -1
+    )
+    :
+    name(name),
+    index(index),
+    begin(-1.0)
+    {}
+
+    Trace_Thread_Span(
+        const Trace_Thread_Span &other
+    )
+    :
+    name(other.name),
+    index(other.index),
+    begin(get_time())
+    {}
+
+    Trace_Thread_Span &operator=(
+        const Trace_Thread_Span &
+    ) = delete;
+
+    ~Trace_Thread_Span() {
+        if (begin >= 0.0)
+            trace_record(name, index, begin, get_time());
+    }
+};
+#endif
 }
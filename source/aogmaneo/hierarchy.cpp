@@ -8,25 +8,26 @@
 
 #include "hierarchy.h"
 
+#include <string.h>
+
 using namespace aon;
 
 void Hierarchy::init_random(
     const Array<IO_Desc> &io_descs,
-    const Array<Layer_Desc> &layer_descs
+    const Array<Layer_Desc> &layer_descs,
+    unsigned int seed
 ) {
+    checkpoint_sequence = 0;
+
+    // weights and the default state are seeded from the model's stream
+    rand_state = rand_get_state(seed);
+
     // create layers
     encoders.resize(layer_descs.size());
     decoders.resize(layer_descs.size());
 
-    ticks.resize(layer_descs.size(), 0);
-
-    histories.resize(layer_descs.size());
-    
     ticks_per_update.resize(layer_descs.size());
 
-    // default update state is no update
-    updates.resize(layer_descs.size(), false);
-
     // cache input sizes
     io_sizes.resize(io_descs.size());
     io_types.resize(io_descs.size());
@@ -65,23 +66,12 @@ void Hierarchy::init_random(
                     e_visible_layer_descs[index].radius = io_descs[i].up_radius;
                 }
             }
-            
-            // initialize history buffers
-            histories[l].resize(io_sizes.size());
 
-            for (int i = 0; i < histories[l].size(); i++) {
-                int in_size = io_sizes[i].x * io_sizes[i].y;
-
-                histories[l][i].resize(layer_descs[l].temporal_horizon);
-                
-                for (int t = 0; t < histories[l][i].size(); t++)
-                    histories[l][i][t] = Int_Buffer(in_size, 0);
-            }
 
             decoders[l].resize(num_predictions);
             actors.resize(num_actions);
 
-            i_indices.resize(io_sizes.size() * 2);
+            i_indices = Int_Buffer(io_sizes.size() * 2, -1);
             d_indices = Int_Buffer(io_sizes.size(), -1);
 
             // create decoders and actors
@@ -98,7 +88,7 @@ void Hierarchy::init_random(
                     if (l < encoders.size() - 1)
                         d_visible_layer_descs[1] = d_visible_layer_descs[0];
 
-                    decoders[l][d_index].init_random(io_sizes[i], d_visible_layer_descs);
+                    decoders[l][d_index].init_random(io_sizes[i], d_visible_layer_descs, rand(&rand_state));
 
                     i_indices[d_index] = i;
                     d_indices[i] = d_index;
@@ -119,7 +109,7 @@ void Hierarchy::init_random(
                     if (l < encoders.size() - 1)
                         a_visible_layer_descs[1] = a_visible_layer_descs[0];
 
-                    actors[d_index].init_random(io_sizes[i], io_descs[i].history_capacity, a_visible_layer_descs);
+                    actors[d_index].init_random(io_sizes[i], io_descs[i].history_capacity, a_visible_layer_descs, rand(&rand_state));
 
                     i_indices[io_sizes.size() + d_index] = i;
                     d_indices[i] = d_index;
@@ -135,15 +125,6 @@ void Hierarchy::init_random(
                 e_visible_layer_descs[t].radius = layer_descs[l].up_radius;
             }
 
-            histories[l].resize(1);
-
-            int in_size = layer_descs[l - 1].hidden_size.x * layer_descs[l - 1].hidden_size.y;
-
-            histories[l][0].resize(layer_descs[l].temporal_horizon);
-
-            for (int t = 0; t < histories[l][0].size(); t++)
-                histories[l][0][t] = Int_Buffer(in_size, 0);
-
             decoders[l].resize(layer_descs[l].ticks_per_update);
 
             // decoder visible layer descriptors
@@ -157,24 +138,68 @@ void Hierarchy::init_random(
 
             // create decoders
             for (int t = 0; t < decoders[l].size(); t++)
-                decoders[l][t].init_random(layer_descs[l - 1].hidden_size, d_visible_layer_descs);
+                decoders[l][t].init_random(layer_descs[l - 1].hidden_size, d_visible_layer_descs, rand(&rand_state));
         }
         
         // create the sparse coding layer
-        encoders[l].init_random(layer_descs[l].hidden_size, e_visible_layer_descs);
+        encoders[l].init_random(layer_descs[l].hidden_size, e_visible_layer_descs, rand(&rand_state));
     }
 
+    init_state(default_state, rand(&rand_state));
+
     // initialize params
     params.layers = Array<Layer_Params>(layer_descs.size());
     params.ios = Array<IO_Params>(io_descs.size());
+
+    pack();
+}
+
+long long Hierarchy::packed_size() const {
+    Arena sizing;
+
+    sizing.replace(arena);
+
+    // sizing only reads the sizes of the buffers
+    const_cast<Hierarchy*>(this)->place(sizing);
+
+    return sizing.get_used();
+}
+
+bool Hierarchy::pack(
+    Byte_Buffer_View buffer
+) {
+    long long size = packed_size();
+
+    Arena packed;
+
+    if (buffer.p == nullptr)
+        packed.allocate(size);
+    else {
+        packed.provide(buffer);
+
+        if (packed.get_capacity() < size)
+            return false;
+    }
+
+    // buffers in the current block move along with the owned ones, after which the block is freed
+    packed.replace(arena);
+
+    place(packed);
+
+    arena = static_cast<Arena&&>(packed);
+
+    return true;
 }
 
 void Hierarchy::step(
+    State &state,
     const Array<Int_Buffer_View> &input_cis,
     bool learn_enabled,
     float reward,
     float mimic
 ) {
+    TRACE_SCOPE("hierarchy step");
+
     assert(params.layers.size() == encoders.size());
     assert(params.ios.size() == io_sizes.size());
 
@@ -182,378 +207,2420 @@ void Hierarchy::step(
     for (int i = 0; i < io_sizes.size(); i++)
         set_input_importance(i, params.ios[i].importance);
 
-    // first tick is always 0
-    ticks[0] = 0;
+    begin_step(state, input_cis);
 
-    // add input to first layer history   
-    for (int i = 0; i < io_sizes.size(); i++) {
-        histories[0][i].push_front();
+    if (params.pipelined) {
+        // layers update from ticks accumulated on previous steps, so a lower layer's update reaches the next layer one step later
+        int num_updates = 0;
 
-        histories[0][i][0] = input_cis[i];
-    }
+        for (int l = 0; l < encoders.size(); l++) {
+            if (l == 0 || state.ticks[l] >= ticks_per_update[l]) {
+                state.ticks[l] = 0;
 
-    // set all updates to no update, will be set to true if an update occurred later
-    updates.fill(false);
+                state.updates[l] = true;
+                state.encoders_stepped[l] = true;
 
-    // forward
-    for (int l = 0; l < encoders.size(); l++) {
-        // if is time for layer to tick
-        if (l == 0 || ticks[l] >= ticks_per_update[l]) {
-            // reset tick
-            ticks[l] = 0;
+                num_updates++;
+            }
+        }
+
+        // move previous outputs into next layer histories, so that updating layers write into buffers nobody else reads this step
+        for (int l = 0; l < encoders.size() - 1; l++) {
+            if (state.updates[l])
+                push_layer_output(state, l);
+        }
+
+        // measured before any feedback buffers are exchanged below
+        for (int l = 0; l < encoders.size(); l++) {
+            if (state.updates[l] && params.layers[l].auto_freeze)
+                update_accuracy(state, l, (l > 0 && state.updates[l - 1]));
+        }
+
+        for (int l = 0; l < encoders.size(); l++) {
+            if (!state.updates[l])
+                continue;
 
-            // updated
-            updates[l] = true;
+            // if the lower layer updates, its previous output is now the most recent history entry
+            int history_offset = (l > 0 && state.updates[l - 1]);
 
-            Array<Int_Buffer_View> layer_input_cis(encoders[l].visible_layers.size());
+            int num_history = state.encoder_input_cis[l].size() / state.histories[l].size();
+
+            assert(l == 0 || state.histories[l][0].size() >= num_history);
 
             int index = 0;
 
-            for (int i = 0; i < histories[l].size(); i++) {
-                for (int t = 0; t < histories[l][i].size(); t++) {
-                    layer_input_cis[index] = histories[l][i][t];
+            for (int i = 0; i < state.histories[l].size(); i++) {
+                for (int t = 0; t < num_history; t++) {
+                    state.encoder_input_cis[l][index] = get_history_cis(state, l, i, t + history_offset);
 
                     index++;
                 }
             }
 
-            // activate sparse coder
-            encoders[l].step(layer_input_cis, learn_enabled, params.layers[l].encoder);
+            Array<Int_Buffer_View> &layer_input_cis = state.decoder_input_cis[l];
 
-            // add to next layer's history
-            if (l < encoders.size() - 1) {
-                int l_next = l + 1;
+            layer_input_cis[0] = state.encoders[l].hidden_cis;
 
-                histories[l_next][0].push_front();
+            if (l < encoders.size() - 1) {
+                // ticks of the next layer already count this update. if the next layer updates now, its outputs are from its previous update,
+                // so the latest of those predictions (the first decoder's) is used
+                Decoder::State &feedback_decoder = state.decoders[l + 1][state.updates[l + 1] ? 0 : ticks_per_update[l + 1] - state.ticks[l + 1]];
 
-                histories[l_next][0][0] = encoders[l].hidden_cis;
+                // keep the previous feedback in a spare buffer if the decoder producing it updates concurrently
+                if (state.updates[l + 1]) {
+                    state.feedback_cis[l].swap(feedback_decoder.hidden_cis);
 
-                ticks[l_next]++;
+                    layer_input_cis[1] = state.feedback_cis[l];
+                }
+                else
+                    layer_input_cis[1] = feedback_decoder.hidden_cis;
             }
         }
-    }
 
-    // backward
-    for (int l = decoders.size() - 1; l >= 0; l--) {
-        if (updates[l]) {
-            Array<Int_Buffer_View> layer_input_cis(1 + (l < encoders.size() - 1));
+        // each layer steps its encoder then its decoders as one task. they draw from their own RNG streams, so results do not depend on scheduling
+        PARALLEL_TASKS(num_updates > 1)
+        {
+            for (int l = 0; l < encoders.size(); l++) {
+                if (!state.updates[l])
+                    continue;
 
-            layer_input_cis[0] = encoders[l].hidden_cis;
-            
-            if (l < encoders.size() - 1)
-                layer_input_cis[1] = decoders[l + 1][ticks_per_update[l + 1] - 1 - ticks[l + 1]].hidden_cis;
+                TASK
+                {
+                    TRACE_SCOPE("layer", l);
 
-            for (int d = 0; d < decoders[l].size(); d++)
-                decoders[l][d].step(layer_input_cis, histories[l][l == 0 ? i_indices[d] : 0][l == 0 ? 0 : d], learn_enabled, (l == 0 ? params.ios[i_indices[d]].decoder : params.layers[l].decoder));
+                    encoders[l].step(state.encoders[l], state.encoder_input_cis[l], learn_enabled && layer_learning(state, l), params.layers[l].encoder);
 
-            if (l == 0) {
-                for (int d = 0; d < actors.size(); d++)
-                    actors[d].step(layer_input_cis, input_cis[i_indices[d + io_sizes.size()]], reward, learn_enabled, mimic, params.ios[i_indices[d + io_sizes.size()]].actor);
+                    step_decoders(state, l, (l > 0 && state.updates[l - 1]), input_cis, learn_enabled, reward, mimic);
+                }
             }
         }
-    }
-}
 
-void Hierarchy::clear_state() {
-    updates.fill(false);
-    ticks.fill(0);
-
-    for (int l = 0; l < encoders.size(); l++) {
-        for (int i = 0; i < histories[l].size(); i++) {
-            for (int t = 0; t < histories[l][i].size(); t++)
-                histories[l][i][t].fill(0);
-        }
+        return;
     }
 
+    // forward
     for (int l = 0; l < encoders.size(); l++) {
-        encoders[l].clear_state();
-    }
-        
-    for (int l = 0; l < encoders.size(); l++) {
-        // decoders
-        for (int d = 0; d < decoders[l].size(); d++)
-            decoders[l][d].clear_state();
-    }
+        // if is time for layer to tick
+        if (l == 0 || state.ticks[l] >= ticks_per_update[l]) {
+            TRACE_SCOPE("layer encode", l);
 
-    // actors
-    for (int d = 0; d < actors.size(); d++)
-        actors[d].clear_state();
-}
+            bool encoder_stepped = state.encoders_stepped[l];
 
-int Hierarchy::size() const {
-    int size = 4 * sizeof(int) + io_sizes.size() * sizeof(Int3) + io_types.size() * sizeof(Byte) + updates.size() * sizeof(Byte) + 2 * ticks.size() * sizeof(int) + i_indices.size() * sizeof(int) + d_indices.size() * sizeof(int);
+            begin_layer_update(state, l);
 
-    for (int l = 0; l < encoders.size(); l++) {
-        size += sizeof(int);
+            bool encoder_learning = learn_enabled && layer_learning(state, l);
 
-        for (int i = 0; i < histories[l].size(); i++) {
-            size += 2 * sizeof(int);
+            // the previous output is only reproduced if the weights did not learn since it was activated
+            if (params.skip_unchanged && encoder_stepped && encoders[l].output_current(state.encoders[l]) && encoder_inputs_unchanged(state, l)) {
+                // reuse the previous output, which was just moved into the next layer's history
+                if (l < encoders.size() - 1 && state.histories[l + 1][0].size() > 0)
+                    state.encoders[l].hidden_cis = state.histories[l + 1][0][0];
 
-            for (int t = 0; t < histories[l][i].size(); t++)
-                size += sizeof(int) + histories[l][i][t].size() * sizeof(int);
+                if (encoder_learning)
+                    encoders[l].learn_stream(state.encoders[l], state.encoder_input_cis[l], params.layers[l].encoder);
+            }
+            else {
+                // activate sparse coder
+                encoders[l].step(state.encoders[l], state.encoder_input_cis[l], encoder_learning, params.layers[l].encoder);
+            }
         }
+    }
+
+    // backward
+    for (int l = decoders.size() - 1; l >= 0; l--) {
+        if (state.updates[l]) {
+            TRACE_SCOPE("layer decode", l);
 
-        size += encoders[l].size();
+            if (params.layers[l].auto_freeze)
+                update_accuracy(state, l, 0);
 
-        for (int d = 0; d < decoders[l].size(); d++)
-            size += decoders[l][d].size();
+            gather_decoder_inputs(state, l);
+
+            step_decoders(state, l, 0, input_cis, learn_enabled, reward, mimic);
+        }
     }
+}
 
-    // actors
-    for (int d = 0; d < actors.size(); d++)
-        size += actors[d].size();
+void Hierarchy::step(
+    State &state,
+    const Array<Int_Buffer_View> &input_cis,
+    bool learn_enabled,
+    float reward,
+    float mimic,
+    double deadline
+) {
+    TRACE_SCOPE("hierarchy step deadline");
 
-    // params
-    size += encoders.size() * sizeof(Layer_Params);
-    size += io_sizes.size() * sizeof(IO_Params);
+    if (params.pipelined) {
+        step(state, input_cis, learn_enabled, reward, mimic);
 
-    return size;
-}
+        return;
+    }
+
+    // set importances from params
+    for (int i = 0; i < io_sizes.size(); i++)
+        set_input_importance(i, params.ios[i].importance);
 
-int Hierarchy::state_size() const {
-    int size = updates.size() * sizeof(Byte) + ticks.size() * sizeof(int);
+    begin_step(state, input_cis);
 
+    // forward
     for (int l = 0; l < encoders.size(); l++) {
-        for (int i = 0; i < histories[l].size(); i++) {
-            size += sizeof(int);
+        if (l == 0 || state.ticks[l] >= ticks_per_update[l]) {
+            begin_layer_update(state, l);
 
-            for (int t = 0; t < histories[l][i].size(); t++)
-                size += histories[l][i][t].size() * sizeof(int);
-        }
+            encoders[l].activate(state.encoders[l], state.encoder_input_cis[l], params.layers[l].encoder);
 
-        size += encoders[l].state_size();
-        
-        // decoders
-        for (int d = 0; d < decoders[l].size(); d++)
-            size += decoders[l][d].state_size();
+            if (learn_enabled && layer_learning(state, l)) {
+                if (get_time() < deadline)
+                    encoders[l].learn_stream(state.encoders[l], state.encoder_input_cis[l], params.layers[l].encoder);
+                else
+                    defer_encoder_learning(state, l);
+            }
+        }
     }
 
-    // actors
-    for (int d = 0; d < actors.size(); d++)
-        size += actors[d].state_size();
+    // backward
+    for (int l = decoders.size() - 1; l >= 0; l--) {
+        if (!state.updates[l])
+            continue;
 
-    return size;
-}
+        if (params.layers[l].auto_freeze)
+            update_accuracy(state, l, 0);
 
-void Hierarchy::write(
-    Stream_Writer &writer
-) const {
-    int num_layers = encoders.size();
+        gather_decoder_inputs(state, l);
 
-    writer.write(reinterpret_cast<const void*>(&num_layers), sizeof(int));
+        for (int d = 0; d < decoders[l].size(); d++) {
+            const Decoder::Params &decoder_params = (l == 0 ? params.ios[i_indices[d]].decoder : params.layers[l].decoder);
 
-    int num_io = io_sizes.size();
+            Int_Buffer_View hidden_target_cis = get_history_cis(state, l, l == 0 ? i_indices[d] : 0, l == 0 ? 0 : d);
 
-    writer.write(reinterpret_cast<const void*>(&num_io), sizeof(int));
+            // decoders learn before they step
+            if (learn_enabled && (l == 0 ? io_learning(state, i_indices[d]) : layer_learning(state, l))) {
+                if (get_time() < deadline)
+                    decoders[l][d].learn_stream(state.decoders[l][d], hidden_target_cis, decoder_params);
+                else
+                    defer_decoder_learning(state, l, d, hidden_target_cis);
+            }
+
+            decoders[l][d].step(state.decoders[l][d], state.decoder_input_cis[l], hidden_target_cis, false, decoder_params);
+        }
+
+        if (l == 0) {
+            for (int d = 0; d < actors.size(); d++) {
+                int i = i_indices[d + io_sizes.size()];
 
-    int num_predictions = decoders[0].size();
-    int num_actions = actors.size();
+                actors[d].step(state.actors[d], state.decoder_input_cis[l], input_cis[i], reward, false, mimic, params.ios[i].actor);
 
-    writer.write(reinterpret_cast<const void*>(&num_predictions), sizeof(int));
-    writer.write(reinterpret_cast<const void*>(&num_actions), sizeof(int));
+                if (learn_enabled && io_learning(state, i)) {
+                    if (get_time() < deadline)
+                        actors[d].learn_history(state.actors[d], mimic, params.ios[i].actor);
+                    else
+                        defer_actor_learning(state, d, mimic);
+                }
+            }
+        }
+    }
+}
 
-    writer.write(reinterpret_cast<const void*>(&io_sizes[0]), num_io * sizeof(Int3));
-    writer.write(reinterpret_cast<const void*>(&io_types[0]), num_io * sizeof(Byte));
+bool Hierarchy::drain_learning(
+    State &state,
+    double budget
+) {
+    TRACE_SCOPE("hierarchy drain learning");
 
-    writer.write(reinterpret_cast<const void*>(&updates[0]), updates.size() * sizeof(Byte));
-    writer.write(reinterpret_cast<const void*>(&ticks[0]), ticks.size() * sizeof(int));
-    writer.write(reinterpret_cast<const void*>(&ticks_per_update[0]), ticks_per_update.size() * sizeof(int));
+    Deferred_Learning &deferred = state.deferred;
 
-    writer.write(reinterpret_cast<const void*>(&i_indices[0]), i_indices.size() * sizeof(int));
-    writer.write(reinterpret_cast<const void*>(&d_indices[0]), d_indices.size() * sizeof(int));
+    double deadline = get_time() + budget;
 
-    for (int l = 0; l < num_layers; l++) {
-        int num_layer_inputs = histories[l].size();
+    for (int l = 0; l < encoders.size(); l++) {
+        if (deferred.num_pending == 0 || get_time() >= deadline)
+            break;
 
-        writer.write(reinterpret_cast<const void*>(&num_layer_inputs), sizeof(int));
+        if (deferred.encoders_pending[l]) {
+            // snapshots learn with the stream's current RNG stream
+            encoders[l].learn_stream(deferred.encoders[l], deferred.encoder_input_views[l], params.layers[l].encoder, &state.encoders[l].rand_state);
 
-        for (int i = 0; i < histories[l].size(); i++) {
-            int history_size = histories[l][i].size();
+            deferred.encoders_pending[l] = false;
+            deferred.num_pending--;
+        }
 
-            writer.write(reinterpret_cast<const void*>(&history_size), sizeof(int));
+        for (int d = 0; d < decoders[l].size(); d++) {
+            if (!deferred.decoders_pending[l][d] || get_time() >= deadline)
+                continue;
 
-            int history_start = histories[l][i].start;
+            decoders[l][d].learn_stream(deferred.decoders[l][d], deferred.decoder_target_cis[l][d], (l == 0 ? params.ios[i_indices[d]].decoder : params.layers[l].decoder),
+                &state.decoders[l][d].rand_state);
 
-            writer.write(reinterpret_cast<const void*>(&history_start), sizeof(int));
+            deferred.decoders_pending[l][d] = false;
+            deferred.num_pending--;
+        }
 
-            for (int t = 0; t < histories[l][i].size(); t++) {
-                int buffer_size = histories[l][i][t].size();
+        if (l == 0) {
+            for (int d = 0; d < actors.size(); d++) {
+                if (!deferred.actors_pending[d] || get_time() >= deadline)
+                    continue;
 
-                writer.write(reinterpret_cast<const void*>(&buffer_size), sizeof(int));
+                actors[d].learn_history(state.actors[d], deferred.actor_mimics[d], params.ios[i_indices[d + io_sizes.size()]].actor);
 
-                writer.write(reinterpret_cast<const void*>(&histories[l][i][t][0]), histories[l][i][t].size() * sizeof(int));
+                deferred.actors_pending[d] = false;
+                deferred.num_pending--;
             }
         }
+    }
 
-        encoders[l].write(writer);
+    return deferred.num_pending == 0;
+}
 
-        // decoders
-        for (int d = 0; d < decoders[l].size(); d++)
-            decoders[l][d].write(writer);
+void Hierarchy::defer_encoder_learning(
+    State &state,
+    int l
+) {
+    Deferred_Learning &deferred = state.deferred;
+
+    if (deferred.encoders_pending[l])
+        deferred.num_dropped++;
+    else {
+        deferred.encoders_pending[l] = true;
+        deferred.num_pending++;
     }
-    
-    // actors
-    for (int d = 0; d < actors.size(); d++)
-        actors[d].write(writer);
 
-    // params
-    for (int l = 0; l < encoders.size(); l++)
-        writer.write(reinterpret_cast<const void*>(&params.layers[l]), sizeof(Layer_Params));
+    deferred.encoders[l] = state.encoders[l];
 
-    for (int i = 0; i < io_sizes.size(); i++)
-        writer.write(reinterpret_cast<const void*>(&params.ios[i]), sizeof(IO_Params));
+    for (int vli = 0; vli < state.encoder_input_cis[l].size(); vli++) {
+        deferred.encoder_input_cis[l][vli] = state.encoder_input_cis[l][vli];
+        deferred.encoder_input_views[l][vli] = deferred.encoder_input_cis[l][vli];
+    }
 }
 
-void Hierarchy::read(
-    Stream_Reader &reader
+void Hierarchy::defer_decoder_learning(
+    State &state,
+    int l,
+    int d,
+    Int_Buffer_View hidden_target_cis
 ) {
-    int num_layers;
+    Deferred_Learning &deferred = state.deferred;
 
-    reader.read(reinterpret_cast<void*>(&num_layers), sizeof(int));
+    if (deferred.decoders_pending[l][d])
+        deferred.num_dropped++;
+    else {
+        deferred.decoders_pending[l][d] = true;
+        deferred.num_pending++;
+    }
 
-    int num_io;
+    deferred.decoders[l][d] = state.decoders[l][d];
+    deferred.decoder_target_cis[l][d] = hidden_target_cis;
+}
 
-    reader.read(reinterpret_cast<void*>(&num_io), sizeof(int));
+void Hierarchy::defer_actor_learning(
+    State &state,
+    int d,
+    float mimic
+) {
+    Deferred_Learning &deferred = state.deferred;
 
-    int num_predictions;
-    int num_actions;
+    if (deferred.actors_pending[d])
+        deferred.num_dropped++;
+    else {
+        deferred.actors_pending[d] = true;
+        deferred.num_pending++;
+    }
 
-    reader.read(reinterpret_cast<void*>(&num_predictions), sizeof(int));
-    reader.read(reinterpret_cast<void*>(&num_actions), sizeof(int));
+    deferred.actor_mimics[d] = mimic;
+}
 
-    io_sizes.resize(num_io);
-    io_types.resize(num_io);
+void Hierarchy::step_batch(
+    const Array<State*> &states,
+    const Array<Array<Int_Buffer_View>> &input_cis,
+    const Byte_Buffer &learn_enabled,
+    const Float_Buffer &rewards,
+    float mimic
+) {
+    TRACE_SCOPE("hierarchy step batch");
 
-    reader.read(reinterpret_cast<void*>(&io_sizes[0]), num_io * sizeof(Int3));
-    reader.read(reinterpret_cast<void*>(&io_types[0]), num_io * sizeof(Byte));
+    assert(params.layers.size() == encoders.size());
+    assert(params.ios.size() == io_sizes.size());
+    assert(input_cis.size() == states.size() && learn_enabled.size() == states.size() && rewards.size() == states.size());
 
-    encoders.resize(num_layers);
-    decoders.resize(num_layers);
+    int num_streams = states.size();
 
-    histories.resize(num_layers);
-    
-    updates.resize(num_layers);
-    ticks.resize(num_layers);
-    ticks_per_update.resize(num_layers);
+    if (params.pipelined) {
+        for (int b = 0; b < num_streams; b++)
+            step(*states[b], input_cis[b], learn_enabled[b], rewards[b], mimic);
 
-    reader.read(reinterpret_cast<void*>(&updates[0]), updates.size() * sizeof(Byte));
-    reader.read(reinterpret_cast<void*>(&ticks[0]), ticks.size() * sizeof(int));
-    reader.read(reinterpret_cast<void*>(&ticks_per_update[0]), ticks_per_update.size() * sizeof(int));
+        return;
+    }
 
-    i_indices.resize(num_io * 2);
-    d_indices.resize(num_io);
+    // set importances from params
+    for (int i = 0; i < io_sizes.size(); i++)
+        set_input_importance(i, params.ios[i].importance);
 
-    reader.read(reinterpret_cast<void*>(&i_indices[0]), i_indices.size() * sizeof(int));
-    reader.read(reinterpret_cast<void*>(&d_indices[0]), d_indices.size() * sizeof(int));
-    
-    for (int l = 0; l < num_layers; l++) {
-        int num_layer_inputs;
-        
-        reader.read(reinterpret_cast<void*>(&num_layer_inputs), sizeof(int));
+    if (batch_streams.size() < num_streams) {
+        batch_streams.resize(num_streams);
+        batch_encoder_states.resize(num_streams);
+        batch_decoder_states.resize(num_streams);
+        batch_actor_states.resize(num_streams);
+        batch_input_cis.resize(num_streams);
+        batch_target_cis.resize(num_streams);
+        batch_rewards.resize(num_streams);
+        batch_learn_enabled.resize(num_streams);
+    }
+
+    for (int b = 0; b < num_streams; b++)
+        begin_step(*states[b], input_cis[b]);
 
-        histories[l].resize(num_layer_inputs);
+    // forward, a layer is finished for all streams before the next one starts
+    for (int l = 0; l < encoders.size(); l++) {
+        int batch_size = 0;
 
-        for (int i = 0; i < histories[l].size(); i++) {
-            int history_size;
+        for (int b = 0; b < num_streams; b++) {
+            State &state = *states[b];
 
-            reader.read(reinterpret_cast<void*>(&history_size), sizeof(int));
+            // if is time for layer to tick
+            if (l == 0 || state.ticks[l] >= ticks_per_update[l]) {
+                begin_layer_update(state, l);
 
-            int history_start;
-            
-            reader.read(reinterpret_cast<void*>(&history_start), sizeof(int));
+                batch_encoder_states[batch_size] = &state.encoders[l];
+                batch_input_cis[batch_size] = &state.encoder_input_cis[l];
+                batch_learn_enabled[batch_size] = learn_enabled[b] && layer_learning(state, l);
 
-            histories[l][i].resize(history_size);
-            histories[l][i].start = history_start;
+                batch_size++;
+            }
+        }
+
+        if (batch_size == 0)
+            continue;
+
+        encoders[l].step_batch(Array_View<Encoder::State*>(batch_encoder_states.p, batch_size), Array_View<const Array<Int_Buffer_View>*>(batch_input_cis.p, batch_size),
+            Byte_Buffer_View(batch_learn_enabled.p, batch_size), params.layers[l].encoder);
+    }
+
+    // backward
+    for (int l = decoders.size() - 1; l >= 0; l--) {
+        int batch_size = 0;
 
-            for (int t = 0; t < histories[l][i].size(); t++) {
-                int buffer_size;
+        for (int b = 0; b < num_streams; b++) {
+            if (states[b]->updates[l]) {
+                if (params.layers[l].auto_freeze)
+                    update_accuracy(*states[b], l, 0);
 
-                reader.read(reinterpret_cast<void*>(&buffer_size), sizeof(int));
+                gather_decoder_inputs(*states[b], l);
 
-                histories[l][i][t].resize(buffer_size);
+                batch_streams[batch_size] = b;
+                batch_input_cis[batch_size] = &states[b]->decoder_input_cis[l];
 
-                reader.read(reinterpret_cast<void*>(&histories[l][i][t][0]), histories[l][i][t].size() * sizeof(int));
+                batch_size++;
             }
         }
 
-        encoders[l].read(reader);
-        
-        decoders[l].resize(l == 0 ? num_predictions : ticks_per_update[l]);
+        if (batch_size == 0)
+            continue;
 
-        // decoders
-        for (int d = 0; d < decoders[l].size(); d++)
-            decoders[l][d].read(reader);
-    }
+        Array_View<const Array<Int_Buffer_View>*> batch_input_cis_view(batch_input_cis.p, batch_size);
+        Array_View<Int_Buffer_View> batch_target_cis_view(batch_target_cis.p, batch_size);
+        Byte_Buffer_View batch_learn_enabled_view(batch_learn_enabled.p, batch_size);
 
-    actors.resize(num_actions);
+        for (int d = 0; d < decoders[l].size(); d++) {
+            for (int bi = 0; bi < batch_size; bi++) {
+                State &state = *states[batch_streams[bi]];
 
-    // actors
-    for (int d = 0; d < actors.size(); d++)
-        actors[d].read(reader);
+                batch_decoder_states[bi] = &state.decoders[l][d];
+                batch_target_cis[bi] = get_history_cis(state, l, l == 0 ? i_indices[d] : 0, l == 0 ? 0 : d);
+                batch_learn_enabled[bi] = learn_enabled[batch_streams[bi]] && (l == 0 ? io_learning(state, i_indices[d]) : layer_learning(state, l));
+            }
 
-    params.layers.resize(num_layers);
-    params.ios.resize(num_io);
+            decoders[l][d].step_batch(Array_View<Decoder::State*>(batch_decoder_states.p, batch_size), batch_input_cis_view, batch_target_cis_view,
+                batch_learn_enabled_view, (l == 0 ? params.ios[i_indices[d]].decoder : params.layers[l].decoder));
+        }
 
-    for (int l = 0; l < num_layers; l++)
-        reader.read(reinterpret_cast<void*>(&params.layers[l]), sizeof(Layer_Params));
+        if (l == 0) {
+            for (int d = 0; d < actors.size(); d++) {
+                int i = i_indices[d + io_sizes.size()];
 
-    for (int i = 0; i < num_io; i++)
-        reader.read(reinterpret_cast<void*>(&params.ios[i]), sizeof(IO_Params));
+                for (int bi = 0; bi < batch_size; bi++) {
+                    int b = batch_streams[bi];
+
+                    batch_actor_states[bi] = &states[b]->actors[d];
+                    batch_target_cis[bi] = input_cis[b][i];
+                    batch_rewards[bi] = rewards[b];
+                    batch_learn_enabled[bi] = learn_enabled[b] && io_learning(*states[b], i);
+                }
+
+                actors[d].step_batch(Array_View<Actor::State*>(batch_actor_states.p, batch_size), batch_input_cis_view, batch_target_cis_view,
+                    Float_Buffer_View(batch_rewards.p, batch_size), batch_learn_enabled_view, mimic, params.ios[i].actor);
+            }
+        }
+    }
 }
 
-void Hierarchy::write_state(
-    Stream_Writer &writer
+void Hierarchy::rollout(
+    const State &state,
+    State &scratch,
+    int num_steps,
+    Int_Buffer_View trajectory
 ) const {
-    writer.write(reinterpret_cast<const void*>(&updates[0]), updates.size() * sizeof(Byte));
-    writer.write(reinterpret_cast<const void*>(&ticks[0]), ticks.size() * sizeof(int));
+    TRACE_SCOPE("hierarchy rollout");
 
-    for (int l = 0; l < encoders.size(); l++) {
-        for (int i = 0; i < histories[l].size(); i++) {
-            int history_start = histories[l][i].start;
+    fork(state, scratch);
 
-            writer.write(reinterpret_cast<const void*>(&history_start), sizeof(int));
+    // inputs of the next step, also what is written to the trajectory
+    Array<Int_Buffer_View> &next_input_cis = scratch.rollout_input_cis;
 
-            for (int t = 0; t < histories[l][i].size(); t++)
-                writer.write(reinterpret_cast<const void*>(&histories[l][i][t][0]), histories[l][i][t].size() * sizeof(int));
-        }
+    next_input_cis.resize(io_sizes.size());
 
-        encoders[l].write_state(writer);
+    int index = 0;
 
-        // decoders
-        for (int d = 0; d < decoders[l].size(); d++)
-            decoders[l][d].write_state(writer);
+    for (int t = 0; t < num_steps; t++) {
+        if (t > 0)
+            predict_step(scratch, next_input_cis);
+
+        for (int i = 0; i < io_sizes.size(); i++) {
+            if (io_types[i] == none)
+                next_input_cis[i] = scratch.histories[0][i][0];
+            else
+                next_input_cis[i] = get_prediction_cis(scratch, i);
+
+            for (int j = 0; j < next_input_cis[i].size(); j++) {
+                trajectory[index] = next_input_cis[i][j];
+
+                index++;
+            }
+        }
     }
 
-    for (int d = 0; d < actors.size(); d++)
-        actors[d].write_state(writer);
+    assert(index == trajectory.size());
 }
 
-void Hierarchy::read_state(
-    Stream_Reader &reader
-) {
-    reader.read(reinterpret_cast<void*>(&updates[0]), updates.size() * sizeof(Byte));
-    reader.read(reinterpret_cast<void*>(&ticks[0]), ticks.size() * sizeof(int));
-    
-    for (int l = 0; l < encoders.size(); l++) {
-        for (int i = 0; i < histories[l].size(); i++) {
-            int history_start;
-            
-            reader.read(reinterpret_cast<void*>(&history_start), sizeof(int));
+void Hierarchy::predict_step(
+    State &state,
+    const Array<Int_Buffer_View> &input_cis
+) const {
+    begin_step(state, input_cis);
 
-            histories[l][i].start = history_start;
+    // forward
+    for (int l = 0; l < encoders.size(); l++) {
+        if (l == 0 || state.ticks[l] >= ticks_per_update[l]) {
+            begin_layer_update(state, l);
 
-            for (int t = 0; t < histories[l][i].size(); t++)
-                reader.read(reinterpret_cast<void*>(&histories[l][i][t][0]), histories[l][i][t].size() * sizeof(int));
+            encoders[l].activate(state.encoders[l], state.encoder_input_cis[l], params.layers[l].encoder);
         }
+    }
+
+    // backward
+    for (int l = decoders.size() - 1; l >= 0; l--) {
+        if (!state.updates[l])
+            continue;
+
+        gather_decoder_inputs(state, l);
 
-        encoders[l].read_state(reader);
-        
-        // decoders
         for (int d = 0; d < decoders[l].size(); d++)
-            decoders[l][d].read_state(reader);
+            decoders[l][d].predict(state.decoders[l][d], state.decoder_input_cis[l], (l == 0 ? params.ios[i_indices[d]].decoder : params.layers[l].decoder));
+
+        if (l == 0) {
+            for (int d = 0; d < actors.size(); d++) {
+                int i = i_indices[d + io_sizes.size()];
+
+                actors[d].act(state.actors[d], state.decoder_input_cis[l], input_cis[i], 0.0f, params.ios[i].actor);
+            }
+        }
+    }
+}
+
+void Hierarchy::begin_step(
+    State &state,
+    const Array<Int_Buffer_View> &input_cis
+) const {
+    // first tick is always 0
+    state.ticks[0] = 0;
+
+    // add input to first layer history   
+    for (int i = 0; i < io_sizes.size(); i++) {
+        // the previous input is still the most recent entry. counts restart while change detection is off, so they never overstate
+        if (params.skip_unchanged && cis_equal(input_cis[i], state.histories[0][i][0]))
+            state.input_repeats[0][i]++;
+        else
+            state.input_repeats[0][i] = 0;
+
+        state.histories[0][i].push_front();
+
+        // inputs filled in place (see get_input_slot) need no copy
+        if (input_cis[i].p != state.histories[0][i][0].p)
+            state.histories[0][i][0] = input_cis[i];
+    }
+
+    // set all updates to no update, will be set to true if an update occurred later
+    state.updates.fill(false);
+}
+
+void Hierarchy::begin_layer_update(
+    State &state,
+    int l
+) const {
+    // reset tick
+    state.ticks[l] = 0;
+
+    // updated
+    state.updates[l] = true;
+
+    int num_history = state.encoder_input_cis[l].size() / state.histories[l].size();
+
+    int index = 0;
+
+    for (int i = 0; i < state.histories[l].size(); i++) {
+        for (int t = 0; t < num_history; t++) {
+            state.encoder_input_cis[l][index] = get_history_cis(state, l, i, t);
+
+            index++;
+        }
+    }
+
+    if (l < encoders.size() - 1)
+        push_layer_output(state, l);
+
+    state.encoders_stepped[l] = true;
+}
+
+void Hierarchy::push_layer_output(
+    State &state,
+    int l
+) const {
+    int l_next = l + 1;
+
+    Circle_Buffer<Int_Buffer> &history = state.histories[l_next][0];
+
+    if (history.size() > 0) {
+        if (params.skip_unchanged && cis_equal(state.encoders[l].hidden_cis, history[0]))
+            state.input_repeats[l_next][0]++;
+        else
+            state.input_repeats[l_next][0] = 0;
+
+        history.push_front();
+
+        history[0].swap(state.encoders[l].hidden_cis);
+    }
+
+    state.ticks[l_next]++;
+}
+
+bool Hierarchy::encoder_inputs_unchanged(
+    const State &state,
+    int l
+) const {
+    int num_history = state.encoder_input_cis[l].size() / state.histories[l].size();
+
+    // the input window moved by one entry per update of the layer below since this layer's previous update.
+    // it is unchanged if all entries it covered in either update are the same
+    if (l == 0) {
+        for (int i = 0; i < state.histories[l].size(); i++) {
+            if (state.input_repeats[l][i] < num_history)
+                return false;
+        }
+
+        return true;
+    }
+
+    // the most recent entry is still the lower encoder's output, which is not counted until it is moved into the history
+    if (state.histories[l][0].size() == 0 || !cis_equal(state.encoders[l - 1].hidden_cis, state.histories[l][0][0]))
+        return false;
+
+    return state.input_repeats[l][0] >= num_history + ticks_per_update[l] - 2;
+}
+
+void Hierarchy::gather_decoder_inputs(
+    State &state,
+    int l
+) const {
+    Array<Int_Buffer_View> &layer_input_cis = state.decoder_input_cis[l];
+
+    layer_input_cis[0] = state.encoders[l].hidden_cis;
+    
+    if (l < encoders.size() - 1)
+        layer_input_cis[1] = state.decoders[l + 1][ticks_per_update[l + 1] - 1 - state.ticks[l + 1]].hidden_cis;
+}
+
+void Hierarchy::update_accuracy(
+    State &state,
+    int l,
+    int history_offset
+) const {
+    const Layer_Params &layer_params = params.layers[l];
+
+    int num_correct = 0;
+    int num_total = 0;
+
+    for (int d = 0; d < decoders[l].size(); d++) {
+        const Decoder::State &decoder_state = state.decoders[l][d];
+
+        // no prediction yet
+        if (decoder_state.hidden_acts[0] == -1.0f)
+            continue;
+
+        const Int_Buffer &target_cis = get_history_cis(state, l, l == 0 ? i_indices[d] : 0, l == 0 ? 0 : d + history_offset);
+
+        for (int i = 0; i < target_cis.size(); i++)
+            num_correct += (decoder_state.hidden_cis[i] == target_cis[i]);
+
+        num_total += target_cis.size();
+    }
+
+    if (num_total == 0)
+        return;
+
+    state.layer_accuracies[l] += layer_params.accuracy_rate * (static_cast<float>(num_correct) / num_total - state.layer_accuracies[l]);
+
+    if (state.layers_frozen[l])
+        state.layers_frozen[l] = (state.layer_accuracies[l] >= layer_params.unfreeze_accuracy);
+    else
+        state.layers_frozen[l] = (state.layer_accuracies[l] >= layer_params.freeze_accuracy);
+}
+
+void Hierarchy::step_decoders(
+    State &state,
+    int l,
+    int history_offset,
+    const Array<Int_Buffer_View> &input_cis,
+    bool learn_enabled,
+    float reward,
+    float mimic
+) {
+    const Array<Int_Buffer_View> &layer_input_cis = state.decoder_input_cis[l];
+
+    int num_heads = decoders[l].size() + (l == 0 ? actors.size() : 0);
+
+    // decoders and actors only share read-only inputs, so when there are at least as many as threads they run as concurrent tasks
+    // (with their column loops inside the tasks running serially, as nested regions are inactive by default).
+    // with fewer, they run one after the other so that each column loop gets all threads.
+    // each draws from its own RNG stream so results do not depend on scheduling
+    PARALLEL_TASKS(num_heads > 1 && num_heads >= get_max_threads())
+    {
+        for (int d = 0; d < decoders[l].size(); d++) {
+            TASK
+            {
+                Int_Buffer_View hidden_target_cis = get_history_cis(state, l, l == 0 ? i_indices[d] : 0, l == 0 ? 0 : d + history_offset);
+
+                bool decoder_learning = learn_enabled && (l == 0 ? io_learning(state, i_indices[d]) : layer_learning(state, l));
+
+                const Decoder::Params &decoder_params = (l == 0 ? params.ios[i_indices[d]].decoder : params.layers[l].decoder);
+
+                // unchanged inputs and weights reproduce the previous predictions, which are kept.
+                // learning would change the weights before the forward pass, so a learning decoder always steps
+                if (!(params.skip_unchanged && !params.pipelined && !decoder_learning && decoders[l][d].inputs_unchanged(state.decoders[l][d], layer_input_cis)))
+                    decoders[l][d].step(state.decoders[l][d], layer_input_cis, hidden_target_cis, decoder_learning, decoder_params);
+            }
+        }
+
+        if (l == 0) {
+            for (int d = 0; d < actors.size(); d++) {
+                TASK
+                {
+                    actors[d].step(state.actors[d], layer_input_cis, input_cis[i_indices[d + io_sizes.size()]], reward, learn_enabled && io_learning(state, i_indices[d + io_sizes.size()]), mimic, params.ios[i_indices[d + io_sizes.size()]].actor);
+                }
+            }
+        }
+    }
+}
+
+void Hierarchy::init_deferred(
+    State &state
+) const {
+    int num_layers = encoders.size();
+
+    Deferred_Learning &deferred = state.deferred;
+
+    // snapshots are allocated when first deferred
+    if (deferred.encoders_pending.size() != num_layers || deferred.actors_pending.size() != actors.size()) {
+        deferred.encoders_pending = Byte_Buffer(num_layers, false);
+        deferred.encoders.resize(num_layers);
+        deferred.encoder_input_cis.resize(num_layers);
+        deferred.encoder_input_views.resize(num_layers);
+
+        deferred.decoders_pending.resize(num_layers);
+        deferred.decoders.resize(num_layers);
+        deferred.decoder_target_cis.resize(num_layers);
+
+        for (int l = 0; l < num_layers; l++) {
+            deferred.encoder_input_cis[l].resize(encoders[l].visible_layers.size());
+            deferred.encoder_input_views[l].resize(encoders[l].visible_layers.size());
+
+            deferred.decoders_pending[l] = Byte_Buffer(decoders[l].size(), false);
+            deferred.decoders[l].resize(decoders[l].size());
+            deferred.decoder_target_cis[l].resize(decoders[l].size());
+        }
+
+        deferred.actors_pending = Byte_Buffer(actors.size(), false);
+        deferred.actor_mimics = Float_Buffer(actors.size(), 0.0f);
+    }
+    else {
+        deferred.encoders_pending.fill(false);
+
+        for (int l = 0; l < num_layers; l++)
+            deferred.decoders_pending[l].fill(false);
+
+        deferred.actors_pending.fill(false);
+    }
+
+    deferred.num_pending = 0;
+    deferred.num_dropped = 0;
+}
+
+void Hierarchy::place(
+    Arena &arena
+) {
+    // per-layer values and IO mappings
+    arena.place(ticks_per_update);
+    arena.place(io_sizes);
+    arena.place(io_types);
+    arena.place(i_indices);
+    arena.place(d_indices);
+
+    for (int l = 0; l < encoders.size(); l++)
+        encoders[l].place(arena);
+
+    for (int l = decoders.size() - 1; l >= 0; l--) {
+        for (int d = 0; d < decoders[l].size(); d++)
+            decoders[l][d].place(arena);
+
+        if (l == 0) {
+            for (int d = 0; d < actors.size(); d++)
+                actors[d].place(arena);
+        }
+    }
+}
+
+void Hierarchy::init_state(
+    State &state,
+    unsigned int seed
+) const {
+    int num_layers = encoders.size();
+
+    state.rand_state = rand_get_state(seed);
+
+    state.encoders.resize(num_layers);
+    state.decoders.resize(num_layers);
+    state.histories.resize(num_layers);
+    state.encoder_input_cis.resize(num_layers);
+    state.decoder_input_cis.resize(num_layers);
+    state.input_repeats.resize(num_layers);
+
+    // default update state is no update
+    state.updates = Byte_Buffer(num_layers, false);
+    state.ticks = Int_Buffer(num_layers, 0);
+    state.encoders_stepped = Byte_Buffer(num_layers, false);
+
+    state.layer_accuracies = Float_Buffer(num_layers, 0.0f);
+    state.layers_frozen = Byte_Buffer(num_layers, false);
+
+    // spare feedback buffers for pipelined stepping
+    state.feedback_cis.resize(max(0, num_layers - 1));
+
+    for (int l = 0; l < state.feedback_cis.size(); l++)
+        state.feedback_cis[l] = Int_Buffer(decoders[l + 1][0].hidden_size.x * decoders[l + 1][0].hidden_size.y, 0);
+
+    for (int l = 0; l < num_layers; l++) {
+        encoders[l].init_state(state.encoders[l], rand(&state.rand_state));
+
+        state.decoders[l].resize(decoders[l].size());
+
+        for (int d = 0; d < decoders[l].size(); d++)
+            decoders[l][d].init_state(state.decoders[l][d], rand(&state.rand_state));
+
+        // history buffers, one per encoder visible layer
+        int num_layer_inputs = (l == 0 ? io_sizes.size() : 1);
+        int num_history = encoders[l].visible_layers.size() / num_layer_inputs;
+
+        state.histories[l].resize(num_layer_inputs);
+        state.input_repeats[l] = Int_Buffer(num_layer_inputs, 0);
+
+        for (int i = 0; i < num_layer_inputs; i++) {
+            const Encoder::Visible_Layer_Desc &vld = encoders[l].visible_layer_descs[i * num_history];
+
+            state.histories[l][i].resize(num_history);
+            state.histories[l][i].start = 0;
+
+            for (int t = 0; t < num_history; t++)
+                state.histories[l][i][t] = Int_Buffer(vld.size.x * vld.size.y, 0);
+        }
+
+        // step input views
+        state.encoder_input_cis[l].resize(encoders[l].visible_layers.size());
+        state.decoder_input_cis[l].resize(1 + (l < num_layers - 1));
+    }
+
+    state.actors.resize(actors.size());
+
+    for (int d = 0; d < actors.size(); d++)
+        actors[d].init_state(state.actors[d], rand(&state.rand_state));
+
+    init_deferred(state);
+}
+
+void Hierarchy::fork(
+    const State &src,
+    State &dst
+) const {
+    // same sized buffers are assigned in place
+    dst.encoders = src.encoders;
+    dst.decoders = src.decoders;
+    dst.histories = src.histories;
+
+    dst.updates = src.updates;
+    dst.ticks = src.ticks;
+
+    dst.encoder_input_cis = src.encoder_input_cis;
+    dst.decoder_input_cis = src.decoder_input_cis;
+
+    dst.input_repeats = src.input_repeats;
+    dst.encoders_stepped = src.encoders_stepped;
+
+    dst.feedback_cis = src.feedback_cis;
+
+    dst.layer_accuracies = src.layer_accuracies;
+    dst.layers_frozen = src.layers_frozen;
+
+    dst.rand_state = src.rand_state;
+
+    dst.actors.resize(actors.size());
+
+    for (int d = 0; d < actors.size(); d++)
+        actors[d].fork_state(src.actors[d], dst.actors[d]);
+
+    init_deferred(dst);
+}
+
+void Hierarchy::clear_state(
+    State &state
+) const {
+    state.updates.fill(false);
+    state.ticks.fill(0);
+    state.encoders_stepped.fill(false);
+
+    for (int l = 0; l < encoders.size(); l++) {
+        state.input_repeats[l].fill(0);
+
+        for (int i = 0; i < state.histories[l].size(); i++) {
+            for (int t = 0; t < state.histories[l][i].size(); t++)
+                state.histories[l][i][t].fill(0);
+        }
+    }
+
+    for (int l = 0; l < encoders.size(); l++) {
+        encoders[l].clear_state(state.encoders[l]);
+    }
+        
+    for (int l = 0; l < encoders.size(); l++) {
+        // decoders
+        for (int d = 0; d < decoders[l].size(); d++)
+            decoders[l][d].clear_state(state.decoders[l][d]);
+    }
+
+    // actors
+    for (int d = 0; d < actors.size(); d++)
+        actors[d].clear_state(state.actors[d]);
+
+    init_deferred(state);
+}
+
+// header fields and section table entries are written field by field
+static long long header_size(
+    int num_sections
+) {
+    return 3 * sizeof(int) + num_sections * (4 * sizeof(int) + 4 * sizeof(long long));
+}
+
+static long long align_section(
+    long long offset
+) {
+    return (offset + section_alignment - 1) / section_alignment * section_alignment;
+}
+
+// counts, then per IO its size and type, ticks per layer, IO indices (two per IO) and decoder indices, then the checkpoint sequence
+static long long meta_size(
+    long long num_layers,
+    long long num_io
+) {
+    return 5 * sizeof(int) + num_io * (3 * sizeof(int) + sizeof(Byte)) + num_layers * sizeof(int) + num_io * 3 * sizeof(int);
+}
+
+// meta and params fields are written one by one at fixed widths (ints, floats and bools as a byte), independent of struct layouts
+static void write_int3(
+    Stream_Writer &writer,
+    const Int3 &v
+) {
+    writer.write(reinterpret_cast<const void*>(&v.x), sizeof(int));
+    writer.write(reinterpret_cast<const void*>(&v.y), sizeof(int));
+    writer.write(reinterpret_cast<const void*>(&v.z), sizeof(int));
+}
+
+static void read_int3(
+    Stream_Reader &reader,
+    Int3 &v
+) {
+    reader.read(reinterpret_cast<void*>(&v.x), sizeof(int));
+    reader.read(reinterpret_cast<void*>(&v.y), sizeof(int));
+    reader.read(reinterpret_cast<void*>(&v.z), sizeof(int));
+}
+
+static void write_bool(
+    Stream_Writer &writer,
+    bool b
+) {
+    Byte byte = b;
+
+    writer.write(reinterpret_cast<const void*>(&byte), sizeof(Byte));
+}
+
+static void read_bool(
+    Stream_Reader &reader,
+    bool &b
+) {
+    Byte byte = 0;
+
+    reader.read(reinterpret_cast<void*>(&byte), sizeof(Byte));
+
+    b = (byte != 0);
+}
+
+// scale, lr and gcurve, for both encoders and decoders
+template <typename T>
+static void write_coder_params(
+    Stream_Writer &writer,
+    const T &params
+) {
+    writer.write(reinterpret_cast<const void*>(&params.scale), sizeof(float));
+    writer.write(reinterpret_cast<const void*>(&params.lr), sizeof(float));
+    writer.write(reinterpret_cast<const void*>(&params.gcurve), sizeof(float));
+}
+
+template <typename T>
+static void read_coder_params(
+    Stream_Reader &reader,
+    T &params
+) {
+    reader.read(reinterpret_cast<void*>(&params.scale), sizeof(float));
+    reader.read(reinterpret_cast<void*>(&params.lr), sizeof(float));
+    reader.read(reinterpret_cast<void*>(&params.gcurve), sizeof(float));
+}
+
+static const long long coder_params_size = 3 * sizeof(float);
+static const long long layer_params_size = 2 * coder_params_size + 3 * sizeof(float) + 2 * sizeof(Byte);
+static const long long io_params_size = coder_params_size + 4 * sizeof(float) + 2 * sizeof(int) + sizeof(Byte);
+
+static void write_layer_params(
+    Stream_Writer &writer,
+    const Hierarchy::Layer_Params &params
+) {
+    write_coder_params(writer, params.decoder);
+    write_coder_params(writer, params.encoder);
+
+    write_bool(writer, params.learn_enabled);
+    write_bool(writer, params.auto_freeze);
+
+    writer.write(reinterpret_cast<const void*>(&params.freeze_accuracy), sizeof(float));
+    writer.write(reinterpret_cast<const void*>(&params.unfreeze_accuracy), sizeof(float));
+    writer.write(reinterpret_cast<const void*>(&params.accuracy_rate), sizeof(float));
+}
+
+static void read_layer_params(
+    Stream_Reader &reader,
+    Hierarchy::Layer_Params &params
+) {
+    read_coder_params(reader, params.decoder);
+    read_coder_params(reader, params.encoder);
+
+    read_bool(reader, params.learn_enabled);
+    read_bool(reader, params.auto_freeze);
+
+    reader.read(reinterpret_cast<void*>(&params.freeze_accuracy), sizeof(float));
+    reader.read(reinterpret_cast<void*>(&params.unfreeze_accuracy), sizeof(float));
+    reader.read(reinterpret_cast<void*>(&params.accuracy_rate), sizeof(float));
+}
+
+static void write_io_params(
+    Stream_Writer &writer,
+    const Hierarchy::IO_Params &params
+) {
+    write_coder_params(writer, params.decoder);
+
+    writer.write(reinterpret_cast<const void*>(&params.actor.vlr), sizeof(float));
+    writer.write(reinterpret_cast<const void*>(&params.actor.alr), sizeof(float));
+    writer.write(reinterpret_cast<const void*>(&params.actor.discount), sizeof(float));
+    writer.write(reinterpret_cast<const void*>(&params.actor.min_steps), sizeof(int));
+    writer.write(reinterpret_cast<const void*>(&params.actor.history_iters), sizeof(int));
+
+    writer.write(reinterpret_cast<const void*>(&params.importance), sizeof(float));
+
+    write_bool(writer, params.learn_enabled);
+}
+
+static void read_io_params(
+    Stream_Reader &reader,
+    Hierarchy::IO_Params &params
+) {
+    read_coder_params(reader, params.decoder);
+
+    reader.read(reinterpret_cast<void*>(&params.actor.vlr), sizeof(float));
+    reader.read(reinterpret_cast<void*>(&params.actor.alr), sizeof(float));
+    reader.read(reinterpret_cast<void*>(&params.actor.discount), sizeof(float));
+    reader.read(reinterpret_cast<void*>(&params.actor.min_steps), sizeof(int));
+    reader.read(reinterpret_cast<void*>(&params.actor.history_iters), sizeof(int));
+
+    reader.read(reinterpret_cast<void*>(&params.importance), sizeof(float));
+
+    read_bool(reader, params.learn_enabled);
+}
+
+long long Hierarchy::size() const {
+    Array<Section> sections;
+
+    get_sections(sections);
+
+    long long size = header_size(sections.size());
+
+    for (int s = 0; s < sections.size(); s++)
+        size = align_section(size) + section_size(sections[s]);
+
+    return size;
+}
+
+long long Hierarchy::state_size() const {
+    long long size = encoders.size() * sizeof(Byte) + encoders.size() * sizeof(int);
+
+    for (int l = 0; l < encoders.size(); l++) {
+        int num_layer_inputs = (l == 0 ? io_sizes.size() : 1);
+
+        // history starts and buffers, one buffer per encoder visible layer
+        size += num_layer_inputs * sizeof(int);
+
+        for (int vli = 0; vli < encoders[l].visible_layer_descs.size(); vli++) {
+            const Encoder::Visible_Layer_Desc &vld = encoders[l].visible_layer_descs[vli];
+
+            size += vld.size.x * vld.size.y * sizeof(int);
+        }
+
+        size += encoders[l].state_size();
+        
+        // decoders
+        for (int d = 0; d < decoders[l].size(); d++)
+            size += decoders[l][d].state_size();
+    }
+
+    // actors
+    for (int d = 0; d < actors.size(); d++)
+        size += actors[d].state_size();
+
+    return size + streams_size();
+}
+
+long long Hierarchy::streams_size() const {
+    int num_rand_states = 1 + encoders.size() + actors.size();
+
+    for (int l = 0; l < decoders.size(); l++)
+        num_rand_states += decoders[l].size();
+
+    return num_rand_states * sizeof(unsigned long);
+}
+
+void Hierarchy::get_sections(
+    Array<Section> &sections
+) const {
+    int num_sections = 3 + actors.size();
+
+    for (int l = 0; l < encoders.size(); l++)
+        num_sections += 1 + decoders[l].size();
+
+    sections.resize(num_sections);
+
+    int index = 0;
+
+    Section section;
+
+    section.layer = 0;
+    section.index = 0;
+    section.offset = 0;
+    section.compression = compression_none;
+    section.size = 0;
+    section.stored_size = 0;
+    section.checksum = 0;
+
+    section.type = section_meta;
+    sections[index++] = section;
+
+    for (int l = 0; l < encoders.size(); l++) {
+        section.layer = l;
+
+        section.type = section_encoder;
+        section.index = 0;
+        sections[index++] = section;
+
+        section.type = section_decoder;
+
+        for (int d = 0; d < decoders[l].size(); d++) {
+            section.index = d;
+            sections[index++] = section;
+        }
+    }
+
+    section.layer = 0;
+    section.type = section_actor;
+
+    for (int d = 0; d < actors.size(); d++) {
+        section.index = d;
+        sections[index++] = section;
+    }
+
+    section.index = 0;
+
+    section.type = section_params;
+    sections[index++] = section;
+
+    // last, reading it needs everything else
+    section.type = section_state;
+    sections[index++] = section;
+}
+
+long long Hierarchy::section_size(
+    const Section &section
+) const {
+    switch (section.type) {
+    case section_meta:
+        return meta_size(encoders.size(), io_sizes.size());
+    case section_encoder:
+        return encoders[section.layer].size();
+    case section_decoder:
+        return decoders[section.layer][section.index].size();
+    case section_actor:
+        return actors[section.index].size();
+    case section_params:
+        return encoders.size() * layer_params_size + io_sizes.size() * io_params_size;
+    case section_state:
+        return state_size();
+    }
+
+    return 0;
+}
+
+void Hierarchy::write_section(
+    Stream_Writer &writer,
+    const Section &section
+) const {
+    switch (section.type) {
+    case section_meta: {
+        int num_layers = encoders.size();
+
+        writer.write(reinterpret_cast<const void*>(&num_layers), sizeof(int));
+
+        int num_io = io_sizes.size();
+
+        writer.write(reinterpret_cast<const void*>(&num_io), sizeof(int));
+
+        int num_predictions = decoders[0].size();
+        int num_actions = actors.size();
+
+        writer.write(reinterpret_cast<const void*>(&num_predictions), sizeof(int));
+        writer.write(reinterpret_cast<const void*>(&num_actions), sizeof(int));
+
+        for (int i = 0; i < num_io; i++)
+            write_int3(writer, io_sizes[i]);
+
+        writer.write(reinterpret_cast<const void*>(&io_types[0]), num_io * sizeof(Byte));
+
+        writer.write(reinterpret_cast<const void*>(&ticks_per_update[0]), ticks_per_update.size() * sizeof(int));
+
+        writer.write(reinterpret_cast<const void*>(&i_indices[0]), i_indices.size() * sizeof(int));
+        writer.write(reinterpret_cast<const void*>(&d_indices[0]), d_indices.size() * sizeof(int));
+
+        writer.write(reinterpret_cast<const void*>(&checkpoint_sequence), sizeof(int));
+
+        break;
+    }
+    case section_encoder:
+        encoders[section.layer].write(writer);
+
+        break;
+    case section_decoder:
+        decoders[section.layer][section.index].write(writer);
+
+        break;
+    case section_actor:
+        actors[section.index].write(writer);
+
+        break;
+    case section_params:
+        for (int l = 0; l < encoders.size(); l++)
+            write_layer_params(writer, params.layers[l]);
+
+        for (int i = 0; i < io_sizes.size(); i++)
+            write_io_params(writer, params.ios[i]);
+
+        break;
+    case section_state:
+        write_state(writer, default_state);
+
+        break;
+    }
+}
+
+bool Hierarchy::read_section(
+    Stream_Reader &reader,
+    const Section &section
+) {
+    switch (section.type) {
+    case section_encoder:
+        if (section.layer < 0 || section.layer >= encoders.size())
+            return false;
+
+        encoders[section.layer].read(reader);
+
+        return true;
+    case section_decoder:
+        if (section.layer < 0 || section.layer >= decoders.size() || section.index < 0 || section.index >= decoders[section.layer].size())
+            return false;
+
+        decoders[section.layer][section.index].read(reader);
+
+        return true;
+    case section_actor:
+        if (section.index < 0 || section.index >= actors.size())
+            return false;
+
+        actors[section.index].read(reader);
+
+        return true;
+    case section_params:
+        params.layers.resize(encoders.size());
+        params.ios.resize(io_sizes.size());
+
+        for (int l = 0; l < encoders.size(); l++)
+            read_layer_params(reader, params.layers[l]);
+
+        for (int i = 0; i < io_sizes.size(); i++)
+            read_io_params(reader, params.ios[i]);
+
+        return true;
+    case section_state:
+        read_state(reader, default_state);
+
+        return true;
+    }
+
+    // meta is read by read_meta. unknown sections of the same version are not expected
+    return false;
+}
+
+// whether a size can be used as a layer size, with its cell count fitting an int
+static bool valid_size(
+    const Int3 &size
+) {
+    if (size.x <= 0 || size.y <= 0 || size.z <= 0)
+        return false;
+
+    return static_cast<long long>(size.x) * size.y * size.z <= 0x7fffffff;
+}
+
+static bool same_size(
+    const Int3 &a,
+    const Int3 &b
+) {
+    return a.x == b.x && a.y == b.y && a.z == b.z;
+}
+
+bool Hierarchy::read_meta(
+    Stream_Reader &reader,
+    const Array<Section> &sections
+) {
+    int num_layers;
+
+    reader.read(reinterpret_cast<void*>(&num_layers), sizeof(int));
+
+    int num_io;
+
+    reader.read(reinterpret_cast<void*>(&num_io), sizeof(int));
+
+    int num_predictions;
+    int num_actions;
+
+    reader.read(reinterpret_cast<void*>(&num_predictions), sizeof(int));
+    reader.read(reinterpret_cast<void*>(&num_actions), sizeof(int));
+
+    if (num_layers <= 0 || num_io <= 0 || num_predictions < 0 || num_actions < 0 || num_predictions + static_cast<long long>(num_actions) > num_io)
+        return false;
+
+    // the section size bounds the counts by the input, the table bounds them by its components (meta, encoders, params and state at least)
+    if (sections[0].size != meta_size(num_layers, num_io) || num_layers + static_cast<long long>(num_predictions) + num_actions + 3 > sections.size())
+        return false;
+
+    io_sizes.resize(num_io);
+    io_types.resize(num_io);
+
+    for (int i = 0; i < num_io; i++) {
+        read_int3(reader, io_sizes[i]);
+
+        if (!valid_size(io_sizes[i]))
+            return false;
+    }
+
+    reader.read(reinterpret_cast<void*>(&io_types[0]), num_io * sizeof(Byte));
+
+    int type_predictions = 0;
+    int type_actions = 0;
+
+    for (int i = 0; i < num_io; i++) {
+        if (io_types[i] == prediction)
+            type_predictions++;
+        else if (io_types[i] == action)
+            type_actions++;
+        else if (io_types[i] != none)
+            return false;
+    }
+
+    if (type_predictions != num_predictions || type_actions != num_actions)
+        return false;
+
+    ticks_per_update.resize(num_layers);
+
+    reader.read(reinterpret_cast<void*>(&ticks_per_update[0]), ticks_per_update.size() * sizeof(int));
+
+    // each tick of a higher layer has its own decoder, so the table bounds the ticks before decoders are sized by them
+    long long num_sections = 3 + num_layers + num_predictions + num_actions;
+
+    for (int l = 0; l < num_layers; l++) {
+        if (l == 0 ? ticks_per_update[l] != 1 : ticks_per_update[l] < 1)
+            return false;
+
+        if (l > 0)
+            num_sections += ticks_per_update[l];
+    }
+
+    if (num_sections != sections.size())
+        return false;
+
+    i_indices.resize(num_io * 2);
+    d_indices.resize(num_io);
+
+    reader.read(reinterpret_cast<void*>(&i_indices[0]), i_indices.size() * sizeof(int));
+    reader.read(reinterpret_cast<void*>(&d_indices[0]), d_indices.size() * sizeof(int));
+
+    // each prediction and action maps to its own decoder or actor and back, unused slots are -1
+    for (int i = 0; i < num_io; i++) {
+        int d = d_indices[i];
+
+        if (io_types[i] == prediction) {
+            if (d < 0 || d >= num_predictions || i_indices[d] != i)
+                return false;
+        }
+        else if (io_types[i] == action) {
+            if (d < 0 || d >= num_actions || i_indices[num_io + d] != i)
+                return false;
+        }
+        else if (d != -1)
+            return false;
+    }
+
+    for (int d = 0; d < num_io; d++) {
+        if ((d >= num_predictions && i_indices[d] != -1) || (d >= num_actions && i_indices[num_io + d] != -1))
+            return false;
+    }
+
+    reader.read(reinterpret_cast<void*>(&checkpoint_sequence), sizeof(int));
+
+    if (!reader.good())
+        return false;
+
+    encoders.resize(num_layers);
+    decoders.resize(num_layers);
+
+    for (int l = 0; l < num_layers; l++)
+        decoders[l].resize(l == 0 ? num_predictions : ticks_per_update[l]);
+
+    actors.resize(num_actions);
+
+    // the table must list exactly the components described, so each is read once
+    Array<Section> expected;
+
+    get_sections(expected);
+
+    for (int s = 0; s < sections.size(); s++) {
+        if (sections[s].type != expected[s].type || sections[s].layer != expected[s].layer || sections[s].index != expected[s].index)
+            return false;
+    }
+
+    return true;
+}
+
+bool Hierarchy::components_fit() const {
+    int num_layers = encoders.size();
+    int num_io = io_sizes.size();
+
+    for (int l = 0; l < num_layers; l++) {
+        const Encoder &enc = encoders[l];
+
+        if (!valid_size(enc.hidden_size))
+            return false;
+
+        // first layer inputs are the IOs, each with the same number of history steps
+        int num_layer_inputs = (l == 0 ? num_io : 1);
+
+        if (enc.visible_layer_descs.size() == 0 || enc.visible_layer_descs.size() % num_layer_inputs != 0)
+            return false;
+
+        int num_history = enc.visible_layer_descs.size() / num_layer_inputs;
+
+        for (int vli = 0; vli < enc.visible_layer_descs.size(); vli++) {
+            if (!same_size(enc.visible_layer_descs[vli].size, l == 0 ? io_sizes[vli / num_history] : encoders[l - 1].hidden_size))
+                return false;
+        }
+
+        int num_feedback = 1 + (l < num_layers - 1);
+
+        for (int d = 0; d < decoders[l].size(); d++) {
+            const Decoder &dec = decoders[l][d];
+
+            if (!same_size(dec.hidden_size, l == 0 ? io_sizes[i_indices[d]] : encoders[l - 1].hidden_size) || dec.visible_layer_descs.size() != num_feedback)
+                return false;
+
+            for (int vli = 0; vli < num_feedback; vli++) {
+                if (!same_size(dec.visible_layer_descs[vli].size, enc.hidden_size))
+                    return false;
+            }
+        }
+    }
+
+    int num_feedback = 1 + (num_layers > 1);
+
+    for (int d = 0; d < actors.size(); d++) {
+        const Actor &act = actors[d];
+
+        if (!same_size(act.hidden_size, io_sizes[i_indices[num_io + d]]) || act.visible_layer_descs.size() != num_feedback)
+            return false;
+
+        for (int vli = 0; vli < num_feedback; vli++) {
+            if (!same_size(act.visible_layer_descs[vli].size, encoders[0].hidden_size))
+                return false;
+        }
+    }
+
+    return true;
+}
+
+void Hierarchy::encode_sections(
+    Array<Section> &sections,
+    Array<Memory_Writer> &raws
+) const {
+    raws.resize(sections.size());
+
+    // sections are independent, so they are encoded concurrently, each hashed as it is written
+    PARALLEL_TASKS(sections.size() > 1)
+    {
+        for (int s = 0; s < sections.size(); s++) {
+            TASK
+            {
+                raws[s].buffer.resize(section_size(sections[s]));
+
+                Checksum_Writer checksum_writer(&raws[s]);
+
+                write_section(checksum_writer, sections[s]);
+
+                sections[s].compression = compression_none;
+                sections[s].size = checksum_writer.size;
+                sections[s].stored_size = checksum_writer.size;
+                sections[s].checksum = checksum_writer.hash;
+            }
+        }
+    }
+}
+
+void Hierarchy::compress_sections(
+    Array<Section> &sections,
+    const Array<Memory_Writer> &raws,
+    Array<Byte_Buffer> &stored
+) const {
+    int num_blocks = 0;
+
+    for (int s = 0; s < sections.size(); s++) {
+        sections[s].compression = compression_rans;
+
+        num_blocks += (raws[s].size + compression_block_size - 1) / compression_block_size;
+    }
+
+    // blocks of all sections are compressed together, so that small sections also spread over threads
+    Int_Buffer block_sections(num_blocks);
+    Array<long long> block_starts(num_blocks); // byte offsets in the sections
+    Array<Byte_Buffer> blocks(num_blocks);
+
+    int block_index = 0;
+
+    for (int s = 0; s < sections.size(); s++) {
+        for (long long start = 0; start < raws[s].size; start += compression_block_size) {
+            block_sections[block_index] = s;
+            block_starts[block_index] = start;
+            block_index++;
+        }
+    }
+
+    PARALLEL_FOR
+    for (int b = 0; b < num_blocks; b++) {
+        const Memory_Writer &raw = raws[block_sections[b]];
+
+        Byte_Buffer_View block(raw.buffer.p + block_starts[b], min<long long>(compression_block_size, raw.size - block_starts[b]));
+
+        // empty if stored raw
+        if (!rans_encode(block, blocks[b]))
+            blocks[b].resize(0);
+    }
+
+    stored.resize(sections.size());
+
+    block_index = 0;
+
+    for (int s = 0; s < sections.size(); s++) {
+        int section_blocks = (raws[s].size + compression_block_size - 1) / compression_block_size;
+
+        Memory_Writer writer;
+
+        writer.write(reinterpret_cast<const void*>(&section_blocks), sizeof(int));
+
+        for (int b = 0; b < section_blocks; b++) {
+            int block_size = min<long long>(compression_block_size, raws[s].size - block_starts[block_index + b]);
+
+            int stored_size = (blocks[block_index + b].size() > 0 ? blocks[block_index + b].size() : block_size);
+
+            writer.write(reinterpret_cast<const void*>(&stored_size), sizeof(int));
+        }
+
+        for (int b = 0; b < section_blocks; b++) {
+            const Byte_Buffer &block = blocks[block_index + b];
+
+            if (block.size() > 0)
+                writer.write(reinterpret_cast<const void*>(block.p), block.size());
+            else
+                writer.write(reinterpret_cast<const void*>(raws[s].buffer.p + block_starts[block_index + b]), min<long long>(compression_block_size, raws[s].size - block_starts[block_index + b]));
+        }
+
+        block_index += section_blocks;
+
+        writer.buffer.resize(writer.size);
+
+        stored[s].swap(writer.buffer);
+
+        sections[s].stored_size = stored[s].size();
+    }
+}
+
+// header and section table
+static void write_table(
+    Stream_Writer &writer,
+    const Array<Hierarchy::Section> &sections
+) {
+    int num_sections = sections.size();
+
+    writer.write(reinterpret_cast<const void*>(&hierarchy_magic), sizeof(int));
+    writer.write(reinterpret_cast<const void*>(&hierarchy_version), sizeof(int));
+    writer.write(reinterpret_cast<const void*>(&num_sections), sizeof(int));
+
+    for (int s = 0; s < sections.size(); s++) {
+        const Hierarchy::Section &section = sections[s];
+
+        writer.write(reinterpret_cast<const void*>(&section.type), sizeof(int));
+        writer.write(reinterpret_cast<const void*>(&section.layer), sizeof(int));
+        writer.write(reinterpret_cast<const void*>(&section.index), sizeof(int));
+        writer.write(reinterpret_cast<const void*>(&section.compression), sizeof(int));
+        writer.write(reinterpret_cast<const void*>(&section.offset), sizeof(long long));
+        writer.write(reinterpret_cast<const void*>(&section.size), sizeof(long long));
+        writer.write(reinterpret_cast<const void*>(&section.stored_size), sizeof(long long));
+        writer.write(reinterpret_cast<const void*>(&section.checksum), sizeof(long long));
+    }
+}
+
+void Hierarchy::write(
+    Stream_Writer &writer,
+    bool compress
+) const {
+    Array<Section> sections;
+
+    get_sections(sections);
+
+    Array<Memory_Writer> raws;
+    Array<Byte_Buffer> stored;
+
+    if (compress) {
+        encode_sections(sections, raws);
+
+        compress_sections(sections, raws, stored);
+    }
+    else {
+        for (int s = 0; s < sections.size(); s++) {
+            sections[s].compression = compression_none;
+            sections[s].size = section_size(sections[s]);
+            sections[s].stored_size = sections[s].size;
+        }
+    }
+
+    long long offset = header_size(sections.size());
+
+    for (int s = 0; s < sections.size(); s++) {
+        offset = align_section(offset);
+
+        sections[s].offset = offset;
+
+        offset += sections[s].stored_size;
+    }
+
+    // writers backed by memory take the sections in place, encoded concurrently
+    Byte* data = (compress ? nullptr : static_cast<Byte*>(writer.view(offset)));
+
+    if (data != nullptr) {
+        PARALLEL_TASKS(sections.size() > 1)
+        {
+            for (int s = 0; s < sections.size(); s++) {
+                TASK
+                {
+                    Span_Writer span_writer(Byte_Buffer_View(data + sections[s].offset, sections[s].size));
+
+                    Checksum_Writer checksum_writer(&span_writer);
+
+                    write_section(checksum_writer, sections[s]);
+
+                    assert(checksum_writer.size == sections[s].size);
+
+                    sections[s].checksum = checksum_writer.hash;
+                }
+            }
+        }
+
+        long long pos = header_size(sections.size());
+
+        for (int s = 0; s < sections.size(); s++) {
+            memset(data + pos, 0, sections[s].offset - pos);
+
+            pos = sections[s].offset + sections[s].stored_size;
+        }
+
+        Span_Writer table_writer(Byte_Buffer_View(data, header_size(sections.size())));
+
+        write_table(table_writer, sections);
+
+        return;
+    }
+
+    if (!compress) {
+        // checksums from a first pass that discards the data, over all sections concurrently
+        PARALLEL_TASKS(sections.size() > 1)
+        {
+            for (int s = 0; s < sections.size(); s++) {
+                TASK
+                {
+                    Checksum_Writer checksum_writer;
+
+                    write_section(checksum_writer, sections[s]);
+
+                    sections[s].checksum = checksum_writer.hash;
+                }
+            }
+        }
+    }
+
+    write_table(writer, sections);
+
+    long long pos = header_size(sections.size());
+
+    const Byte padding[section_alignment] = { 0 };
+
+    for (int s = 0; s < sections.size(); s++) {
+        if (sections[s].offset > pos)
+            writer.write(reinterpret_cast<const void*>(padding), sections[s].offset - pos);
+
+        if (compress)
+            writer.write(reinterpret_cast<const void*>(stored[s].p), stored[s].size());
+        else
+            write_section(writer, sections[s]);
+
+        pos = sections[s].offset + sections[s].stored_size;
+    }
+}
+
+// skip the padding before a section starting at offset, returns false if it is not a valid start
+static bool skip_padding(
+    Stream_Reader &reader,
+    long long pos,
+    long long offset
+) {
+    if (offset < pos || offset - pos >= section_alignment)
+        return false;
+
+    if (offset > pos) {
+        int len = offset - pos;
+
+        if (reader.view(len) == nullptr) {
+            Byte padding[section_alignment];
+
+            reader.read(reinterpret_cast<void*>(padding), len);
+        }
+    }
+
+    return true;
+}
+
+// read len bytes into buffer. if the length of the input is not known, the buffer grows with what is read instead of being sized up front,
+// so a corrupt length runs into the end of the input before allocating much more than it holds
+static bool read_stored(
+    Stream_Reader &reader,
+    Byte_Buffer &buffer,
+    long long len
+) {
+    if (reader.remaining() >= 0) {
+        if (len > reader.remaining())
+            return false;
+
+        buffer.resize(len);
+
+        reader.read(reinterpret_cast<void*>(buffer.p), len);
+
+        return reader.good();
+    }
+
+    buffer.resize(0);
+
+    long long pos = 0;
+
+    while (pos < len) {
+        long long chunk = min(len - pos, max<long long>(compression_block_size, pos));
+
+        buffer.resize(pos + chunk);
+
+        reader.read(reinterpret_cast<void*>(buffer.p + pos), chunk);
+
+        if (!reader.good())
+            return false;
+
+        pos += chunk;
+    }
+
+    return true;
+}
+
+bool Hierarchy::parse_section(
+    Byte_Buffer_View raw,
+    bool borrow,
+    const Array<Section> &sections,
+    int s
+) {
+    Span_Reader span_reader(raw);
+    Memory_Reader memory_reader(raw);
+
+    // only counts what is read
+    Checksum_Reader checksum_reader(borrow ? static_cast<Stream_Reader*>(&span_reader) : static_cast<Stream_Reader*>(&memory_reader), false);
+
+    if (!(s == 0 ? read_meta(checksum_reader, sections) : read_section(checksum_reader, sections[s])))
+        return false;
+
+    return checksum_reader.size == sections[s].size && checksum_reader.good();
+}
+
+bool Hierarchy::read_streamed(
+    Stream_Reader &reader,
+    const Array<Section> &sections,
+    bool verify
+) {
+    Byte_Buffer raw;
+
+    for (int s = 0; s < sections.size(); s++) {
+        const Section &section = sections[s];
+
+        if (s > 0 && !skip_padding(reader, sections[s - 1].offset + sections[s - 1].size, section.offset))
+            return false;
+
+        if (!read_stored(reader, raw, section.size))
+            return false;
+
+        if (verify && checksum(raw.p, raw.size()) != section.checksum)
+            return false;
+
+        // the state is allocated by the layout, which the components must fit
+        if (s == sections.size() - 1 && !components_fit())
+            return false;
+
+        if (!parse_section(raw, false, sections, s))
+            return false;
+    }
+
+    return true;
+}
+
+bool Hierarchy::read_sections(
+    Stream_Reader &reader,
+    const Array<Section> &sections,
+    long long pos,
+    bool verify
+) {
+    bool compressed = false;
+
+    for (int s = 0; s < sections.size(); s++)
+        compressed = compressed || sections[s].compression != compression_none;
+
+    // stored data, viewed in place if the reader allows it
+    Array<Byte_Buffer> stored_buffers(sections.size());
+    Array<Byte_Buffer_View> stored(sections.size());
+
+    // uncompressed sections are parsed where they are stored. viewed ones outlive the hierarchy, so parsing can borrow from them
+    Byte_Buffer borrow(sections.size());
+
+    for (int s = 0; s < sections.size(); s++) {
+        const Section &section = sections[s];
+
+        if (!skip_padding(reader, pos, section.offset))
+            return false;
+
+        void* data = reader.view(section.stored_size);
+
+        // uncompressed sections that can not be viewed are streamed in order, buffering one at a time instead of all of them
+        if (data == nullptr && s == 0 && !compressed)
+            return read_streamed(reader, sections, verify);
+
+        borrow[s] = (data != nullptr && section.compression == compression_none);
+
+        if (data != nullptr)
+            stored[s] = Byte_Buffer_View(static_cast<Byte*>(data), section.stored_size);
+        else {
+            if (!read_stored(reader, stored_buffers[s], section.stored_size))
+                return false;
+
+            stored[s] = stored_buffers[s];
+        }
+
+        pos = section.offset + section.stored_size;
+    }
+
+    // truncated input of unknown length
+    if (!reader.good())
+        return false;
+
+    Array<Byte_Buffer> raw_buffers(sections.size());
+    Array<Byte_Buffer_View> raws(sections.size());
+
+    // locate the blocks of all compressed sections, to decompress them together
+    int num_blocks = 0;
+
+    for (int s = 0; s < sections.size(); s++) {
+        if (sections[s].compression == compression_none)
+            raws[s] = stored[s];
+        else
+            num_blocks += (sections[s].size + compression_block_size - 1) / compression_block_size;
+    }
+
+    Int_Buffer block_sections(num_blocks);
+    Array<long long> block_starts(num_blocks); // byte offsets in the sections
+    Array<Byte_Buffer_View> blocks(num_blocks);
+
+    int block_index = 0;
+
+    for (int s = 0; s < sections.size(); s++) {
+        const Section &section = sections[s];
+
+        if (section.compression == compression_none)
+            continue;
+
+        int section_blocks = (section.size + compression_block_size - 1) / compression_block_size;
+
+        int stored_section_blocks;
+
+        if (stored[s].size() < static_cast<Index>(sizeof(int)) * (1 + section_blocks))
+            return false;
+
+        memcpy(&stored_section_blocks, stored[s].p, sizeof(int));
+
+        if (stored_section_blocks != section_blocks)
+            return false;
+
+        long long block_pos = sizeof(int) * (1 + section_blocks);
+
+        for (int b = 0; b < section_blocks; b++) {
+            int stored_size;
+
+            memcpy(&stored_size, stored[s].p + sizeof(int) * (1 + b), sizeof(int));
+
+            if (stored_size <= 0 || stored_size > stored[s].size() - block_pos)
+                return false;
+
+            block_sections[block_index] = s;
+            block_starts[block_index] = static_cast<long long>(b) * compression_block_size;
+            blocks[block_index] = Byte_Buffer_View(stored[s].p + block_pos, stored_size);
+            block_index++;
+
+            block_pos += stored_size;
+        }
+
+        raw_buffers[s].resize(section.size);
+
+        raws[s] = raw_buffers[s];
+    }
+
+    Byte_Buffer blocks_valid(num_blocks);
+
+    PARALLEL_FOR
+    for (int b = 0; b < num_blocks; b++) {
+        Byte_Buffer &raw = raw_buffers[block_sections[b]];
+
+        Byte_Buffer_View block(raw.p + block_starts[b], min<long long>(compression_block_size, raw.size() - block_starts[b]));
+
+        if (blocks[b].size() == block.size()) {
+            memcpy(block.p, blocks[b].p, block.size());
+
+            blocks_valid[b] = true;
+        }
+        else
+            blocks_valid[b] = rans_decode(blocks[b], block);
+    }
+
+    for (int b = 0; b < num_blocks; b++) {
+        if (!blocks_valid[b])
+            return false;
+    }
+
+    // compressed data is no longer needed
+    for (int s = 0; s < sections.size(); s++) {
+        if (sections[s].compression != compression_none)
+            stored_buffers[s].resize(0);
+    }
+
+    if (verify) {
+        // sections are whole in memory, so they can be checked before parsing
+        Byte_Buffer sections_valid(sections.size());
+
+        PARALLEL_FOR
+        for (int s = 0; s < sections.size(); s++)
+            sections_valid[s] = (checksum(raws[s].p, raws[s].size()) == sections[s].checksum);
+
+        for (int s = 0; s < sections.size(); s++) {
+            if (!sections_valid[s])
+                return false;
+        }
+    }
+
+    int last = sections.size() - 1;
+
+    // components are parsed concurrently between meta and state. reading meta checks that each appears once
+    if (!parse_section(raws[0], borrow[0], sections, 0))
+        return false;
+
+    Byte_Buffer sections_parsed(sections.size(), true);
+
+    PARALLEL_TASKS(sections.size() > 3)
+    {
+        for (int s = 1; s < last; s++) {
+            TASK
+            {
+                sections_parsed[s] = parse_section(raws[s], borrow[s], sections, s);
+
+                // free as we go
+                raw_buffers[s].resize(0);
+                stored_buffers[s].resize(0);
+            }
+        }
+    }
+
+    for (int s = 1; s < last; s++) {
+        if (!sections_parsed[s])
+            return false;
+    }
+
+    // the state needs all components, and is allocated by the layout they must fit
+    if (!components_fit())
+        return false;
+
+    return parse_section(raws[last], borrow[last], sections, last);
+}
+
+bool Hierarchy::read(
+    Stream_Reader &reader,
+    bool verify
+) {
+    int magic;
+    int version;
+    int num_sections;
+
+    reader.read(reinterpret_cast<void*>(&magic), sizeof(int));
+
+    if (magic != hierarchy_magic)
+        return false;
+
+    reader.read(reinterpret_cast<void*>(&version), sizeof(int));
+
+    if (version != hierarchy_version)
+        return false;
+
+    reader.read(reinterpret_cast<void*>(&num_sections), sizeof(int));
+
+    // at least meta, one encoder, params and state
+    if (num_sections < 4)
+        return false;
+
+    // the section table must fit in the input
+    if (reader.remaining() >= 0 && header_size(num_sections) - header_size(0) > reader.remaining())
+        return false;
+
+    // if the length of the input is not known, the table grows with the entries read instead of being sized by num_sections up front
+    Array<Section> sections(reader.remaining() >= 0 ? num_sections : min(num_sections, 64));
+
+    for (int s = 0; s < num_sections; s++) {
+        if (s == sections.size()) {
+            if (!reader.good())
+                return false;
+
+            sections.resize(min(num_sections, s * 2));
+        }
+
+        Section &section = sections[s];
+
+        reader.read(reinterpret_cast<void*>(&section.type), sizeof(int));
+        reader.read(reinterpret_cast<void*>(&section.layer), sizeof(int));
+        reader.read(reinterpret_cast<void*>(&section.index), sizeof(int));
+        reader.read(reinterpret_cast<void*>(&section.compression), sizeof(int));
+        reader.read(reinterpret_cast<void*>(&section.offset), sizeof(long long));
+        reader.read(reinterpret_cast<void*>(&section.size), sizeof(long long));
+        reader.read(reinterpret_cast<void*>(&section.stored_size), sizeof(long long));
+
+        reader.read(reinterpret_cast<void*>(&section.checksum), sizeof(long long));
+
+        if (section.compression != compression_none && section.compression != compression_rans)
+            return false;
+
+        if (section.size < 0 || section.stored_size < 0)
+            return false;
+
+        // sections are held whole in buffers, which must be able to index them
+        if (static_cast<Index>(section.size) != section.size || static_cast<Index>(section.stored_size) != section.stored_size)
+            return false;
+
+        if (section.compression == compression_none && section.stored_size != section.size)
+            return false;
+    }
+
+    // the meta section sizes everything else, the state section needs everything else
+    if (sections[0].type != section_meta || sections[num_sections - 1].type != section_state)
+        return false;
+
+    if (!reader.good())
+        return false;
+
+    long long pos = header_size(sections.size());
+
+    // reject sections past the end of the input, before buffers are sized by them
+    long long remaining = reader.remaining();
+
+    if (remaining >= 0) {
+        long long end = pos + remaining;
+
+        for (int s = 0; s < sections.size(); s++) {
+            if (sections[s].offset < pos || sections[s].stored_size > end - sections[s].offset)
+                return false;
+        }
+    }
+
+    if (!read_sections(reader, sections, pos, verify))
+        return false;
+
+    // the model's stream is not written, derive it without advancing the default state's
+    unsigned long default_stream = default_state.rand_state;
+
+    rand_state = rand_get_state(rand(&default_stream));
+
+    pack();
+
+    return true;
+}
+
+void Hierarchy::clear_dirty() {
+    for (int l = 0; l < encoders.size(); l++) {
+        encoders[l].clear_dirty();
+
+        for (int d = 0; d < decoders[l].size(); d++)
+            decoders[l][d].clear_dirty();
+    }
+
+    for (int d = 0; d < actors.size(); d++)
+        actors[d].clear_dirty();
+}
+
+// continue a checksum with the sizes and radii of a component, which the shape of its weights follows
+template<typename C>
+static unsigned long long component_checksum(
+    const C &component,
+    unsigned long long hash
+) {
+    Memory_Writer shape;
+
+    write_int3(shape, component.hidden_size);
+
+    for (int vli = 0; vli < component.visible_layer_descs.size(); vli++) {
+        write_int3(shape, component.visible_layer_descs[vli].size);
+
+        shape.write(reinterpret_cast<const void*>(&component.visible_layer_descs[vli].radius), sizeof(int));
+    }
+
+    return checksum(shape.buffer.p, shape.size, hash);
+}
+
+unsigned long long Hierarchy::layout_checksum() const {
+    Section section;
+
+    section.type = section_meta;
+    section.layer = 0;
+    section.index = 0;
+
+    Memory_Writer meta;
+
+    write_section(meta, section);
+
+    // the checkpoint sequence is last, and changes with every delta
+    unsigned long long hash = checksum(meta.buffer.p, meta.size - sizeof(int));
+
+    for (int l = 0; l < encoders.size(); l++) {
+        hash = component_checksum(encoders[l], hash);
+
+        for (int d = 0; d < decoders[l].size(); d++)
+            hash = component_checksum(decoders[l][d], hash);
+    }
+
+    for (int d = 0; d < actors.size(); d++)
+        hash = component_checksum(actors[d], hash);
+
+    return hash;
+}
+
+void Hierarchy::write_delta(
+    Stream_Writer &writer
+) {
+    int sequence = checkpoint_sequence + 1;
+
+    long long shape = state_size();
+    unsigned long long layout = layout_checksum();
+
+    writer.write(reinterpret_cast<const void*>(&delta_magic), sizeof(int));
+    writer.write(reinterpret_cast<const void*>(&delta_version), sizeof(int));
+    writer.write(reinterpret_cast<const void*>(&sequence), sizeof(int));
+    writer.write(reinterpret_cast<const void*>(&shape), sizeof(long long));
+    writer.write(reinterpret_cast<const void*>(&layout), sizeof(long long));
+
+    Checksum_Writer checksum_writer(&writer);
+
+    for (int l = 0; l < encoders.size(); l++) {
+        encoders[l].write_delta(checksum_writer);
+
+        for (int d = 0; d < decoders[l].size(); d++)
+            decoders[l][d].write_delta(checksum_writer);
+    }
+
+    for (int d = 0; d < actors.size(); d++)
+        actors[d].write_delta(checksum_writer);
+
+    Section section;
+
+    section.layer = 0;
+    section.index = 0;
+
+    section.type = section_params;
+    write_section(checksum_writer, section);
+
+    section.type = section_state;
+    write_section(checksum_writer, section);
+
+    writer.write(reinterpret_cast<const void*>(&checksum_writer.hash), sizeof(long long));
+
+    clear_dirty();
+
+    checkpoint_sequence = sequence;
+}
+
+bool Hierarchy::read_delta(
+    Stream_Reader &reader,
+    bool verify
+) {
+    int magic;
+    int version;
+    int sequence;
+    long long shape;
+    unsigned long long layout;
+
+    reader.read(reinterpret_cast<void*>(&magic), sizeof(int));
+    reader.read(reinterpret_cast<void*>(&version), sizeof(int));
+    reader.read(reinterpret_cast<void*>(&sequence), sizeof(int));
+    reader.read(reinterpret_cast<void*>(&shape), sizeof(long long));
+    reader.read(reinterpret_cast<void*>(&layout), sizeof(long long));
+
+    if (magic != delta_magic || version != delta_version || sequence != checkpoint_sequence + 1 || shape != state_size() || layout != layout_checksum())
+        return false;
+
+    Checksum_Reader checksum_reader(&reader, verify);
+
+    for (int l = 0; l < encoders.size(); l++) {
+        if (!encoders[l].read_delta(checksum_reader))
+            return false;
+
+        for (int d = 0; d < decoders[l].size(); d++) {
+            if (!decoders[l][d].read_delta(checksum_reader))
+                return false;
+        }
+    }
+
+    for (int d = 0; d < actors.size(); d++) {
+        if (!actors[d].read_delta(checksum_reader))
+            return false;
+    }
+
+    Section section;
+
+    section.layer = 0;
+    section.index = 0;
+
+    section.type = section_params;
+    read_section(checksum_reader, section);
+
+    section.type = section_state;
+    read_section(checksum_reader, section);
+
+    unsigned long long delta_checksum;
+
+    reader.read(reinterpret_cast<void*>(&delta_checksum), sizeof(long long));
+
+    if (!reader.good() || (verify && delta_checksum != checksum_reader.hash))
+        return false;
+
+    // the weights are now those of the delta
+    clear_dirty();
+
+    checkpoint_sequence = sequence;
+
+    return true;
+}
+
+bool aon::compact_checkpoint(
+    Stream_Reader &base,
+    const Array<Stream_Reader*> &deltas,
+    Stream_Writer &writer,
+    bool compress
+) {
+    Hierarchy h;
+
+    if (!h.read(base))
+        return false;
+
+    for (int d = 0; d < deltas.size(); d++) {
+        if (!h.read_delta(*deltas[d]))
+            return false;
+    }
+
+    h.write(writer, compress);
+
+    return true;
+}
+
+void Hierarchy::write_state(
+    Stream_Writer &writer,
+    const State &state
+) const {
+    writer.write(reinterpret_cast<const void*>(&state.updates[0]), state.updates.size() * sizeof(Byte));
+    writer.write(reinterpret_cast<const void*>(&state.ticks[0]), state.ticks.size() * sizeof(int));
+
+    for (int l = 0; l < encoders.size(); l++) {
+        for (int i = 0; i < state.histories[l].size(); i++) {
+            int history_start = state.histories[l][i].start;
+
+            writer.write(reinterpret_cast<const void*>(&history_start), sizeof(int));
+
+            for (int t = 0; t < state.histories[l][i].size(); t++)
+                writer.write(reinterpret_cast<const void*>(&state.histories[l][i][t][0]), state.histories[l][i][t].size() * sizeof(int));
+        }
+
+        encoders[l].write_state(writer, state.encoders[l]);
+
+        // decoders
+        for (int d = 0; d < decoders[l].size(); d++)
+            decoders[l][d].write_state(writer, state.decoders[l][d]);
+    }
+
+    for (int d = 0; d < actors.size(); d++)
+        actors[d].write_state(writer, state.actors[d]);
+
+    write_streams(writer, state);
+}
+
+void Hierarchy::read_state(
+    Stream_Reader &reader,
+    State &state
+) const {
+    // allocate states that do not belong to this hierarchy yet. their streams are read last
+    if (state.histories.size() != encoders.size() || state.actors.size() != actors.size())
+        init_state(state, 0);
+
+    reader.read(reinterpret_cast<void*>(&state.updates[0]), state.updates.size() * sizeof(Byte));
+    reader.read(reinterpret_cast<void*>(&state.ticks[0]), state.ticks.size() * sizeof(int));
+
+    // change detection and accuracies are not saved, they restart. learning deferred before is for what the state held then
+    state.encoders_stepped.fill(false);
+
+    state.layer_accuracies.fill(0.0f);
+    state.layers_frozen.fill(false);
+
+    init_deferred(state);
+
+    for (int l = 0; l < encoders.size(); l++)
+        state.input_repeats[l].fill(0);
+    
+    for (int l = 0; l < encoders.size(); l++) {
+        for (int i = 0; i < state.histories[l].size(); i++) {
+            int history_start;
+            
+            reader.read(reinterpret_cast<void*>(&history_start), sizeof(int));
+
+            state.histories[l][i].start = history_start;
+
+            for (int t = 0; t < state.histories[l][i].size(); t++)
+                reader.read(reinterpret_cast<void*>(&state.histories[l][i][t][0]), state.histories[l][i][t].size() * sizeof(int));
+        }
+
+        encoders[l].read_state(reader, state.encoders[l]);
+        
+        // decoders
+        for (int d = 0; d < decoders[l].size(); d++)
+            decoders[l][d].read_state(reader, state.decoders[l][d]);
+    }
+
+    // actors
+    for (int d = 0; d < actors.size(); d++)
+        actors[d].read_state(reader, state.actors[d]);
+
+    read_streams(reader, state);
+}
+
+void Hierarchy::write_streams(
+    Stream_Writer &writer,
+    const State &state
+) const {
+    writer.write(reinterpret_cast<const void*>(&state.rand_state), sizeof(unsigned long));
+
+    for (int l = 0; l < encoders.size(); l++) {
+        writer.write(reinterpret_cast<const void*>(&state.encoders[l].rand_state), sizeof(unsigned long));
+
+        for (int d = 0; d < decoders[l].size(); d++)
+            writer.write(reinterpret_cast<const void*>(&state.decoders[l][d].rand_state), sizeof(unsigned long));
+    }
+
+    for (int d = 0; d < actors.size(); d++)
+        writer.write(reinterpret_cast<const void*>(&state.actors[d].rand_state), sizeof(unsigned long));
+}
+
+void Hierarchy::read_streams(
+    Stream_Reader &reader,
+    State &state
+) const {
+    reader.read(reinterpret_cast<void*>(&state.rand_state), sizeof(unsigned long));
+
+    for (int l = 0; l < encoders.size(); l++) {
+        reader.read(reinterpret_cast<void*>(&state.encoders[l].rand_state), sizeof(unsigned long));
+
+        for (int d = 0; d < decoders[l].size(); d++)
+            reader.read(reinterpret_cast<void*>(&state.decoders[l][d].rand_state), sizeof(unsigned long));
     }
 
-    // actors
     for (int d = 0; d < actors.size(); d++)
-        actors[d].read_state(reader);
+        reader.read(reinterpret_cast<void*>(&state.actors[d].rand_state), sizeof(unsigned long));
 }
@@ -20,6 +20,41 @@ enum IO_Type {
     action = 2
 };
 
+// serialized hierarchy format: a header (magic, version, number of sections), a table of sections and the sections themselves.
+// sections start at multiples of section_alignment, so arrays in them stay aligned when the file is mapped.
+// compressed sections are split into blocks of compression_block_size bytes, coded independently so they can be decoded in parallel.
+// the raw dump written before this format, without header, is not read
+const int hierarchy_magic = 0x484e4f41; // "AONH"
+const int hierarchy_version = 1;
+const int section_alignment = 64;
+const int compression_block_size = 1 << 20;
+
+// incremental checkpoint (delta) format: a header (magic, version, checkpoint sequence number, the hierarchy's state size and layout checksum),
+// the dirty weights of each encoder, decoder and actor, params, the default state and a checksum of everything after the header
+const int delta_magic = 0x444e4f41; // "AOND"
+const int delta_version = 1;
+
+// type of a section of a serialized hierarchy
+enum Section_Type {
+    section_meta = 0, // layer and IO counts and sizes
+    section_encoder = 1,
+    section_decoder = 2,
+    section_actor = 3,
+    section_params = 4,
+    section_state = 5 // default state
+};
+
+// how a section is stored
+enum Section_Compression {
+    compression_none = 0,
+    compression_rans = 1 // number of blocks, stored size of each block, then the blocks, each rANS coded or raw if that is not smaller
+};
+
+// RNG streams: the model and each state have their own, and components draw from those only, so nothing shares the global
+// stream (global_state), which is not thread safe. it is only drawn from for seeds left out of the constructors and init_random
+// of models and components. init_state without a seed draws from the model's stream, which init_random seeds and read derives
+// from the default state's. streams that were not written (states read on their own, formats from before the streams) start from seed 0
+
 // a sph
 class Hierarchy {
 public:
@@ -77,6 +112,25 @@ public:
     struct Layer_Params {
         Decoder::Params decoder;
         Encoder::Params encoder;
+
+        // whether the encoder and decoders (and actors, for the first layer) of this layer learn, in addition to the step's flag
+        bool learn_enabled;
+
+        // automatic freezing. the layer stops learning from a stream while the moving average of its decoders' prediction accuracy in that stream
+        // is at or above freeze_accuracy, and learns again once it drops below unfreeze_accuracy. actors are not frozen
+        bool auto_freeze;
+        float freeze_accuracy;
+        float unfreeze_accuracy;
+        float accuracy_rate; // moving average rate
+
+        Layer_Params()
+        :
+        learn_enabled(true),
+        auto_freeze(false),
+        freeze_accuracy(0.98f),
+        unfreeze_accuracy(0.9f),
+        accuracy_rate(0.01f)
+        {}
     };
 
     struct IO_Params {
@@ -86,15 +140,117 @@ public:
         // additional
         float importance;
 
+        bool learn_enabled; // whether the decoder or actor of this IO learns, in addition to the layer's and the step's flags
+
         IO_Params()
         :
-        importance(1.0f)
+        importance(1.0f),
+        learn_enabled(true)
         {}
     };
 
     struct Params {
         Array<Layer_Params> layers;
         Array<IO_Params> ios;
+
+        // run all updating layers concurrently (pipelined) instead of one after the other.
+        // each layer then sees the output its lower layer produced on its previous update, and top-down feedback is that of the previous step.
+        // this adds one step of latency per layer to bottom-up information and one step of staleness to top-down feedback
+        bool pipelined;
+
+        // skip activating encoders and decoders whose inputs are the same as on their previous update, reusing their outputs.
+        // a layer is only skipped while its weights are unchanged since its output was computed, so results are the same as without skipping.
+        // learning layers therefore mostly still step.
+        // only applies to sequential (not pipelined, batched or deadline) steps
+        bool skip_unchanged;
+
+        Params()
+        :
+        pipelined(false),
+        skip_unchanged(false)
+        {}
+    };
+
+    // entry of the section table of a serialized hierarchy
+    struct Section {
+        int type; // Section_Type
+        int layer; // layer of encoders and decoders
+        int index; // decoder or actor index
+        int compression; // Section_Compression
+
+        long long offset; // from the start of the header
+        long long size; // in bytes, without padding
+        long long stored_size; // in bytes after compression
+        unsigned long long checksum; // FNV-1a of the section's (uncompressed) bytes
+    };
+
+    // learning deferred by steps of a stream with a deadline, at most one pending update per encoder, decoder and actor.
+    // pending encoder and decoder updates are snapshots of what they would have learned from, actors learn from the stream's history later
+    struct Deferred_Learning {
+        Byte_Buffer encoders_pending;
+        Array<Encoder::State> encoders;
+        Array<Array<Int_Buffer>> encoder_input_cis;
+        Array<Array<Int_Buffer_View>> encoder_input_views;
+
+        Array<Byte_Buffer> decoders_pending;
+        Array<Array<Decoder::State>> decoders;
+        Array<Array<Int_Buffer>> decoder_target_cis;
+
+        Byte_Buffer actors_pending;
+        Float_Buffer actor_mimics;
+
+        int num_pending;
+        int num_dropped;
+
+        Deferred_Learning()
+        :
+        num_pending(0),
+        num_dropped(0)
+        {}
+    };
+
+    // per-stream state. the hierarchy itself (the model) only holds weights and the scratch buffers of learning and batched steps,
+    // so one model can serve many streams, each stepped with its own state. predict paths (rollouts) only write their state,
+    // so they may run concurrently on different states. steps that learn or are batched run one at a time
+    struct State {
+        Array<Encoder::State> encoders;
+        Array<Array<Decoder::State>> decoders;
+        Array<Actor::State> actors;
+
+        // histories. for layers above the first, the most recent entry is normally not stored here, it is the lower encoder's hidden_cis.
+        // the oldest entry is then spare, it is used when pipelined stepping moves the lower layer's previous output into the history
+        Array<Array<Circle_Buffer<Int_Buffer>>> histories;
+
+        // per-layer values
+        Byte_Buffer updates;
+
+        Int_Buffer ticks;
+
+        // per-layer input views, pre-allocated so that step does not allocate
+        Array<Array<Int_Buffer_View>> encoder_input_cis;
+        Array<Array<Int_Buffer_View>> decoder_input_cis;
+
+        // change detection for skip_unchanged. number of times the latest history entry of each layer input repeated the one before it,
+        // and whether each encoder has stepped since the state was cleared (before that its output can not be reused)
+        Array<Int_Buffer> input_repeats;
+        Byte_Buffer encoders_stepped;
+
+        // spare buffers holding the previous top-down feedback to each layer (except the last) while the layer above updates concurrently (pipelined)
+        Array<Int_Buffer> feedback_cis;
+
+        // per-layer prediction accuracy averages and freezing, for automatic freezing. not saved, they restart when the state is read
+        Float_Buffer layer_accuracies;
+        Byte_Buffer layers_frozen;
+
+        // rollout inputs, fed back from predictions
+        Array<Int_Buffer_View> rollout_input_cis;
+
+        // learning deferred by steps with a deadline, dropped when the state is cleared, read or forked into
+        Deferred_Learning deferred;
+
+        // RNG stream seeding those of the state's encoders, decoders and actors, which they draw from when stepping.
+        // all are written with the state, so a stream read back continues where the written one left off
+        unsigned long rand_state;
     };
 
 
@@ -107,13 +263,26 @@ public:
     Int_Buffer i_indices;
     Int_Buffer d_indices;
 
-    // histories
-    Array<Array<Circle_Buffer<Int_Buffer>>> histories;
+    // block holding the buffers of all layers, see pack
+    Arena arena;
 
-    // per-layer values
-    Byte_Buffer updates;
+    // number of deltas in the history of the weights, saved with them. a delta applies to the weights it follows
+    int checkpoint_sequence;
 
-    Int_Buffer ticks;
+    // the model's RNG stream, seeding states allocated without a seed
+    unsigned long rand_state;
+
+    // batched step scratch, grown to the largest batch seen
+    Int_Buffer batch_streams;
+    Array<Encoder::State*> batch_encoder_states;
+    Array<Decoder::State*> batch_decoder_states;
+    Array<Actor::State*> batch_actor_states;
+    Array<const Array<Int_Buffer_View>*> batch_input_cis;
+    Array<Int_Buffer_View> batch_target_cis;
+    Float_Buffer batch_rewards;
+    Byte_Buffer batch_learn_enabled;
+
+    // per-layer values
     Int_Buffer ticks_per_update;
 
     // input dimensions
@@ -125,59 +294,452 @@ public:
         int i,
         float importance
     ) {
-        for (int t = 0; t < histories[0][i].size(); t++)
-            encoders[0].visible_layers[i * histories[0][i].size() + t].importance = importance;
+        int num_history = encoders[0].visible_layers.size() / io_sizes.size();
+
+        // only written when changed, steps that do not learn then leave the model untouched
+        for (int t = 0; t < num_history; t++) {
+            if (encoders[0].visible_layers[i * num_history + t].importance != importance)
+                encoders[0].visible_layers[i * num_history + t].importance = importance;
+        }
+    }
+
+    // add the inputs of a step to the first layer history and reset per-step values
+    void begin_step(
+        State &state,
+        const Array<Int_Buffer_View> &input_cis
+    ) const;
+
+    // mark layer l of a stream as updating, gather its encoder inputs and move the previous output into the next layer's history
+    void begin_layer_update(
+        State &state,
+        int l
+    ) const;
+
+    // add the previous output of layer l to the next layer's history, by exchanging it with the oldest entry which becomes the new output buffer
+    void push_layer_output(
+        State &state,
+        int l
+    ) const;
+
+    // whether the inputs of updating layer l are the same as on its previous update. call after begin_layer_update
+    bool encoder_inputs_unchanged(
+        const State &state,
+        int l
+    ) const;
+
+    // gather the decoder inputs of layer l of a stream (own hidden state and feedback from above)
+    void gather_decoder_inputs(
+        State &state,
+        int l
+    ) const;
+
+    // whether layer l currently learns in a stream (ignoring the step's flag)
+    bool layer_learning(
+        const State &state,
+        int l
+    ) const {
+        return params.layers[l].learn_enabled && !(params.layers[l].auto_freeze && state.layers_frozen[l]);
+    }
+
+    // whether the decoder or actor of IO i currently learns in a stream (ignoring the step's flag)
+    bool io_learning(
+        const State &state,
+        int i
+    ) const {
+        return io_types[i] == action ? params.layers[0].learn_enabled && params.ios[i].learn_enabled : layer_learning(state, 0) && params.ios[i].learn_enabled;
     }
 
+    // measure how well the decoders of updating layer l predicted their targets and update its freezing. call before they step
+    void update_accuracy(
+        State &state,
+        int l,
+        int history_offset
+    ) const;
+
+    // step the decoders (and actors for the first layer) of layer l on state.decoder_input_cis[l].
+    // history_offset is added to decoder target history indices
+    void step_decoders(
+        State &state,
+        int l,
+        int history_offset,
+        const Array<Int_Buffer_View> &input_cis,
+        bool learn_enabled,
+        float reward,
+        float mimic
+    );
+
+    // step a stream on the forward paths only, without learning or keeping anything for it. actors draw from the state's RNG streams
+    void predict_step(
+        State &state,
+        const Array<Int_Buffer_View> &input_cis
+    ) const;
+
+    // queue learning that did not fit before a deadline, replacing (dropping) a pending update of the same component
+    void defer_encoder_learning(
+        State &state,
+        int l
+    );
+
+    void defer_decoder_learning(
+        State &state,
+        int l,
+        int d,
+        Int_Buffer_View hidden_target_cis
+    );
+
+    void defer_actor_learning(
+        State &state,
+        int d,
+        float mimic
+    );
+
+    // RNG streams of a state, written after everything else, in section order (the state's own, then per layer the encoder's and decoders', then the actors')
+    long long streams_size() const;
+
+    void write_streams(
+        Stream_Writer &writer,
+        const State &state
+    ) const;
+
+    void read_streams(
+        Stream_Reader &reader,
+        State &state
+    ) const;
+
+    // allocate the deferred learning of a state if needed, dropping what is pending
+    void init_deferred(
+        State &state
+    ) const;
+
+    // place the buffers of all layers in an arena, in the order a step uses them (encoders bottom up, then decoders and actors top down)
+    void place(
+        Arena &arena
+    );
+
+    // serialization by section. sections lists the sections in the order they are written, without offsets, sizes and checksums
+    void get_sections(
+        Array<Section> &sections
+    ) const;
+
+    long long section_size(
+        const Section &section
+    ) const;
+
+    void write_section(
+        Stream_Writer &writer,
+        const Section &section
+    ) const;
+
+    // returns false if the section does not fit the sections read before it
+    bool read_section(
+        Stream_Reader &reader,
+        const Section &section
+    );
+
+    // read the meta section, the first in sections. sizes the layers only once the counts, sizes and indices are consistent with each other
+    // and with the table, and the table lists exactly the components they describe
+    bool read_meta(
+        Stream_Reader &reader,
+        const Array<Section> &sections
+    );
+
+    // whether the components read fit the layout read from the meta section, which the state is allocated by
+    bool components_fit() const;
+
+    // checksum of the meta section without the checkpoint sequence, and of the sizes and radii of the components. deltas only apply to the same layout
+    unsigned long long layout_checksum() const;
+
+    // serialize all sections into their own buffers, filling in their sizes and checksums
+    void encode_sections(
+        Array<Section> &sections,
+        Array<Memory_Writer> &raws
+    ) const;
+
+    // compress encoded sections, filling in their stored sizes and compression
+    void compress_sections(
+        Array<Section> &sections,
+        const Array<Memory_Writer> &raws,
+        Array<Byte_Buffer> &stored
+    ) const;
+
+    // read section s from memory holding all of it, borrowing from it if it outlives the hierarchy. returns false if not all of it is read
+    bool parse_section(
+        Byte_Buffer_View raw,
+        bool borrow,
+        const Array<Section> &sections,
+        int s
+    );
+
+    // read the remaining sections in order from a reader positioned at the first one, buffering one at a time to verify it before parsing
+    bool read_streamed(
+        Stream_Reader &reader,
+        const Array<Section> &sections,
+        bool verify
+    );
+
+    // read the remaining sections, starting after the header at pos
+    bool read_sections(
+        Stream_Reader &reader,
+        const Array<Section> &sections,
+        long long pos,
+        bool verify
+    );
+
 public:
     // parameters
     Params params;
 
+    // state of the stream stepped by the overloads without a state argument
+    State default_state;
+
     // default
-    Hierarchy() {}
+    Hierarchy()
+    :
+    checkpoint_sequence(0),
+    rand_state(rand_get_state(0))
+    {}
 
     Hierarchy(
         const Array<IO_Desc> &io_descs, // input-output descriptors
-        const Array<Layer_Desc> &layer_descs // descriptors for layers
+        const Array<Layer_Desc> &layer_descs, // descriptors for layers
+        unsigned int seed = rand() // seed of the weights and the RNG streams
     ) {
-        init_random(io_descs, layer_descs);
+        init_random(io_descs, layer_descs, seed);
     }
     
-    // create a randomly initialized hierarchy
+    // create a randomly initialized hierarchy. the same seed and descriptors give the same hierarchy, and stepping it the same way the same results
     void init_random(
         const Array<IO_Desc> &io_descs, // input-output descriptors
-        const Array<Layer_Desc> &layer_descs // descriptors for layers
+        const Array<Layer_Desc> &layer_descs, // descriptors for layers
+        unsigned int seed = rand() // seed of the weights and the RNG streams
     );
 
-    // simulation step/tick
+    // allocate a cleared state for another stream of this hierarchy
+    void init_state(
+        State &state,
+        unsigned int seed // seed of the state's RNG streams
+    ) const;
+
+    // allocate a cleared state, seeded from the model's RNG stream
+    void init_state(
+        State &state
+    ) {
+        init_state(state, rand(&rand_state));
+    }
+
+    // bytes of the buffers pack moves into one block
+    long long packed_size() const;
+
+    // move the weights and scratch buffers of all layers into one block, in the order a step uses them, instead of an allocation each.
+    // init_random and read pack into an allocated block. if buffer is given it is used instead, it must hold packed_size() bytes
+    // (plus up to array_alignment - 1 to align its start) and outlive the hierarchy's use of it. returns false, changing nothing, if it is too small.
+    // buffers borrowed from a reader stay where they are. copies of a hierarchy own their buffers separately until packed
+    bool pack(
+        Byte_Buffer_View buffer = Byte_Buffer_View()
+    );
+
+    // simulation step/tick of a stream
     void step(
+        State &state, // stream state to advance
         const Array<Int_Buffer_View> &input_cis, // inputs to remember
         bool learn_enabled = true, // whether learning is enabled
         float reward = 0.0f, // reward
         float mimic = 0.0f // mimicry mode
     );
 
-    void clear_state();
+    // step a batch of streams at once. each layer steps the streams it updates for together, reusing its weights across them.
+    // streams may be at different ticks and have their own learning flags and rewards. with learning, the streams of a batch
+    // are all activated before any learns from that step (decoders learn before activating, from the previous step, as usual).
+    // pipelined hierarchies step the streams one after the other
+    void step_batch(
+        const Array<State*> &states, // stream states to advance
+        const Array<Array<Int_Buffer_View>> &input_cis, // inputs to remember, per stream
+        const Byte_Buffer &learn_enabled, // whether learning is enabled, per stream
+        const Float_Buffer &rewards, // rewards, per stream
+        float mimic = 0.0f // mimicry mode
+    );
 
-    // serialization
-    int size() const; // returns size in bytes
-    int state_size() const; // returns size of state in bytes
+    // step a stream, always completing the forward and prediction paths but learning only while get_time() is before deadline.
+    // learning that does not fit is deferred, see drain_learning. decoders and actors of a layer step one after the other.
+    // pipelined hierarchies do not defer learning
+    void step(
+        State &state, // stream state to advance
+        const Array<Int_Buffer_View> &input_cis, // inputs to remember
+        bool learn_enabled, // whether learning is enabled
+        float reward, // reward
+        float mimic, // mimicry mode
+        double deadline // time (see get_time) after which learning is deferred
+    );
+
+    // process the deferred learning of a stream for up to budget seconds, lower layers first. returns whether nothing is left pending.
+    // actors learn from the current history of the stream
+    bool drain_learning(
+        State &state,
+        double budget
+    );
+
+    bool drain_learning(
+        double budget
+    ) {
+        return drain_learning(default_state, budget);
+    }
+
+    // number of deferred updates of a stream waiting to be drained
+    int get_num_pending_learning(
+        const State &state
+    ) const {
+        return state.deferred.num_pending;
+    }
+
+    int get_num_pending_learning() const {
+        return get_num_pending_learning(default_state);
+    }
+
+    // number of deferred updates of a stream dropped because a newer one of the same component was deferred before they were drained
+    int get_num_dropped_learning(
+        const State &state
+    ) const {
+        return state.deferred.num_dropped;
+    }
+
+    int get_num_dropped_learning() const {
+        return get_num_dropped_learning(default_state);
+    }
+
+    // simulation step/tick of the default stream
+    void step(
+        const Array<Int_Buffer_View> &input_cis, // inputs to remember
+        bool learn_enabled = true, // whether learning is enabled
+        float reward = 0.0f, // reward
+        float mimic = 0.0f // mimicry mode
+    ) {
+        step(default_state, input_cis, learn_enabled, reward, mimic);
+    }
+
+    void clear_state(
+        State &state
+    ) const;
+
+    // fork a stream for a speculative rollout, copying its recurrent state and RNG streams into dst. weights stay shared with the model,
+    // and actor histories are not copied, so the fork records no samples and its actors do not learn.
+    // dst is allocated on first use only, so forking into pooled states does not allocate and discarding a fork costs nothing.
+    // forks can be stepped like any other state, but not written
+    void fork(
+        const State &src,
+        State &dst
+    ) const;
+
+    // imagine num_steps steps ahead of a stream without changing it, feeding predictions (and actions) back as inputs.
+    // inputs without predictions are held at their latest value. only the forward paths run, nothing is learned.
+    // actions are sampled from the fork's copy of the stream's RNG streams, so neither the stream nor the model advance and
+    // rolling out the same stream again gives the same trajectory.
+    // the trajectory receives, for each step, the predicted columns of all IOs in order, starting with the stream's current predictions
+    void rollout(
+        const State &state, // stream to imagine from
+        State &scratch, // fork the rollout runs on, reused between calls
+        int num_steps, // number of steps to predict
+        Int_Buffer_View trajectory // num_steps times the total number of IO columns
+    ) const;
 
+    void clear_state() {
+        clear_state(default_state);
+    }
+
+    // serialization. write and read include the default state, in the sectioned format described at hierarchy_magic.
+    // states are written raw, without a header
+    long long size() const; // returns size in bytes, when written uncompressed
+    long long state_size() const; // returns size of a state in bytes
+
+    // sections (one per component) are encoded in parallel. writers backed by memory (Memory_Writer, Span_Writer) receive them in place,
+    // others get checksums from a parallel pass, then the sections in order. compressing encodes the sections into buffers
+    // and entropy codes them in parallel, which shrinks the mostly skewed byte weights.
+    // readers that view memory in place (Mapped_Reader, Span_Reader) have the sections checked and the components parsed in parallel,
+    // others parse them in order as they are read. compressed sections are decompressed in parallel into buffers, so can not be borrowed
     void write(
-        Stream_Writer &writer
+        Stream_Writer &writer,
+        bool compress = false
     ) const;
 
-    void read(
-        Stream_Reader &reader
+    // returns false if the data is not a hierarchy of this format version or is corrupt, in which case the hierarchy is unusable.
+    // verifying checksums reads every byte, turn it off to keep mapped loading (Mapped_Reader) from touching weights until used
+    bool read(
+        Stream_Reader &reader,
+        bool verify = true
     );
 
     void write_state(
+        Stream_Writer &writer,
+        const State &state
+    ) const;
+
+    // incremental checkpoints. learning marks the blocks of weights it changes as dirty (hidden cells of encoders, columns of decoders and actors).
+    // write_delta writes the dirty weights along with params and the default state, then clears them. reading a snapshot and then its deltas in order
+    // restores the latest delta. clear_dirty after writing a snapshot keeps the next delta from repeating what the snapshot holds
+    void clear_dirty();
+
+    void write_delta(
         Stream_Writer &writer
+    );
+
+    // returns false if the delta does not directly follow the current weights, or is corrupt (in which case the hierarchy is unusable)
+    bool read_delta(
+        Stream_Reader &reader,
+        bool verify = true
+    );
+
+    // number of deltas the weights went through
+    int get_checkpoint_sequence() const {
+        return checkpoint_sequence;
+    }
+
+    // reads into a state of this hierarchy, allocating it if needed
+    void read_state(
+        Stream_Reader &reader,
+        State &state
     ) const;
 
+    void write_state(
+        Stream_Writer &writer
+    ) const {
+        write_state(writer, default_state);
+    }
+
     void read_state(
         Stream_Reader &reader
-    );
+    ) {
+        read_state(reader, default_state);
+    }
+
+    // writable view of the history slot the next step of a stream reads input i from.
+    // filling it and passing the same view to step avoids copying the input
+    Int_Buffer_View get_input_slot(
+        State &state,
+        int i
+    ) {
+        return state.histories[0][i].back();
+    }
+
+    Int_Buffer_View get_input_slot(
+        int i
+    ) {
+        return get_input_slot(default_state, i);
+    }
+
+    // history entry t (0 is the most recent) of input i to layer l
+    const Int_Buffer &get_history_cis(
+        const State &state,
+        int l,
+        int i,
+        int t
+    ) const {
+        if (l == 0)
+            return state.histories[l][i][t];
+
+        if (t == 0)
+            return state.encoders[l - 1].hidden_cis;
+
+        return state.histories[l][i][t - 1];
+    }
 
     // get the number of layers (encoders)
     int get_num_layers() const {
@@ -190,38 +752,66 @@ public:
         return d_indices[i] != -1;
     }
 
-    // retrieve predictions
+    // retrieve predictions of a stream
     const Int_Buffer &get_prediction_cis(
+        const State &state,
         int i
     ) const {
         if (io_types[i] == action)
-            return actors[d_indices[i]].hidden_cis;
+            return state.actors[d_indices[i]].hidden_cis;
 
-        return decoders[0][d_indices[i]].hidden_cis;
+        return state.decoders[0][d_indices[i]].hidden_cis;
     }
 
-    // retrieve prediction activations
+    const Int_Buffer &get_prediction_cis(
+        int i
+    ) const {
+        return get_prediction_cis(default_state, i);
+    }
+
+    // retrieve prediction activations of a stream
     const Float_Buffer &get_prediction_acts(
+        const State &state,
         int i
     ) const {
         if (io_types[i] == action)
-            return actors[d_indices[i]].hidden_acts;
+            return state.actors[d_indices[i]].hidden_acts;
 
-        return decoders[0][d_indices[i]].hidden_acts;
+        return state.decoders[0][d_indices[i]].hidden_acts;
+    }
+
+    const Float_Buffer &get_prediction_acts(
+        int i
+    ) const {
+        return get_prediction_acts(default_state, i);
     }
 
     // whether this layer received on update this timestep
+    bool get_update(
+        const State &state,
+        int l
+    ) const {
+        return state.updates[l];
+    }
+
     bool get_update(
         int l
     ) const {
-        return updates[l];
+        return get_update(default_state, l);
     }
 
     // get current layer ticks, relative to previous layer
     int get_ticks(
+        const State &state,
         int l
     ) const {
-        return ticks[l];
+        return state.ticks[l];
+    }
+
+    int get_ticks(
+        int l
+    ) const {
+        return get_ticks(default_state, l);
     }
 
     // get layer ticks per update, relative to previous layer
@@ -250,12 +840,54 @@ public:
         return static_cast<IO_Type>(io_types[i]);
     }
 
+    // moving average of the prediction accuracy of layer l in a stream, measured while auto_freeze is enabled
+    float get_layer_accuracy(
+        const State &state,
+        int l
+    ) const {
+        return state.layer_accuracies[l];
+    }
+
+    float get_layer_accuracy(
+        int l
+    ) const {
+        return get_layer_accuracy(default_state, l);
+    }
+
+    // whether layer l was frozen by auto_freeze in a stream
+    bool get_layer_frozen(
+        const State &state,
+        int l
+    ) const {
+        return state.layers_frozen[l];
+    }
+
+    bool get_layer_frozen(
+        int l
+    ) const {
+        return get_layer_frozen(default_state, l);
+    }
+
     int get_num_encoder_visible_layers(
         int l
     ) const {
         return encoders[l].visible_layers.size();
     }
 
+    // retrieve the hidden state (sparse code) of a layer in a stream
+    const Int_Buffer &get_hidden_cis(
+        const State &state,
+        int l
+    ) const {
+        return state.encoders[l].hidden_cis;
+    }
+
+    const Int_Buffer &get_hidden_cis(
+        int l
+    ) const {
+        return get_hidden_cis(default_state, l);
+    }
+
     // retrieve a sparse coding layer
     Encoder &get_encoder(
         int l
@@ -302,5 +934,28 @@ public:
     ) const {
         return actors[d_indices[i]];
     }
+
+    // retrieve the state of an actor in a stream
+    Actor::State &get_actor_state(
+        State &state,
+        int i
+    ) {
+        return state.actors[d_indices[i]];
+    }
+
+    const Actor::State &get_actor_state(
+        const State &state,
+        int i
+    ) const {
+        return state.actors[d_indices[i]];
+    }
 };
+
+// fold a snapshot and the deltas following it into a new snapshot. returns false if any of them fails to read
+bool compact_checkpoint(
+    Stream_Reader &base,
+    const Array<Stream_Reader*> &deltas,
+    Stream_Writer &writer,
+    bool compress = false
+);
 }
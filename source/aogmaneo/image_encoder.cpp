@@ -60,12 +60,12 @@ void Image_Encoder::forward(
 
                     Int2 offset(ix - field_lower_bound.x, iy - field_lower_bound.y);
 
-                    int wi_start = vld.size.z * (offset.y + diam * (offset.x + diam * hidden_cell_index));
+                    Index wi_start = vld.size.z * (offset.y + diam * (offset.x + diam * static_cast<Index>(hidden_cell_index)));
 
                     int i_start = vld.size.z * (iy + ix * vld.size.y);
 
                     for (int vc = 0; vc < vld.size.z; vc++) {
-                        int wi = vc + wi_start;
+                        Index wi = vc + wi_start;
 
                         float input = vl_inputs[vc + i_start] * byte_inv;
 
@@ -128,12 +128,12 @@ void Image_Encoder::forward(
 
                         Int2 offset(ix - field_lower_bound.x, iy - field_lower_bound.y);
 
-                        int wi_start = vld.size.z * (offset.y + diam * (offset.x + diam * hidden_cell_index));
+                        Index wi_start = vld.size.z * (offset.y + diam * (offset.x + diam * static_cast<Index>(hidden_cell_index)));
 
                         int i_start = vld.size.z * (iy + ix * vld.size.y);
 
                         for (int vc = 0; vc < vld.size.z; vc++) {
-                            int wi = vc + wi_start;
+                            Index wi = vc + wi_start;
 
                             float input = vl_inputs[vc + i_start] * byte_inv;
 
@@ -203,7 +203,7 @@ void Image_Encoder::learn_reconstruction(
 
                     Int2 offset(column_pos.x - visible_center.x + vld.radius, column_pos.y - visible_center.y + vld.radius);
 
-                    int wi = vc + vld.size.z * (offset.y + diam * (offset.x + diam * hidden_cell_index));
+                    Index wi = vc + vld.size.z * (offset.y + diam * (offset.x + diam * static_cast<Index>(hidden_cell_index)));
 
                     sum += vl.weights[wi];
                     count++;
@@ -229,7 +229,7 @@ void Image_Encoder::learn_reconstruction(
 
                     Int2 offset(column_pos.x - visible_center.x + vld.radius, column_pos.y - visible_center.y + vld.radius);
 
-                    int wi = vc + vld.size.z * (offset.y + diam * (offset.x + diam * hidden_cell_index));
+                    Index wi = vc + vld.size.z * (offset.y + diam * (offset.x + diam * static_cast<Index>(hidden_cell_index)));
 
                     vl.weights[wi] = min(255, max(0, rand_roundf(vl.weights[wi] + delta, state)));
                 }
@@ -289,7 +289,7 @@ void Image_Encoder::reconstruct(
 
                     Int2 offset(column_pos.x - visible_center.x + vld.radius, column_pos.y - visible_center.y + vld.radius);
 
-                    int wi = vc + vld.size.z * (offset.y + diam * (offset.x + diam * hidden_cell_index));
+                    Index wi = vc + vld.size.z * (offset.y + diam * (offset.x + diam * static_cast<Index>(hidden_cell_index)));
 
                     sum += vl.weights[wi];
                     count++;
@@ -304,12 +304,15 @@ void Image_Encoder::reconstruct(
 
 void Image_Encoder::init_random(
     const Int3 &hidden_size,
-    const Array<Visible_Layer_Desc> &visible_layer_descs
+    const Array<Visible_Layer_Desc> &visible_layer_descs,
+    unsigned int seed
 ) {
     this->visible_layer_descs = visible_layer_descs;
 
     this->hidden_size = hidden_size;
 
+    rand_state = rand_get_state(seed);
+
     visible_layers.resize(visible_layer_descs.size());
 
     // pre-compute dimensions
@@ -327,12 +330,12 @@ void Image_Encoder::init_random(
         int diam = vld.radius * 2 + 1;
         int area = diam * diam;
 
-        vl.protos.resize(num_hidden_cells * area * vld.size.z);
+        vl.protos.resize(static_cast<Index>(num_hidden_cells) * area * vld.size.z);
         vl.weights.resize(vl.protos.size());
 
         // initialize to random values
-        for (int i = 0; i < vl.protos.size(); i++) {
-            vl.protos[i] = rand() % 256;
+        for (Index i = 0; i < vl.protos.size(); i++) {
+            vl.protos[i] = rand(&rand_state) % 256;
             vl.weights[i] = 127;
         }
 
@@ -350,7 +353,7 @@ void Image_Encoder::step(
 ) {
     int num_hidden_columns = hidden_size.x * hidden_size.y;
     
-    unsigned int base_state = rand();
+    unsigned int base_state = rand(&rand_state);
 
     PARALLEL_FOR
     for (int i = 0; i < num_hidden_columns; i++) {
@@ -365,7 +368,7 @@ void Image_Encoder::step(
 
             int num_visible_columns = vld.size.x * vld.size.y;
 
-            base_state = rand();
+            base_state = rand(&rand_state);
 
             PARALLEL_FOR
             for (int i = 0; i < num_visible_columns; i++) {
@@ -391,8 +394,8 @@ void Image_Encoder::reconstruct(
     }
 }
 
-int Image_Encoder::size() const {
-    int size = sizeof(Int3) + sizeof(float) + hidden_cis.size() * sizeof(int) + hidden_resources.size() * sizeof(float) + sizeof(int);
+long long Image_Encoder::size() const {
+    long long size = 2 * sizeof(int) + sizeof(Int3) + sizeof(Params) + hidden_cis.size() * sizeof(int) + hidden_resources.size() * sizeof(float) + sizeof(unsigned long) + sizeof(int);
 
     for (int vli = 0; vli < visible_layers.size(); vli++) {
         const Visible_Layer &vl = visible_layers[vli];
@@ -407,6 +410,9 @@ int Image_Encoder::size() const {
 void Image_Encoder::write(
     Stream_Writer &writer
 ) const {
+    writer.write(reinterpret_cast<const void*>(&image_encoder_magic), sizeof(int));
+    writer.write(reinterpret_cast<const void*>(&image_encoder_version), sizeof(int));
+
     writer.write(reinterpret_cast<const void*>(&hidden_size), sizeof(Int3));
 
     writer.write(reinterpret_cast<const void*>(&params), sizeof(Params));
@@ -415,6 +421,8 @@ void Image_Encoder::write(
     
     writer.write(reinterpret_cast<const void*>(&hidden_resources[0]), hidden_resources.size() * sizeof(float));
 
+    writer.write(reinterpret_cast<const void*>(&rand_state), sizeof(unsigned long));
+
     int num_visible_layers = visible_layers.size();
 
     writer.write(reinterpret_cast<const void*>(&num_visible_layers), sizeof(int));
@@ -433,7 +441,25 @@ void Image_Encoder::write(
 void Image_Encoder::read(
     Stream_Reader &reader
 ) {
-    reader.read(reinterpret_cast<void*>(&hidden_size), sizeof(Int3));
+    int magic;
+
+    reader.read(reinterpret_cast<void*>(&magic), sizeof(int));
+
+    int version = 0;
+
+    // without a header, the first int is the start of the hidden size
+    if (magic != image_encoder_magic) {
+        hidden_size.x = magic;
+
+        reader.read(reinterpret_cast<void*>(&hidden_size.y), sizeof(Int3) - sizeof(int));
+    }
+    else {
+        reader.read(reinterpret_cast<void*>(&version), sizeof(int));
+
+        assert(version == image_encoder_version);
+
+        reader.read(reinterpret_cast<void*>(&hidden_size), sizeof(Int3));
+    }
 
     int num_hidden_columns = hidden_size.x * hidden_size.y;
     int num_hidden_cells = num_hidden_columns * hidden_size.z;
@@ -448,6 +474,11 @@ void Image_Encoder::read(
 
     reader.read(reinterpret_cast<void*>(&hidden_resources[0]), hidden_resources.size() * sizeof(float));
 
+    if (version > 0)
+        reader.read(reinterpret_cast<void*>(&rand_state), sizeof(unsigned long));
+    else
+        rand_state = rand_get_state(0);
+
     int num_visible_layers;
 
     reader.read(reinterpret_cast<void*>(&num_visible_layers), sizeof(int));
@@ -467,11 +498,8 @@ void Image_Encoder::read(
         int diam = vld.radius * 2 + 1;
         int area = diam * diam;
 
-        vl.protos.resize(num_hidden_cells * area * vld.size.z);
-        vl.weights.resize(vl.protos.size());
-
-        reader.read(reinterpret_cast<void*>(&vl.protos[0]), vl.protos.size() * sizeof(Byte));
-        reader.read(reinterpret_cast<void*>(&vl.weights[0]), vl.weights.size() * sizeof(Byte));
+        read_array(reader, vl.protos, static_cast<Index>(num_hidden_cells) * area * vld.size.z);
+        read_array(reader, vl.weights, vl.protos.size());
 
         vl.reconstruction = Byte_Buffer(num_visible_cells, 0);
     }
@@ -11,6 +11,11 @@
 #include "helpers.h"
 
 namespace aon {
+// serialized image encoder format: a header (magic, version), then the parameters, hidden states, RNG stream and weights.
+// version 0 had no header and no RNG stream
+const int image_encoder_magic = 0x474d494f; // "OIMG"
+const int image_encoder_version = 1;
+
 // image coder
 class Image_Encoder {
 public:
@@ -60,6 +65,8 @@ public:
 
     Float_Buffer hidden_resources;
 
+    unsigned long rand_state; // own RNG stream
+
     // visible layers and associated descriptors
     Array<Visible_Layer> visible_layers;
     Array<Visible_Layer_Desc> visible_layer_descs;
@@ -91,7 +98,8 @@ public:
 
     void init_random(
         const Int3 &hidden_size, // hidden/output size
-        const Array<Visible_Layer_Desc> &visible_layer_descs // descriptors for visible layers
+        const Array<Visible_Layer_Desc> &visible_layer_descs, // descriptors for visible layers
+        unsigned int seed = rand() // seed of the RNG stream
     );
 
     // activate the sparse coder (perform sparse coding)
@@ -111,12 +119,13 @@ public:
     }
 
     // serialization
-    int size() const; // returns size in bytes
+    long long size() const; // returns size in bytes
 
     void write(
         Stream_Writer &writer
     ) const;
 
+    // also reads image encoders written before the format had a header (version 0). their RNG stream was not saved, so it restarts from a fixed seed
     void read(
         Stream_Reader &reader
     );
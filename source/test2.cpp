@@ -0,0 +1,809 @@
+// stepping checks, built with its own copy of the library counting
+// allocations. returns the number of failed checks
+#include "test_helpers.h"
+
+#include <cstdio>
+
+// once warmed up, steps (learning, pipelined, batched) and forks into used
+// states do not allocate
+static void check_allocation_free() {
+#ifdef USE_ALLOCATION_COUNT
+  Hierarchy hier;
+  init_hierarchy(hier);
+
+  Hierarchy::State other;
+  hier.init_state(other, 1);
+
+  Hierarchy::State fork;
+
+  Int_Buffer obs(8);
+  Array<Int_Buffer_View> input_cis(2);
+
+  Array<Hierarchy::State *> states(2);
+  states[0] = &hier.default_state;
+  states[1] = &other;
+
+  Array<Array<Int_Buffer_View>> batch_input_cis(2);
+  batch_input_cis[0].resize(2);
+  batch_input_cis[1].resize(2);
+
+  Int_Buffer batch_obs(8);
+  Byte_Buffer learn_enabled(2, true);
+  Float_Buffer rewards(2, 0.5f);
+
+  for (int pass = 0; pass < 2; pass++) {
+    unsigned long before = allocation_count;
+
+    for (int t = 0; t < 50; t++) {
+      hier.params.pipelined = (t % 2 == 1);
+
+      set_inputs(hier, hier.default_state, 0, t, obs, input_cis);
+      hier.step(input_cis, true, 0.5f);
+
+      hier.fork(hier.default_state, fork);
+
+      hier.params.pipelined = false;
+
+      set_inputs(hier, hier.default_state, 0, t, obs, batch_input_cis[0]);
+      set_inputs(hier, other, 1, t, batch_obs, batch_input_cis[1]);
+      hier.step_batch(states, batch_input_cis, learn_enabled, rewards);
+    }
+
+    // the first pass allocates the fork and the batch scratch
+    if (pass == 1)
+      CHECK(allocation_count == before);
+  }
+#endif
+}
+
+// batched steps give the same results as single steps: without learning for
+// any batch, with learning for batches of one stream
+static void check_step_batch() {
+  Hierarchy single;
+  Hierarchy batched;
+  init_hierarchy(single);
+  init_hierarchy(batched);
+
+  Hierarchy::State single_states[2];
+  Hierarchy::State batched_states[2];
+
+  for (int b = 0; b < 2; b++) {
+    single.init_state(single_states[b], b + 1);
+    batched.init_state(batched_states[b], b + 1);
+  }
+
+  Int_Buffer obs(8);
+  Array<Int_Buffer_View> input_cis(2);
+
+  Array<Hierarchy::State *> states(2);
+  Array<Array<Int_Buffer_View>> batch_input_cis(2);
+  Int_Buffer batch_obs[2] = {Int_Buffer(8), Int_Buffer(8)};
+  Byte_Buffer learn_enabled(2, false);
+  Float_Buffer rewards(2, 0.0f);
+
+  for (int b = 0; b < 2; b++) {
+    states[b] = &batched_states[b];
+    batch_input_cis[b].resize(2);
+  }
+
+  for (int t = 0; t < 30; t++) {
+    for (int b = 0; b < 2; b++) {
+      set_inputs(single, single_states[b], b, t, obs, input_cis);
+      single.step(single_states[b], input_cis, false);
+
+      set_inputs(batched, batched_states[b], b, t, batch_obs[b],
+                 batch_input_cis[b]);
+    }
+
+    batched.step_batch(states, batch_input_cis, learn_enabled, rewards);
+
+    for (int b = 0; b < 2; b++)
+      CHECK(same_predictions(single, single_states[b], batched,
+                             batched_states[b]));
+  }
+
+  states.resize(1);
+  batch_input_cis.resize(1);
+  learn_enabled = Byte_Buffer(1, true);
+  rewards = Float_Buffer(1, 0.5f);
+
+  for (int t = 0; t < 30; t++) {
+    set_inputs(single, single_states[0], 0, t, obs, input_cis);
+    single.step(single_states[0], input_cis, true, 0.5f);
+
+    set_inputs(batched, batched_states[0], 0, t, batch_obs[0],
+               batch_input_cis[0]);
+    batched.step_batch(states, batch_input_cis, learn_enabled, rewards);
+
+    CHECK(same_predictions(single, single_states[0], batched,
+                           batched_states[0]));
+  }
+
+  CHECK(same_weights(single, batched));
+}
+
+// packing (into an allocated or a provided block) does not change results,
+// including after pipelined steps, which exchange feedback buffers with
+// decoder states
+static void check_pack() {
+  // outlives the hierarchy packed into it
+  Byte_Buffer block;
+
+  Hierarchy hier;
+  init_hierarchy(hier);
+
+  hier.params.pipelined = true;
+
+  Int_Buffer obs(8);
+  Array<Int_Buffer_View> input_cis(2);
+
+  for (int t = 0; t < 20; t++) {
+    set_inputs(hier, hier.default_state, 0, t, obs, input_cis);
+    hier.step(input_cis, true, 0.5f);
+  }
+
+  Hierarchy reference = hier;
+
+  CHECK(hier.pack());
+
+  Byte_Buffer too_small(hier.packed_size() / 2);
+  CHECK(!hier.pack(too_small));
+
+  for (int t = 20; t < 40; t++) {
+    set_inputs(hier, hier.default_state, 0, t, obs, input_cis);
+    hier.step(input_cis, true, 0.5f);
+
+    set_inputs(reference, reference.default_state, 0, t, obs, input_cis);
+    reference.step(input_cis, true, 0.5f);
+
+    CHECK(same_predictions(hier, hier.default_state, reference,
+                           reference.default_state));
+  }
+
+  block.resize(hier.packed_size() + array_alignment);
+  CHECK(hier.pack(block));
+
+  hier.params.pipelined = false;
+  reference.params.pipelined = false;
+
+  for (int t = 40; t < 60; t++) {
+    set_inputs(hier, hier.default_state, 0, t, obs, input_cis);
+    hier.step(input_cis, true, 0.5f);
+
+    set_inputs(reference, reference.default_state, 0, t, obs, input_cis);
+    reference.step(input_cis, true, 0.5f);
+
+    CHECK(same_predictions(hier, hier.default_state, reference,
+                           reference.default_state));
+  }
+
+  CHECK(same_weights(hier, reference));
+}
+
+// skipping layers whose inputs did not change gives the same results as
+// stepping them, also when they learn on the repeated input
+static void check_skip_unchanged() {
+  Hierarchy skipping;
+  Hierarchy stepping;
+  init_hierarchy(skipping);
+  init_hierarchy(stepping);
+
+  skipping.params.skip_unchanged = true;
+
+  Int_Buffer obs(8);
+  Int_Buffer actions(2, 1);
+  Array<Int_Buffer_View> input_cis(2);
+
+  for (int t = 0; t < 100; t++) {
+    // changing inputs first, then held still
+    for (int i = 0; i < obs.size(); i++)
+      obs[i] = ((t < 20 ? t : 20) + i * 3) % 16;
+
+    input_cis[0] = obs;
+    input_cis[1] = actions;
+
+    // learning throughout, then not at all, then on every other step
+    bool learn_enabled = (t < 40 || (t >= 70 && t % 2 == 0));
+
+    skipping.step(input_cis, learn_enabled, 0.5f);
+    stepping.step(input_cis, learn_enabled, 0.5f);
+
+    CHECK(same_predictions(skipping, skipping.default_state, stepping,
+                           stepping.default_state));
+  }
+
+  skipping.params.skip_unchanged = false;
+
+  CHECK(same_weights(skipping, stepping));
+}
+
+// average reward over the last steps of a task rewarding actions that repeat
+// the previous observation
+static float train_repeat(Hierarchy &hier, int num_steps, int num_scored) {
+  Int_Buffer obs(1);
+  Int_Buffer action(1);
+  Array<Int_Buffer_View> input_cis(2);
+
+  int obs_prev = 0;
+  float total = 0.0f;
+
+  for (int t = 0; t < num_steps; t++) {
+    obs[0] = (t * 7) % 4;
+    action[0] = hier.get_prediction_cis(1)[0];
+
+    float reward = (action[0] == obs_prev ? 1.0f : 0.0f);
+
+    if (t >= num_steps - num_scored)
+      total += reward;
+
+    input_cis[0] = obs;
+    input_cis[1] = action;
+
+    hier.step(input_cis, true, reward);
+
+    obs_prev = obs[0];
+  }
+
+  return total / num_scored;
+}
+
+// a fixed-point actor learns about as well as a float one, and a trained
+// float actor fits the fixed-point range
+static void check_fixed_point() {
+  Array<Hierarchy::IO_Desc> ios(2);
+  ios[0] = Hierarchy::IO_Desc(Int3(1, 1, 4), prediction);
+  ios[1] = Hierarchy::IO_Desc(Int3(1, 1, 4), action);
+
+  Array<Hierarchy::Layer_Desc> descs(1);
+  descs[0] = Hierarchy::Layer_Desc(Int3(2, 2, 16));
+
+  Hierarchy floating;
+  floating.init_random(ios, descs, 1);
+
+  Hierarchy fixed = floating;
+  CHECK(fixed.get_actor(0).set_fixed_point(true) == 0);
+
+  float floating_reward = train_repeat(floating, 3000, 500);
+  float fixed_reward = train_repeat(fixed, 3000, 500);
+
+  // chance is 0.25
+  CHECK(floating_reward > 0.4f);
+  CHECK(fixed_reward > 0.4f);
+  CHECK(fixed_reward > floating_reward - 0.1f &&
+        fixed_reward < floating_reward + 0.1f);
+
+  CHECK(floating.get_actor(0).set_fixed_point(true) == 0);
+}
+
+// actors keeping most of their history in a spill file learn the same as
+// ones keeping all of it in memory, also in copies of the spilling state.
+// written states differ, as spilled histories are written as if they started
+// at 0, so the actor weights are compared on their own
+static bool same_actor_weights(const Hierarchy &a, const Hierarchy &b) {
+  Memory_Writer wa;
+  Memory_Writer wb;
+
+  a.get_actor(1).write(wa);
+  b.get_actor(1).write(wb);
+
+  return same_bytes(wa, wb);
+}
+
+static void spill_run(Hierarchy &spilling, Hierarchy &resident, int start,
+                      int num_steps) {
+  for (int t = start; t < start + num_steps; t++) {
+    run(spilling, spilling.default_state, t, 1, true);
+    run(resident, resident.default_state, t, 1, true);
+
+    CHECK(same_predictions(spilling, spilling.default_state, resident,
+                           resident.default_state));
+  }
+
+  CHECK(same_actor_weights(spilling, resident));
+}
+
+static void check_history_spill() {
+  const char *file_name = "test2_history_spill.bin";
+
+  Hierarchy spilling;
+  Hierarchy resident;
+  init_hierarchy(spilling);
+  init_hierarchy(resident);
+
+  Actor::State &actor_state =
+      spilling.get_actor_state(spilling.default_state, 1);
+
+  CHECK(spilling.get_actor(1).set_history_spill(actor_state, file_name, 4));
+  CHECK(actor_state.spill_rewards.size() > 0);
+
+  spill_run(spilling, resident, 0, 60);
+
+  {
+    Hierarchy spilling_copy = spilling;
+    Hierarchy resident_copy = resident;
+
+    spill_run(spilling_copy, resident_copy, 60, 20);
+  }
+
+  // the copies used their own files
+  spill_run(spilling, resident, 60, 20);
+
+  CHECK(spilling.get_actor(1).set_history_spill(actor_state, nullptr, 0));
+
+  std::remove(file_name);
+}
+
+// actors with a shared learner act (select actions and estimate values) with
+// its weights and leave learning to it, which replays the histories of all of
+// them
+static void check_shared_learner() {
+  Hierarchy learner;
+  init_hierarchy(learner);
+
+  Actor &learner_actor = learner.get_actor(1);
+
+  Hierarchy followers[2];
+
+  Array<const Actor::State *> streams(2);
+
+  for (int b = 0; b < 2; b++) {
+    init_hierarchy(followers[b]);
+
+    followers[b].get_actor(1).set_learner(&learner_actor);
+
+    streams[b] = &followers[b].get_actor_state(followers[b].default_state, 1);
+  }
+
+  Memory_Writer own_weights;
+  followers[0].get_actor(1).write(own_weights);
+
+  Memory_Writer initial_weights;
+  learner_actor.write(initial_weights);
+
+  for (int t = 0; t < 60; t++) {
+    for (int b = 0; b < 2; b++)
+      run(followers[b], followers[b].default_state, t + b * 100, 1, true);
+
+    if (t % 10 == 9)
+      learner_actor.learn_streams(streams, 0.0f,
+                                  learner.params.ios[1].actor);
+  }
+
+  Memory_Writer own_weights_after;
+  followers[0].get_actor(1).write(own_weights_after);
+
+  Memory_Writer learned_weights;
+  learner_actor.write(learned_weights);
+
+  CHECK(same_bytes(own_weights, own_weights_after));
+  CHECK(!same_bytes(initial_weights, learned_weights));
+
+  // a copy does not share the learner, but acts the same with its weights
+  Hierarchy copy = followers[0];
+  copy.get_actor(1) = learner_actor;
+
+  for (int t = 60; t < 70; t++) {
+    run(followers[0], followers[0].default_state, t, 1, false);
+    run(copy, copy.default_state, t, 1, false);
+
+    CHECK(same_predictions(followers[0], followers[0].default_state, copy,
+                           copy.default_state));
+
+    const Actor::State &state =
+        followers[0].get_actor_state(followers[0].default_state, 1);
+    const Actor::State &copy_state =
+        copy.get_actor_state(copy.default_state, 1);
+
+    for (int i = 0; i < state.hidden_values.size(); i++)
+      CHECK(state.hidden_values[i] == copy_state.hidden_values[i]);
+  }
+}
+
+// inputs filled in place in their history slots step the same as copied
+// ones, and histories hold the latest inputs most recent first
+static void check_input_slots() {
+  Hierarchy in_place;
+  Hierarchy copied;
+  init_hierarchy(in_place);
+  init_hierarchy(copied);
+
+  Int_Buffer obs(8);
+  Int_Buffer obs_prev(8);
+  Int_Buffer actions(2);
+  Array<Int_Buffer_View> input_cis(2);
+  Array<Int_Buffer_View> slot_input_cis(2);
+
+  for (int t = 0; t < 60; t++) {
+    set_inputs(copied, copied.default_state, 0, t, obs, input_cis);
+
+    // a copy, as the slot is, instead of a view of the predictions the step
+    // overwrites
+    actions = copied.get_prediction_cis(1);
+    input_cis[1] = actions;
+
+    copied.step(input_cis, true, 0.5f);
+
+    for (int i = 0; i < 2; i++) {
+      slot_input_cis[i] = in_place.get_input_slot(i);
+
+      const Int_Buffer &source =
+          (i == 0 ? obs : in_place.get_prediction_cis(i));
+
+      for (int j = 0; j < source.size(); j++)
+        slot_input_cis[i][j] = source[j];
+    }
+
+    in_place.step(slot_input_cis, true, 0.5f);
+
+    CHECK(same_predictions(in_place, in_place.default_state, copied,
+                           copied.default_state));
+
+    const Int_Buffer &latest =
+        in_place.get_history_cis(in_place.default_state, 0, 0, 0);
+
+    for (int j = 0; j < obs.size(); j++)
+      CHECK(latest[j] == obs[j]);
+
+    if (t > 0) {
+      const Int_Buffer &previous =
+          in_place.get_history_cis(in_place.default_state, 0, 0, 1);
+
+      for (int j = 0; j < obs.size(); j++)
+        CHECK(previous[j] == obs_prev[j]);
+    }
+
+    obs_prev = obs;
+  }
+
+  CHECK(same_weights(in_place, copied));
+}
+
+// rollouts leave the stream and the model as they were, repeat the same
+// trajectory, and imagine what stepping without learning on fed back
+// predictions would give
+static void check_rollout() {
+  Hierarchy hier;
+  init_hierarchy(hier);
+
+  run(hier, hier.default_state, 0, 40, true);
+
+  Memory_Writer before;
+  hier.write(before);
+
+  const int num_steps = 10;
+  int num_columns = 8 + 2;
+
+  Int_Buffer trajectory(num_steps * num_columns);
+  Int_Buffer repeated(trajectory.size());
+
+  Hierarchy::State scratch;
+
+  hier.rollout(hier.default_state, scratch, num_steps, trajectory);
+  hier.rollout(hier.default_state, scratch, num_steps, repeated);
+
+  Memory_Writer after;
+  hier.write(after);
+
+  CHECK(same_bytes(before, after));
+
+  for (int j = 0; j < trajectory.size(); j++)
+    CHECK(trajectory[j] == repeated[j]);
+
+  // the same steps on a copy
+  Hierarchy copy = hier;
+
+  Int_Buffer inputs[2] = {Int_Buffer(8), Int_Buffer(2)};
+  Array<Int_Buffer_View> input_cis(2);
+
+  for (int t = 0; t < num_steps; t++) {
+    if (t > 0)
+      copy.step(input_cis, false);
+
+    for (int i = 0; i < 2; i++) {
+      inputs[i] = copy.get_prediction_cis(i);
+      input_cis[i] = inputs[i];
+    }
+
+    for (int j = 0; j < 8; j++)
+      CHECK(trajectory[t * num_columns + j] == inputs[0][j]);
+
+    for (int j = 0; j < 2; j++)
+      CHECK(trajectory[t * num_columns + 8 + j] == inputs[1][j]);
+  }
+}
+
+template <typename T> static Memory_Writer written_component(const T &c) {
+  Memory_Writer writer;
+  c.write(writer);
+
+  return writer;
+}
+
+// layers and IOs with learning turned off keep their weights while the rest
+// learns. auto_freeze stops a layer learning a sequence it predicts, and
+// resumes it once the inputs become unpredictable
+static void check_learning_control() {
+  Hierarchy hier;
+  init_hierarchy(hier);
+
+  hier.params.layers[1].learn_enabled = false;
+  hier.params.ios[1].learn_enabled = false;
+
+  Memory_Writer encoder0 = written_component(hier.get_encoder(0));
+  Memory_Writer encoder1 = written_component(hier.get_encoder(1));
+  Memory_Writer decoder1 = written_component(hier.get_decoder(1, 0));
+  Memory_Writer actor = written_component(hier.get_actor(1));
+
+  run(hier, hier.default_state, 0, 30, true);
+
+  CHECK(!same_bytes(encoder0, written_component(hier.get_encoder(0))));
+  CHECK(same_bytes(encoder1, written_component(hier.get_encoder(1))));
+  CHECK(same_bytes(decoder1, written_component(hier.get_decoder(1, 0))));
+  CHECK(same_bytes(actor, written_component(hier.get_actor(1))));
+
+  Hierarchy freezing;
+  init_hierarchy(freezing);
+
+  Hierarchy::Layer_Params &layer_params = freezing.params.layers[0];
+  layer_params.auto_freeze = true;
+  layer_params.freeze_accuracy = 0.9f;
+  layer_params.unfreeze_accuracy = 0.6f;
+  layer_params.accuracy_rate = 0.1f;
+
+  run(freezing, freezing.default_state, 0, 150, true);
+
+  CHECK(freezing.get_layer_accuracy(0) >= 0.9f);
+  CHECK(freezing.get_layer_frozen(0));
+  CHECK(!freezing.get_layer_frozen(1));
+
+  Memory_Writer frozen_encoder = written_component(freezing.get_encoder(0));
+  Memory_Writer frozen_decoder = written_component(freezing.get_decoder(0, 0));
+  Memory_Writer learning_encoder = written_component(freezing.get_encoder(1));
+
+  run(freezing, freezing.default_state, 150, 20, true);
+
+  CHECK(freezing.get_layer_frozen(0));
+  CHECK(same_bytes(frozen_encoder, written_component(freezing.get_encoder(0))));
+  CHECK(same_bytes(frozen_decoder,
+                   written_component(freezing.get_decoder(0, 0))));
+  CHECK(!same_bytes(learning_encoder,
+                    written_component(freezing.get_encoder(1))));
+
+  // unpredictable inputs
+  Int_Buffer obs(8);
+  Array<Int_Buffer_View> input_cis(2);
+  unsigned long noise_state = rand_get_state(5);
+
+  for (int t = 0; t < 20; t++) {
+    for (int i = 0; i < obs.size(); i++)
+      obs[i] = rand(&noise_state) % 16;
+
+    input_cis[0] = obs;
+    input_cis[1] = freezing.get_prediction_cis(1);
+
+    freezing.step(input_cis, true);
+  }
+
+  CHECK(freezing.get_layer_accuracy(0) < 0.6f);
+  CHECK(!freezing.get_layer_frozen(0));
+  CHECK(!same_bytes(frozen_encoder,
+                    written_component(freezing.get_encoder(0))));
+}
+
+// steps with a deadline that is never reached learn like plain steps. with
+// one that passed, learning is deferred until drained, and draining right
+// after the step leaves the same weights as learning in it
+static void check_deadline() {
+  Hierarchy timely;
+  Hierarchy plain;
+  init_hierarchy(timely);
+  init_hierarchy(plain);
+
+  Int_Buffer obs(8);
+  Array<Int_Buffer_View> input_cis(2);
+
+  for (int t = 0; t < 30; t++) {
+    set_inputs(timely, timely.default_state, 0, t, obs, input_cis);
+    timely.step(timely.default_state, input_cis, true, 0.5f, 0.0f,
+                get_time() + 1000.0);
+
+    set_inputs(plain, plain.default_state, 0, t, obs, input_cis);
+    plain.step(input_cis, true, 0.5f);
+
+    CHECK(same_predictions(timely, timely.default_state, plain,
+                           plain.default_state));
+  }
+
+  CHECK(timely.get_num_pending_learning() == 0);
+  CHECK(same_weights(timely, plain));
+
+  Hierarchy late = timely;
+
+  Memory_Writer before;
+  late.write(before);
+
+  // deferred, and replacing what is pending
+  for (int t = 30; t < 33; t++) {
+    set_inputs(late, late.default_state, 0, t, obs, input_cis);
+    late.step(late.default_state, input_cis, true, 0.5f, 0.0f, -1.0);
+  }
+
+  Memory_Writer deferred;
+  late.write(deferred);
+
+  CHECK(late.get_num_pending_learning() > 0);
+  CHECK(late.get_num_dropped_learning() > 0);
+
+  CHECK(late.drain_learning(1000.0));
+  CHECK(late.get_num_pending_learning() == 0);
+
+  Memory_Writer drained;
+  late.write(drained);
+
+  CHECK(!same_bytes(deferred, drained));
+
+  // a deferred step drained at once. only one, as its decoders predicted with
+  // the weights from before learning, which can change what follows
+  set_inputs(timely, timely.default_state, 0, 30, obs, input_cis);
+  timely.step(timely.default_state, input_cis, true, 0.5f, 0.0f, -1.0);
+
+  CHECK(timely.drain_learning(1000.0));
+
+  set_inputs(plain, plain.default_state, 0, 30, obs, input_cis);
+  plain.step(input_cis, true, 0.5f);
+
+  CHECK(same_weights(timely, plain));
+}
+
+// decoders and actors run as tasks when there are at least as many of them as
+// threads, and one after the other otherwise. either way, and for any number
+// of threads, results are the same
+static void check_thread_counts() {
+  int max_threads = get_max_threads();
+
+  Hierarchy reference;
+  init_hierarchy(reference);
+
+  set_num_threads(1);
+  run(reference, reference.default_state, 0, 40, true);
+
+  int thread_counts[] = {2, 4};
+
+  for (int i = 0; i < 2; i++) {
+    set_num_threads(thread_counts[i]);
+
+    Hierarchy hier;
+    init_hierarchy(hier);
+
+    run(hier, hier.default_state, 0, 40, true);
+
+    CHECK(same_predictions(hier, hier.default_state, reference,
+                           reference.default_state));
+    CHECK(same_weights(hier, reference));
+  }
+
+  set_num_threads(max_threads);
+}
+
+// forks step like copies of the stream they were forked from, without
+// changing it, and forking into a used state starts over from the stream
+static void check_fork() {
+  Hierarchy hier;
+  init_hierarchy(hier);
+
+  run(hier, hier.default_state, 0, 40, true);
+
+  Memory_Writer state_before;
+  hier.write_state(state_before);
+
+  Hierarchy::State fork;
+
+  for (int pass = 0; pass < 2; pass++) {
+    hier.fork(hier.default_state, fork);
+
+    Hierarchy copy = hier;
+
+    Int_Buffer obs(8);
+    Int_Buffer actions(2);
+    Int_Buffer copy_actions(2);
+    Array<Int_Buffer_View> input_cis(2);
+
+    for (int t = 40; t < 50; t++) {
+      for (int i = 0; i < obs.size(); i++)
+        obs[i] = (t + i * 3) % 16;
+
+      input_cis[0] = obs;
+
+      actions = hier.get_prediction_cis(fork, 1);
+      input_cis[1] = actions;
+
+      hier.step(fork, input_cis, false);
+
+      copy_actions = copy.get_prediction_cis(1);
+      input_cis[1] = copy_actions;
+
+      copy.step(input_cis, false);
+
+      CHECK(same_predictions(hier, fork, copy, copy.default_state));
+    }
+  }
+
+  Memory_Writer state_after;
+  hier.write_state(state_after);
+
+  CHECK(same_bytes(state_before, state_after));
+}
+
+// array storage is aligned, moves hand it over without allocating, and arrays
+// of arrays keep their elements' storage when they grow
+static void check_array() {
+  for (int size = 1; size < 100; size += 7) {
+    Byte_Buffer bytes(size);
+    Array<double> doubles(size);
+
+    CHECK(reinterpret_cast<unsigned long long>(bytes.p) % array_alignment == 0);
+    CHECK(reinterpret_cast<unsigned long long>(doubles.p) % array_alignment ==
+          0);
+  }
+
+  Int_Buffer a(10, 3);
+  int *storage = a.p;
+
+  unsigned long before = allocation_count;
+
+  Int_Buffer b(static_cast<Int_Buffer &&>(a));
+
+  CHECK(b.p == storage && b.size() == 10 && b[9] == 3);
+  CHECK(a.p == nullptr && a.size() == 0);
+
+  Int_Buffer c;
+  c = static_cast<Int_Buffer &&>(b);
+
+  CHECK(c.p == storage && b.p == nullptr);
+
+  // shrinking and growing back within the capacity
+  c.resize(4);
+  c.resize(10);
+
+  CHECK(c.p == storage);
+  CHECK(allocation_count == before);
+
+  c.reserve(100);
+  before = allocation_count;
+
+  c.resize(100);
+
+  CHECK(allocation_count == before);
+
+  Array<Int_Buffer> nested(2);
+  nested[0] = Int_Buffer(5, 1);
+  nested[1] = Int_Buffer(5, 2);
+
+  int *inner = nested[1].p;
+
+  nested.resize(50);
+
+  CHECK(nested[1].p == inner && nested[1][4] == 2);
+}
+
+int main() {
+  check_allocation_free();
+  check_step_batch();
+  check_pack();
+  check_skip_unchanged();
+  check_fixed_point();
+  check_history_spill();
+  check_shared_learner();
+  check_input_slots();
+  check_rollout();
+  check_learning_control();
+  check_deadline();
+  check_thread_counts();
+  check_fork();
+  check_array();
+
+  if (failures == 0)
+    std::printf("test2 passed\n");
+
+  return failures;
+}
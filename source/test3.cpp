@@ -0,0 +1,704 @@
+// serialization checks. returns the number of failed checks
+#include "test_helpers.h"
+
+#include <aogmaneo/image_encoder.h>
+#include <cstdio>
+#include <cstring>
+
+// reads memory without telling its length, like a pipe
+class Unknown_Length_Reader : public Stream_Reader {
+private:
+  Memory_Reader reader;
+
+public:
+  Unknown_Length_Reader(Byte_Buffer_View data) : reader(data) {}
+
+  void read(void *data, long long len) override { reader.read(data, len); }
+
+  bool good() const override { return reader.good(); }
+};
+
+// written hierarchies read back into the same weights and default state, and
+// continue stepping the same way
+static void check_round_trip() {
+  Hierarchy hier;
+  init_hierarchy(hier);
+
+  run(hier, hier.default_state, 0, 50, true);
+
+  Memory_Writer writer;
+  hier.write(writer);
+
+  CHECK(writer.size == hier.size());
+
+  Hierarchy read;
+  Memory_Reader reader(written(writer));
+  CHECK(read.read(reader));
+
+  Memory_Writer rewritten;
+  read.write(rewritten);
+  CHECK(same_bytes(writer, rewritten));
+
+  Hierarchy streamed;
+  Unknown_Length_Reader streamed_reader(written(writer));
+  CHECK(streamed.read(streamed_reader));
+  CHECK(same_weights(read, streamed));
+
+  Hierarchy copy = hier;
+
+  run(copy, copy.default_state, 50, 20, true);
+  run(read, read.default_state, 50, 20, true);
+
+  CHECK(same_weights(copy, read));
+}
+
+// reading stops with a failure, instead of reading past the end, at any
+// truncation of the input
+static void check_truncated() {
+  Hierarchy hier;
+  init_hierarchy(hier);
+
+  run(hier, hier.default_state, 0, 20, true);
+
+  Memory_Writer writer;
+  hier.write(writer);
+
+  long long lengths[] = {0, 4, 12, 100, writer.size / 2, writer.size - 1};
+
+  for (int i = 0; i < 6; i++) {
+    Byte_Buffer_View truncated(writer.buffer.p, lengths[i]);
+
+    Hierarchy read;
+    Memory_Reader reader(truncated);
+    CHECK(!read.read(reader));
+
+    Hierarchy streamed;
+    Unknown_Length_Reader streamed_reader(truncated);
+    CHECK(!streamed.read(streamed_reader));
+  }
+}
+
+// meta counts and table sizes that do not fit the rest are rejected before
+// anything is sized by them, even without checksums and input length
+static void check_corrupt() {
+  Hierarchy hier;
+  init_hierarchy(hier);
+
+  Memory_Writer writer;
+  hier.write(writer);
+
+  // header is magic, version and section count, then the table entries
+  // (type, layer, index, compression, offset, size, stored size, checksum)
+  const long long table = 3 * sizeof(int);
+  const long long entry = 4 * sizeof(int) + 4 * sizeof(long long);
+
+  long long meta_offset;
+  std::memcpy(&meta_offset, writer.buffer.p + table + 4 * sizeof(int),
+              sizeof(long long));
+
+  // ticks of layer 1, after the counts, IO sizes and IO types of the 2 IOs
+  long long ticks_offset =
+      meta_offset + 4 * sizeof(int) + 2 * (3 * sizeof(int) + 1) + sizeof(int);
+
+  long long huge_size = 1ll << 40;
+
+  for (int c = 0; c < 3; c++) {
+    Byte_Buffer corrupt(writer.size);
+    std::memcpy(corrupt.p, writer.buffer.p, writer.size);
+
+    if (c == 0) {
+      int ticks = 0x7fffffff;
+      std::memcpy(corrupt.p + ticks_offset, &ticks, sizeof(int));
+    } else {
+      // size and stored size of the first encoder section
+      std::memcpy(corrupt.p + table + entry + 4 * sizeof(int) +
+                      c * sizeof(long long),
+                  &huge_size, sizeof(long long));
+    }
+
+    Hierarchy read;
+    Memory_Reader reader(Byte_Buffer_View(corrupt.p, corrupt.size()));
+    CHECK(!read.read(reader, false));
+
+    Hierarchy streamed;
+    Unknown_Length_Reader streamed_reader(
+        Byte_Buffer_View(corrupt.p, corrupt.size()));
+    CHECK(!streamed.read(streamed_reader, false));
+  }
+}
+
+// compressed models are smaller and read back into the same model as
+// uncompressed ones. truncated ones are rejected
+static void check_compressed() {
+  Hierarchy hier;
+  init_hierarchy(hier);
+
+  run(hier, hier.default_state, 0, 50, true);
+
+  Memory_Writer raw;
+  hier.write(raw);
+
+  Memory_Writer compressed;
+  hier.write(compressed, true);
+
+  CHECK(compressed.size < raw.size);
+
+  Hierarchy read;
+  Memory_Reader reader(written(compressed));
+  CHECK(read.read(reader));
+
+  Memory_Writer rewritten;
+  read.write(rewritten);
+  CHECK(same_bytes(raw, rewritten));
+
+  Hierarchy streamed;
+  Unknown_Length_Reader streamed_reader(written(compressed));
+  CHECK(streamed.read(streamed_reader));
+  CHECK(same_weights(read, streamed));
+
+  long long lengths[] = {100, compressed.size / 2, compressed.size - 1};
+
+  for (int i = 0; i < 3; i++) {
+    Hierarchy truncated;
+    Memory_Reader truncated_reader(
+        Byte_Buffer_View(compressed.buffer.p, lengths[i]));
+    CHECK(!truncated.read(truncated_reader));
+  }
+}
+
+// encoders and decoders written before their formats had a header (version
+// 0) read into the same weights, with the stream state they held
+static void check_legacy_components() {
+  // formats now start with magic and version, then the hidden size
+  const long long header = 2 * sizeof(int);
+
+  Array<Encoder::Visible_Layer_Desc> e_descs(2);
+
+  Encoder enc;
+  enc.init_random(Int3(3, 3, 8), e_descs, 5);
+
+  Memory_Writer enc_current;
+  enc.write(enc_current);
+
+  Int_Buffer hidden_cis(9);
+
+  for (int i = 0; i < hidden_cis.size(); i++)
+    hidden_cis[i] = i % 8;
+
+  // version 0 held the hidden states after the hidden size
+  Memory_Writer enc_legacy;
+  enc_legacy.write(enc_current.buffer.p + header, sizeof(Int3));
+  enc_legacy.write(&hidden_cis[0], hidden_cis.size() * sizeof(int));
+  enc_legacy.write(enc_current.buffer.p + header + sizeof(Int3),
+                   enc_current.size - header - sizeof(Int3));
+
+  Encoder enc_read;
+  Encoder::State enc_state;
+  Memory_Reader enc_reader(written(enc_legacy));
+  enc_read.read(enc_reader, &enc_state);
+  CHECK(enc_reader.good() && enc_reader.remaining() == 0);
+
+  Memory_Writer enc_rewritten;
+  enc_read.write(enc_rewritten);
+  CHECK(same_bytes(enc_current, enc_rewritten));
+
+  bool same_state = (enc_state.hidden_cis.size() == hidden_cis.size());
+
+  for (int i = 0; same_state && i < hidden_cis.size(); i++)
+    same_state = (enc_state.hidden_cis[i] == hidden_cis[i]);
+
+  CHECK(same_state);
+
+  Array<Decoder::Visible_Layer_Desc> d_descs(2);
+  d_descs[0].size = d_descs[1].size = Int3(3, 3, 8);
+
+  Decoder dec;
+  dec.init_random(Int3(2, 4, 16), d_descs, 6);
+
+  Memory_Writer dec_current;
+  dec.write(dec_current);
+
+  Float_Buffer hidden_acts(2 * 4 * 16, 0.25f);
+
+  // version 0 held the hidden states after the hidden size and the previous
+  // inputs after the weights of each visible layer
+  Memory_Writer dec_legacy;
+  dec_legacy.write(dec_current.buffer.p + header, sizeof(Int3));
+  dec_legacy.write(&hidden_cis[0], 8 * sizeof(int));
+  dec_legacy.write(&hidden_acts[0], hidden_acts.size() * sizeof(float));
+
+  long long pos = header + sizeof(Int3);
+  dec_legacy.write(dec_current.buffer.p + pos, sizeof(int));
+  pos += sizeof(int);
+
+  for (int vli = 0; vli < d_descs.size(); vli++) {
+    int diam = d_descs[vli].radius * 2 + 1;
+    long long num_weights = 2 * 4 * 16 * diam * diam * d_descs[vli].size.z;
+
+    dec_legacy.write(dec_current.buffer.p + pos,
+                     sizeof(Decoder::Visible_Layer_Desc) + num_weights);
+    pos += sizeof(Decoder::Visible_Layer_Desc) + num_weights;
+
+    dec_legacy.write(&hidden_cis[0], 9 * sizeof(int));
+  }
+
+  CHECK(pos == dec_current.size);
+
+  Decoder dec_read;
+  Decoder::State dec_state;
+  Memory_Reader dec_reader(written(dec_legacy));
+  dec_read.read(dec_reader, &dec_state);
+  CHECK(dec_reader.good() && dec_reader.remaining() == 0);
+
+  Memory_Writer dec_rewritten;
+  dec_read.write(dec_rewritten);
+  CHECK(same_bytes(dec_current, dec_rewritten));
+
+  CHECK(dec_state.hidden_cis.size() == 8 && dec_state.hidden_cis[7] == 7);
+  CHECK(dec_state.hidden_acts.size() == hidden_acts.size() &&
+        dec_state.hidden_acts[0] == 0.25f);
+  CHECK(dec_state.input_cis_prev.size() == 2 &&
+        dec_state.input_cis_prev[1][3] == 3);
+}
+
+// image encoders written before their format had a header (version 0), which
+// also lacked the RNG stream, read into the same weights
+static void check_legacy_image_encoder() {
+  Array<Image_Encoder::Visible_Layer_Desc> descs(1);
+  descs[0].size = Int3(8, 8, 3);
+
+  Image_Encoder enc;
+  enc.init_random(Int3(4, 4, 16), descs, 7);
+
+  Memory_Writer current;
+  enc.write(current);
+
+  CHECK(current.size == enc.size());
+
+  // magic and version, then the hidden size, parameters and hidden states
+  // before the RNG stream
+  const long long header = 2 * sizeof(int);
+  long long stream_pos = header + sizeof(Int3) + sizeof(Image_Encoder::Params) +
+                         4 * 4 * sizeof(int) + 4 * 4 * 16 * sizeof(float);
+
+  Memory_Writer legacy;
+  legacy.write(current.buffer.p + header, stream_pos - header);
+  legacy.write(current.buffer.p + stream_pos + sizeof(unsigned long),
+               current.size - stream_pos - sizeof(unsigned long));
+
+  Image_Encoder read;
+  Memory_Reader reader(written(legacy));
+  read.read(reader);
+  CHECK(reader.good() && reader.remaining() == 0);
+
+  // the same apart from the stream, which restarts
+  Memory_Writer rewritten;
+  read.write(rewritten);
+
+  unsigned long fixed_stream = rand_get_state(0);
+  std::memcpy(current.buffer.p + stream_pos, &fixed_stream,
+              sizeof(unsigned long));
+
+  CHECK(same_bytes(current, rewritten));
+}
+
+// the state of any stream, including its RNG streams, reads back into one
+// that steps the same way
+static void check_state_round_trip() {
+  Hierarchy hier;
+  init_hierarchy(hier);
+
+  Hierarchy::State state;
+  hier.init_state(state, 7);
+
+  run(hier, state, 0, 30, false);
+
+  Memory_Writer writer;
+  hier.write_state(writer, state);
+  CHECK(writer.size == hier.state_size());
+
+  Hierarchy::State read;
+  Memory_Reader reader(written(writer));
+  hier.read_state(reader, read);
+  CHECK(reader.good() && reader.remaining() == 0);
+
+  run(hier, state, 30, 20, false);
+  run(hier, read, 30, 20, false);
+
+  Memory_Writer a;
+  Memory_Writer b;
+  hier.write_state(a, state);
+  hier.write_state(b, read);
+  CHECK(same_bytes(a, b));
+}
+
+// allocating and reading states does not draw from the global RNG stream.
+// states allocated without a seed are seeded from the model's stream, the
+// same way for models read back
+static void check_state_streams() {
+  Hierarchy hier;
+  init_hierarchy(hier);
+
+  Memory_Writer writer;
+  hier.write(writer);
+
+  Hierarchy read;
+  Memory_Reader reader(written(writer));
+  CHECK(read.read(reader));
+
+  Hierarchy read_again;
+  Memory_Reader reader_again(written(writer));
+  CHECK(read_again.read(reader_again));
+
+  unsigned long global_before = global_state;
+
+  Hierarchy::State states[3];
+  hier.init_state(states[0]);
+  read.init_state(states[1]);
+  read_again.init_state(states[2]);
+
+  Memory_Writer state_writer;
+  hier.write_state(state_writer, states[0]);
+
+  Hierarchy::State state_read;
+  Memory_Reader state_reader(written(state_writer));
+  hier.read_state(state_reader, state_read);
+
+  CHECK(global_state == global_before);
+
+  Memory_Writer a;
+  Memory_Writer b;
+  read.write_state(a, states[1]);
+  read_again.write_state(b, states[2]);
+  CHECK(same_bytes(a, b));
+}
+
+// a snapshot followed by its deltas reads into the latest weights. deltas
+// out of order are rejected
+static void check_deltas() {
+  Hierarchy hier;
+  init_hierarchy(hier);
+
+  run(hier, hier.default_state, 0, 30, true);
+
+  Memory_Writer snapshot;
+  hier.write(snapshot);
+  hier.clear_dirty();
+
+  Memory_Writer deltas[2];
+
+  for (int d = 0; d < 2; d++) {
+    run(hier, hier.default_state, 30 + d * 20, 20, true);
+
+    hier.write_delta(deltas[d]);
+  }
+
+  CHECK(hier.get_checkpoint_sequence() == 2);
+
+  Hierarchy read;
+  Memory_Reader snapshot_reader(written(snapshot));
+  CHECK(read.read(snapshot_reader));
+
+  Memory_Reader skipped(written(deltas[1]));
+  CHECK(!read.read_delta(skipped));
+
+  for (int d = 0; d < 2; d++) {
+    Memory_Reader reader(written(deltas[d]));
+    CHECK(read.read_delta(reader));
+  }
+
+  Memory_Writer a;
+  Memory_Writer b;
+  hier.write(a);
+  read.write(b);
+  CHECK(same_bytes(a, b));
+}
+
+// deltas do not apply to a hierarchy of another layout, even if its states
+// have the same size
+static void check_delta_layout() {
+  Hierarchy hier;
+  init_hierarchy(hier);
+
+  Memory_Writer snapshot;
+  hier.write(snapshot);
+  hier.clear_dirty();
+
+  run(hier, hier.default_state, 0, 20, true);
+
+  Memory_Writer delta;
+  hier.write_delta(delta);
+
+  // smaller decoder and actor radii change the weights but not the states
+  Array<Hierarchy::IO_Desc> ios(2);
+  ios[0] = Hierarchy::IO_Desc(Int3(2, 4, 16), prediction, 2, 1);
+  ios[1] = Hierarchy::IO_Desc(Int3(1, 2, 4), action, 2, 1, 32);
+
+  Array<Hierarchy::Layer_Desc> descs(3);
+  descs[0] = descs[1] = descs[2] = Hierarchy::Layer_Desc(Int3(3, 3, 8));
+
+  Hierarchy other;
+  other.init_random(ios, descs, 1234);
+
+  CHECK(other.state_size() == hier.state_size());
+
+  Memory_Reader reader(written(delta));
+  CHECK(!other.read_delta(reader));
+
+  Hierarchy same;
+  Memory_Reader snapshot_reader(written(snapshot));
+  CHECK(same.read(snapshot_reader));
+
+  Memory_Reader same_reader(written(delta));
+  CHECK(same.read_delta(same_reader));
+}
+
+// compacting a snapshot and its deltas gives the model they read into
+static void check_compact_checkpoint() {
+  Hierarchy hier;
+  init_hierarchy(hier);
+
+  Memory_Writer snapshot;
+  hier.write(snapshot);
+  hier.clear_dirty();
+
+  Memory_Writer deltas[3];
+
+  for (int d = 0; d < 3; d++) {
+    run(hier, hier.default_state, d * 10, 10, true);
+
+    hier.write_delta(deltas[d]);
+  }
+
+  Array<Stream_Reader *> delta_ptrs(3);
+
+  for (int compress = 0; compress < 2; compress++) {
+    Memory_Reader compact_base(written(snapshot));
+    Memory_Reader compact_deltas[3] = {Memory_Reader(written(deltas[0])),
+                                       Memory_Reader(written(deltas[1])),
+                                       Memory_Reader(written(deltas[2]))};
+
+    for (int d = 0; d < 3; d++)
+      delta_ptrs[d] = &compact_deltas[d];
+
+    Memory_Writer compacted;
+    CHECK(compact_checkpoint(compact_base, delta_ptrs, compacted, compress));
+
+    Hierarchy read;
+    Memory_Reader reader(written(compacted));
+    CHECK(read.read(reader));
+    CHECK(same_weights(hier, read));
+  }
+
+  // a missing delta fails
+  Memory_Reader gap_base(written(snapshot));
+  Memory_Reader gap_delta(written(deltas[1]));
+
+  Array<Stream_Reader *> gap(1);
+  gap[0] = &gap_delta;
+
+  Memory_Writer unused;
+  CHECK(!compact_checkpoint(gap_base, gap, unused));
+}
+
+// bytes written in pieces smaller and larger than the file buffer read back
+// the same in differently sized pieces, and hierarchies go through files
+static void check_file_streams() {
+  const char *file_name = "test3_file_streams.bin";
+
+  Byte_Buffer bytes(file_buffer_size * 2 + 10);
+
+  for (int i = 0; i < bytes.size(); i++)
+    bytes[i] = (i * 7 + i / 251) % 256;
+
+  File_Writer writer;
+  CHECK(writer.open(file_name));
+
+  writer.write(bytes.p, 3);
+  writer.write(bytes.p + 3, file_buffer_size * 2);
+  writer.write(bytes.p + 3 + file_buffer_size * 2, 7);
+
+  CHECK(writer.close());
+
+  Byte_Buffer read_bytes(bytes.size());
+
+  File_Reader reader;
+  CHECK(reader.open(file_name));
+  CHECK(reader.remaining() == bytes.size());
+
+  reader.read(read_bytes.p, 1);
+  reader.read(read_bytes.p + 1, file_buffer_size + 5);
+  reader.read(read_bytes.p + 1 + file_buffer_size + 5,
+              bytes.size() - 1 - file_buffer_size - 5);
+
+  CHECK(reader.good());
+  CHECK(reader.remaining() == 0);
+  CHECK(std::memcmp(bytes.p, read_bytes.p, bytes.size()) == 0);
+
+  // past the end
+  int past = -1;
+  reader.read(&past, sizeof(int));
+
+  CHECK(past == 0);
+  CHECK(!reader.good());
+
+  reader.close();
+
+  Hierarchy hier;
+  init_hierarchy(hier);
+
+  run(hier, hier.default_state, 0, 20, true);
+
+  for (int compress = 0; compress < 2; compress++) {
+    CHECK(writer.open(file_name));
+    hier.write(writer, compress);
+    CHECK(writer.close());
+
+    Hierarchy read;
+    CHECK(reader.open(file_name));
+    CHECK(read.read(reader));
+    CHECK(same_weights(hier, read));
+
+    reader.close();
+  }
+
+  std::remove(file_name);
+
+  CHECK(!reader.open(file_name));
+}
+
+// span writers fill exactly sized memory and flag overflow, span readers
+// borrow from it and stop at its end
+static void check_span_streams() {
+  Hierarchy hier;
+  init_hierarchy(hier);
+
+  run(hier, hier.default_state, 0, 20, true);
+
+  // outlives the hierarchy borrowing from it
+  Byte_Buffer block(hier.size());
+
+  Span_Writer writer(block);
+  hier.write(writer);
+
+  CHECK(writer.good());
+  CHECK(writer.get_size() == block.size());
+
+  {
+    Hierarchy read;
+    Span_Reader reader(block);
+    CHECK(read.read(reader));
+    CHECK(same_weights(hier, read));
+
+    run(hier, hier.default_state, 20, 10, true);
+    run(read, read.default_state, 20, 10, true);
+
+    CHECK(same_weights(hier, read));
+  }
+
+  Byte_Buffer small(block.size() - 1);
+
+  Span_Writer small_writer(small);
+  hier.write(small_writer);
+
+  CHECK(!small_writer.good());
+
+  Span_Reader reader(Byte_Buffer_View(block.p, 8));
+
+  CHECK(reader.view(9) == nullptr);
+  CHECK(reader.view(8) == block.p);
+  CHECK(reader.good());
+
+  int past = -1;
+  reader.read(&past, sizeof(int));
+
+  CHECK(past == 0);
+  CHECK(!reader.good());
+}
+
+// hierarchies loaded from a private mapping of a file borrow their weights
+// from it, step like the original, and leave the file as it was when learning
+static void check_mapped_load() {
+  const char *file_name = "test3_mapped_load.bin";
+
+  Hierarchy hier;
+  init_hierarchy(hier);
+
+  run(hier, hier.default_state, 0, 20, true);
+
+  Memory_Writer original;
+  hier.write(original);
+
+  File_Writer writer;
+  CHECK(writer.open(file_name));
+  hier.write(writer);
+  CHECK(writer.close());
+
+#ifdef USE_MMAP
+  for (int verify = 0; verify < 2; verify++) {
+    // outlives the hierarchy borrowing from it
+    Mapped_Reader reader;
+    CHECK(reader.open(file_name));
+    CHECK(reader.remaining() == original.size);
+
+    Hierarchy mapped;
+    CHECK(mapped.read(reader, verify));
+    CHECK(reader.remaining() == 0);
+    CHECK(same_weights(hier, mapped));
+
+    Hierarchy copy = hier;
+
+    run(copy, copy.default_state, 20, 10, true);
+    run(mapped, mapped.default_state, 20, 10, true);
+
+    CHECK(same_weights(copy, mapped));
+
+    CHECK(reader.view(1) == nullptr);
+
+    int past = -1;
+    reader.read(&past, sizeof(int));
+
+    CHECK(past == 0);
+    CHECK(!reader.good());
+  }
+
+  // learning wrote to private pages only
+  Byte_Buffer on_disk(original.size);
+
+  File_Reader file_reader;
+  CHECK(file_reader.open(file_name));
+  file_reader.read(on_disk.p, on_disk.size());
+  CHECK(file_reader.good());
+
+  file_reader.close();
+
+  CHECK(std::memcmp(on_disk.p, original.buffer.p, original.size) == 0);
+#endif
+
+  std::remove(file_name);
+
+  Mapped_Reader missing;
+  CHECK(!missing.open(file_name));
+}
+
+int main() {
+  check_round_trip();
+  check_state_round_trip();
+  check_state_streams();
+  check_deltas();
+  check_delta_layout();
+  check_compact_checkpoint();
+  check_truncated();
+  check_corrupt();
+  check_compressed();
+  check_legacy_components();
+  check_legacy_image_encoder();
+  check_file_streams();
+  check_span_streams();
+  check_mapped_load();
+
+  if (failures == 0)
+    std::printf("test3 passed\n");
+
+  return failures;
+}
@@ -0,0 +1,100 @@
+// shared by the tests: a check macro counting failures and a small hierarchy
+// fixture stepped on a fixed sequence
+#pragma once
+
+#include <aogmaneo/array.h>
+#include <aogmaneo/helpers.h>
+#include <aogmaneo/hierarchy.h>
+#include <cstdio>
+
+using namespace aon;
+
+// number of failed checks, returned by main
+static int failures = 0;
+
+#define CHECK(cond)                                                            \
+  do {                                                                         \
+    if (!(cond)) {                                                             \
+      std::printf("%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond);     \
+      failures++;                                                              \
+    }                                                                          \
+  } while (0)
+
+// a prediction (observation) and an action IO under three layers
+inline void init_hierarchy(Hierarchy &hier) {
+  Array<Hierarchy::IO_Desc> ios(2);
+  ios[0] = Hierarchy::IO_Desc(Int3(2, 4, 16), prediction);
+  ios[1] = Hierarchy::IO_Desc(Int3(1, 2, 4), action, 2, 2, 32);
+
+  Array<Hierarchy::Layer_Desc> descs(3);
+  descs[0] = descs[1] = descs[2] = Hierarchy::Layer_Desc(Int3(3, 3, 8));
+
+  hier.init_random(ios, descs, 1234);
+}
+
+// observation of step t (a different sequence per stream), actions are fed
+// back from the predictions
+inline void set_inputs(const Hierarchy &hier, const Hierarchy::State &state,
+                       int stream, int t, Int_Buffer &obs,
+                       Array<Int_Buffer_View> &input_cis) {
+  for (int i = 0; i < obs.size(); i++)
+    obs[i] = (t * (stream + 1) + i * 3) % 16;
+
+  input_cis[0] = obs;
+  input_cis[1] = hier.get_prediction_cis(state, 1);
+}
+
+// step stream 0 of a hierarchy from step start
+inline void run(Hierarchy &hier, Hierarchy::State &state, int start,
+                int num_steps, bool learn_enabled) {
+  Int_Buffer obs(8);
+  Array<Int_Buffer_View> input_cis(2);
+
+  for (int t = start; t < start + num_steps; t++) {
+    set_inputs(hier, state, 0, t, obs, input_cis);
+
+    hier.step(state, input_cis, learn_enabled, 0.5f);
+  }
+}
+
+inline bool same_predictions(const Hierarchy &a, const Hierarchy::State &sa,
+                             const Hierarchy &b, const Hierarchy::State &sb) {
+  for (int i = 0; i < a.get_num_io(); i++) {
+    const Int_Buffer &pa = a.get_prediction_cis(sa, i);
+    const Int_Buffer &pb = b.get_prediction_cis(sb, i);
+
+    for (int j = 0; j < pa.size(); j++) {
+      if (pa[j] != pb[j])
+        return false;
+    }
+  }
+
+  return true;
+}
+
+inline bool same_bytes(const Memory_Writer &a, const Memory_Writer &b) {
+  if (a.size != b.size)
+    return false;
+
+  for (long long i = 0; i < a.size; i++) {
+    if (a.buffer[i] != b.buffer[i])
+      return false;
+  }
+
+  return true;
+}
+
+inline Byte_Buffer_View written(const Memory_Writer &writer) {
+  return Byte_Buffer_View(writer.buffer.p, writer.size);
+}
+
+// same weights, parameters and default state
+inline bool same_weights(const Hierarchy &a, const Hierarchy &b) {
+  Memory_Writer wa;
+  Memory_Writer wb;
+
+  a.write(wa);
+  b.write(wb);
+
+  return same_bytes(wa, wb);
+}